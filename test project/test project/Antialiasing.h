@@ -0,0 +1,121 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+#include <cstddef>
+#include <string>
+
+// How smoothly a render target draws edges. Strokes and outlines already
+// carry a feathered edge of their own (StrokeTessellator.h); multisampling
+// also smooths what the feather misses, such as bucket fill edges and thin
+// features shrunk by zooming out. Supersampling, for exports only, renders
+// at a multiple of the output resolution and averages it down, which is
+// slower but also resolves detail finer than a pixel
+struct Antialiasing {
+    static const unsigned MaxSamples = 8;
+    static const unsigned MaxSupersample = 4;
+
+    unsigned samples = 0;     // Multisamples per pixel, 0 for off; drivers may give fewer
+    unsigned supersample = 1; // Output pixels are averaged from supersample x supersample rendered ones
+
+    // Fast enough for weak GPUs while drawing
+    static Antialiasing interactiveDefault() {
+        return Antialiasing();
+    }
+
+    static Antialiasing exportDefault() {
+        Antialiasing quality;
+        quality.samples = 4;
+        quality.supersample = 2;
+        return quality;
+    }
+
+    bool isOff() const { return samples == 0 && supersample <= 1; }
+
+    // Settings to create a window or render texture with, clamped to what
+    // render textures support
+    sf::ContextSettings contextSettings() const {
+        sf::ContextSettings settings;
+        unsigned supported = sf::RenderTexture::getMaximumAntialiasingLevel();
+        settings.antialiasingLevel = samples < supported ? samples : supported;
+        return settings;
+    }
+
+    // Supersampling factor usable for an output of `width` x `height`
+    // pixels rendered in one texture, keeping it within texture limits
+    unsigned supersampleFor(unsigned width, unsigned height) const {
+        unsigned largest = width > height ? width : height;
+        unsigned factor = supersample < 1 ? 1 : supersample;
+        while (factor > 1 && largest * factor > sf::Texture::getMaximumSize()) {
+            --factor;
+        }
+        return factor;
+    }
+
+    // Off, 2x, 4x, 8x multisampling, then back to off
+    Antialiasing nextInteractive() const {
+        Antialiasing next;
+        next.samples = samples == 0 ? 2 : samples < MaxSamples ? samples * 2 : 0;
+        return next;
+    }
+
+    // The export tiers from fastest to finest, the default among them,
+    // then back to off. Settings from elsewhere, such as the command line,
+    // continue from off
+    Antialiasing nextExport() const {
+        static const unsigned tiers[][2] = {
+            { 0, 1 }, { 2, 1 }, { 4, 1 }, { 4, 2 }, { MaxSamples, 1 }, { MaxSamples, 2 }, { MaxSamples, MaxSupersample },
+        };
+        const std::size_t count = sizeof(tiers) / sizeof(tiers[0]);
+        std::size_t current = count - 1;
+        for (std::size_t i = 0; i < count; ++i) {
+            if (tiers[i][0] == samples && tiers[i][1] == (supersample < 1 ? 1 : supersample)) {
+                current = i;
+            }
+        }
+        Antialiasing next;
+        next.samples = tiers[(current + 1) % count][0];
+        next.supersample = tiers[(current + 1) % count][1];
+        return next;
+    }
+
+    std::string describe() const {
+        if (isOff()) {
+            return "off";
+        }
+        std::string text = samples > 0 ? "MSAA " + std::to_string(samples) + "x" : "";
+        if (supersample > 1) {
+            text += (text.empty() ? "" : " + ") + std::to_string(supersample) + "x supersampling";
+        }
+        return text;
+    }
+
+    // Averages each `factor` x `factor` block of the RGBA pixels in `source`,
+    // `sourceWidth` pixels per row, into one pixel of `out`, whose rows are
+    // `outStride` bytes apart. Colours are weighted by their alpha so
+    // transparent pixels do not darken the edges next to them
+    static void downsample(const sf::Uint8* source, unsigned sourceWidth, unsigned factor,
+                           unsigned width, unsigned height, sf::Uint8* out, std::size_t outStride) {
+        unsigned area = factor * factor;
+        for (unsigned y = 0; y < height; ++y) {
+            sf::Uint8* row = out + y * outStride;
+            for (unsigned x = 0; x < width; ++x) {
+                unsigned red = 0, green = 0, blue = 0, alpha = 0;
+                for (unsigned sy = 0; sy < factor; ++sy) {
+                    const sf::Uint8* pixel = source + ((static_cast<std::size_t>(y) * factor + sy) * sourceWidth
+                                                       + static_cast<std::size_t>(x) * factor) * 4;
+                    for (unsigned sx = 0; sx < factor; ++sx, pixel += 4) {
+                        red += pixel[0] * pixel[3];
+                        green += pixel[1] * pixel[3];
+                        blue += pixel[2] * pixel[3];
+                        alpha += pixel[3];
+                    }
+                }
+                sf::Uint8* target = row + static_cast<std::size_t>(x) * 4;
+                target[0] = static_cast<sf::Uint8>(alpha > 0 ? (red + alpha / 2) / alpha : 0);
+                target[1] = static_cast<sf::Uint8>(alpha > 0 ? (green + alpha / 2) / alpha : 0);
+                target[2] = static_cast<sf::Uint8>(alpha > 0 ? (blue + alpha / 2) / alpha : 0);
+                target[3] = static_cast<sf::Uint8>((alpha + area / 2) / area);
+            }
+        }
+    }
+};
@@ -0,0 +1,479 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "DocumentFile.h"
+#include "LayerStack.h"
+#include "ShapeStore.h"
+
+// Append-only journal of edits, replayed on startup to recover work lost
+// in a crash. All values are little-endian.
+//
+//   header  "2DDJ" magic, uint16 version, uint16 reserved
+//   record* uint8 op, uint8 flags, uint16 reserved, uint32 layer, int32 value,
+//           uint32 payload size, uint32 checksum, then the payload
+//
+// AddShapes records have a payload of one chunk of the vector document
+// format (DocumentFile.h). ModifyShapes records (version 2) hold the new
+// versions of the shapes as a chunk, followed by the uint32 index of each
+// one in the layer. The chunks of version 3 and 4 journals are in the
+// format of documents of the same version, those of version 5 in that of
+// version 4 documents. Retract records (version 5) undo the last edit so
+// that it cannot be redone, as when a shared session reorders an edit
+// (NetworkSession.h). The checksum covers the rest of the record, so a
+// record torn by a crash ends the journal instead of being replayed
+namespace AutosaveJournal {
+    const char Magic[4] = { '2', 'D', 'D', 'J' };
+    const std::uint16_t Version = 5;
+
+    enum class Op : std::uint8_t { AddLayer = 1, SetActive, MoveActive, SetFlags, AddShapes, Undo, Redo, Clear, ModifyShapes, Retract };
+
+    // Flags of SetFlags records
+    const std::uint8_t Visible = 1;
+    const std::uint8_t Locked = 2;
+
+    // Flags of AddShapes and ModifyShapes records
+    const std::uint8_t Merge = 1;    // Extends the previous add or modify in the undo history
+    const std::uint8_t Snapshot = 2; // Part of a snapshot, so not undoable
+
+    struct RecordHeader {
+        std::uint8_t op;
+        std::uint8_t flags;
+        std::uint16_t reserved;
+        std::uint32_t layer;
+        std::int32_t value;
+        std::uint32_t payloadSize;
+        std::uint32_t checksum;
+    };
+    static_assert(sizeof(RecordHeader) == 20, "Unexpected record header layout");
+
+    // FNV-1a over the header fields before the checksum and the payload
+    inline std::uint32_t checksum(const RecordHeader& header, const char* payload, std::size_t size) {
+        std::uint32_t hash = 2166136261u;
+        const char* fields = reinterpret_cast<const char*>(&header);
+        for (std::size_t i = 0; i < offsetof(RecordHeader, checksum); ++i) {
+            hash = (hash ^ static_cast<std::uint8_t>(fields[i])) * 16777619u;
+        }
+        for (std::size_t i = 0; i < size; ++i) {
+            hash = (hash ^ static_cast<std::uint8_t>(payload[i])) * 16777619u;
+        }
+        return hash;
+    }
+}
+
+// Encodes edits as journal records, for the journal file and for anything
+// else that sends edits elsewhere, such as a shared session
+class JournalEncoder {
+public:
+    struct ByteSink {
+        std::vector<char>& bytes;
+        void write(const char* data, std::size_t size) {
+            bytes.insert(bytes.end(), data, data + size);
+        }
+    };
+
+private:
+    std::vector<std::uint32_t> pointCounts;
+    ChunkEncoder chunks;
+    ShapeStore modified; // Scratch copy of the shapes of a ModifyShapes record
+
+public:
+    // Appends a record without a payload
+    static void record(std::vector<char>& out, AutosaveJournal::Op op, std::uint8_t flags = 0,
+                       std::uint32_t layer = 0, std::int32_t value = 0) {
+        AutosaveJournal::RecordHeader header = { static_cast<std::uint8_t>(op), flags, 0, layer, value, 0, 0 };
+        header.checksum = AutosaveJournal::checksum(header, nullptr, 0);
+        ByteSink{ out }.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    }
+
+    static std::uint8_t layerFlags(const Layer& layer) {
+        return (layer.visible ? AutosaveJournal::Visible : 0) | (layer.locked ? AutosaveJournal::Locked : 0);
+    }
+
+    // Appends shapes [first, first + count) as AddShapes records of at most
+    // one chunk each, or as ModifyShapes records if `indices` gives the
+    // position in the layer of each of the shapes
+    void shapes(std::vector<char>& out, std::uint32_t layer, const ShapeStore& source,
+                std::size_t first, std::size_t count, std::uint8_t flags, const std::uint32_t* indices = nullptr) {
+        AutosaveJournal::Op op = indices ? AutosaveJournal::Op::ModifyShapes : AutosaveJournal::Op::AddShapes;
+        for (std::size_t end = first + count; first < end; first += pointCounts.size()) {
+            DocumentFile::chunkExtent(source, first,
+                std::min<std::size_t>(DocumentFile::DefaultChunkSize, end - first), pointCounts);
+
+            std::size_t headerAt = out.size();
+            out.resize(headerAt + sizeof(AutosaveJournal::RecordHeader));
+            ByteSink sink{ out };
+            chunks.write(sink, source, first, pointCounts.size());
+            if (indices) {
+                sink.write(reinterpret_cast<const char*>(indices + first), pointCounts.size() * sizeof(std::uint32_t));
+            }
+
+            std::size_t payloadAt = headerAt + sizeof(AutosaveJournal::RecordHeader);
+            AutosaveJournal::RecordHeader header = { static_cast<std::uint8_t>(op), flags, 0,
+                                                     layer, 0, static_cast<std::uint32_t>(out.size() - payloadAt), 0 };
+            header.checksum = AutosaveJournal::checksum(header, out.data() + payloadAt, header.payloadSize);
+            std::memcpy(out.data() + headerAt, &header, sizeof(header));
+
+            // The rest of a split add or modify belongs to the same undo step
+            if (!(flags & AutosaveJournal::Snapshot)) {
+                flags |= AutosaveJournal::Merge;
+            }
+        }
+    }
+
+    // Appends ModifyShapes records of the current versions of the `count`
+    // shapes at `indices` of `layer`, merged into the previous modify if `merge` is set
+    void modifiedShapes(std::vector<char>& out, std::uint32_t layer, const ShapeStore& source,
+                        const std::uint32_t* indices, std::size_t count, bool merge = false) {
+        modified.clear();
+        for (std::size_t i = 0; i < count; ++i) {
+            modified.append(source, indices[i], 1);
+        }
+        shapes(out, layer, modified, 0, count, merge ? AutosaveJournal::Merge : 0, indices);
+    }
+
+    // Appends the records that rebuild `layers` from a new, empty drawing
+    void snapshot(std::vector<char>& out, const LayerStack& layers) {
+        // A new drawing has one layer, and each added layer goes above the
+        // active one, so the layers are rebuilt bottom to top
+        for (std::size_t i = 1; i < layers.size(); ++i) {
+            record(out, AutosaveJournal::Op::AddLayer);
+        }
+        for (std::size_t i = 0; i < layers.size(); ++i) {
+            const Layer& layer = layers[i];
+            record(out, AutosaveJournal::Op::SetFlags, layerFlags(layer), static_cast<std::uint32_t>(i));
+            shapes(out, static_cast<std::uint32_t>(i), layer.shapes, 0, layer.shapes.size(), AutosaveJournal::Snapshot);
+        }
+        record(out, AutosaveJournal::Op::SetActive, 0, static_cast<std::uint32_t>(layers.getActiveIndex()));
+    }
+};
+
+// Records edits as they happen. The UI thread only encodes records into a
+// buffer, handed over once per frame by flush(); a background thread
+// appends each batch to the file. Once the journal has grown past the size
+// of its last snapshot, snapshot() replaces it with records that rebuild
+// the current drawing, so it stays proportional to the drawing and replay
+// stays fast
+class JournalWriter {
+private:
+    static const std::size_t MinSnapshotInterval = 1 << 20; // Journal bytes between snapshots
+
+    struct Job {
+        bool restart; // Replaces the journal with `bytes` instead of appending them
+        std::vector<char> bytes;
+    };
+
+    std::string filename;
+    bool started = false;
+    std::vector<char> pending; // Records not yet handed to the worker
+    JournalEncoder encoder;
+    std::size_t bytesSinceSnapshot = 0;
+    std::size_t snapshotBytes = 0;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<Job> jobs;
+    bool stopping = false;
+    std::atomic<bool> writeFailed{ false };
+
+    std::thread worker; // Declared last so it starts after the state above exists
+
+    void push(bool restart, std::vector<char>& bytes) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs.push_back(Job{ restart, std::vector<char>() });
+            jobs.back().bytes.swap(bytes);
+        }
+        wake.notify_one();
+    }
+
+    void run() {
+        std::ofstream file;
+        for (;;) {
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this] { return stopping || !jobs.empty(); });
+                if (jobs.empty()) {
+                    return; // Stopping, and everything queued has been written
+                }
+                job = std::move(jobs.front());
+                jobs.pop_front();
+            }
+
+            if (job.restart) {
+                // The snapshot is written beside the journal and then swapped
+                // in, so a crash while writing it leaves the old journal intact.
+                // If it cannot be written, appending to the old journal still
+                // replays to the same drawing
+                file.close();
+                std::string temporary = filename + ".tmp";
+                bool written;
+                {
+                    std::ofstream snapshot(temporary, std::ios::binary | std::ios::trunc);
+                    snapshot.write(job.bytes.data(), job.bytes.size());
+                    written = static_cast<bool>(snapshot);
+                }
+                if (written) {
+                    std::remove(filename.c_str());
+                    written = std::rename(temporary.c_str(), filename.c_str()) == 0;
+                }
+                if (!written) {
+                    writeFailed = true;
+                }
+                file.clear();
+                file.open(filename, std::ios::binary | std::ios::app);
+            }
+            else {
+                file.write(job.bytes.data(), job.bytes.size());
+                file.flush();
+            }
+            if (!file) {
+                writeFailed = true;
+            }
+        }
+    }
+
+public:
+    JournalWriter()
+        : worker(&JournalWriter::run, this) {
+    }
+
+    // Writes everything recorded before returning
+    ~JournalWriter() {
+        flush();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_one();
+        worker.join();
+    }
+
+    JournalWriter(const JournalWriter&) = delete;
+    JournalWriter& operator=(const JournalWriter&) = delete;
+
+    // Starts journaling to `file`, replacing it with a snapshot of `layers`.
+    // Until then, recording does nothing, so a journal can be replayed
+    // through the same code paths that record it
+    void start(const std::string& file, const LayerStack& layers) {
+        filename = file;
+        started = true;
+        snapshot(layers);
+    }
+
+    void addLayer() { record(AutosaveJournal::Op::AddLayer); }
+    void setActive(std::size_t layer) { record(AutosaveJournal::Op::SetActive, 0, layer); }
+    void moveActive(int direction) { record(AutosaveJournal::Op::MoveActive, 0, 0, direction); }
+    void undo() { record(AutosaveJournal::Op::Undo); }
+    void redo() { record(AutosaveJournal::Op::Redo); }
+    void retract() { record(AutosaveJournal::Op::Retract); }
+    void clear(std::size_t layer) { record(AutosaveJournal::Op::Clear, 0, layer); }
+
+    void setFlags(std::size_t position, const Layer& layer) {
+        record(AutosaveJournal::Op::SetFlags, JournalEncoder::layerFlags(layer), position);
+    }
+
+    // Records shapes [first, first + count) as added to `layer`, merged
+    // into the previous add if `merge` is set
+    void addShapes(std::size_t layer, const ShapeStore& shapes, std::size_t first, std::size_t count, bool merge = false) {
+        if (started) {
+            std::size_t before = pending.size();
+            encoder.shapes(pending, static_cast<std::uint32_t>(layer), shapes, first, count, merge ? AutosaveJournal::Merge : 0);
+            bytesSinceSnapshot += pending.size() - before;
+        }
+    }
+
+    // Records the current versions of the `count` shapes at `indices` of
+    // `layer`, merged into the previous modify if `merge` is set
+    void modifyShapes(std::size_t layer, const ShapeStore& shapes, const std::uint32_t* indices, std::size_t count,
+                      bool merge = false) {
+        if (!started) {
+            return;
+        }
+        std::size_t before = pending.size();
+        encoder.modifiedShapes(pending, static_cast<std::uint32_t>(layer), shapes, indices, count, merge);
+        bytesSinceSnapshot += pending.size() - before;
+    }
+
+    void record(AutosaveJournal::Op op, std::uint8_t flags = 0, std::size_t layer = 0, std::int32_t value = 0) {
+        if (started) {
+            JournalEncoder::record(pending, op, flags, static_cast<std::uint32_t>(layer), value);
+            bytesSinceSnapshot += sizeof(AutosaveJournal::RecordHeader);
+        }
+    }
+
+    // Hands the records of this frame to the writer thread
+    void flush() {
+        if (!pending.empty()) {
+            push(false, pending);
+        }
+    }
+
+    bool needsSnapshot() const {
+        return started && bytesSinceSnapshot > MinSnapshotInterval && bytesSinceSnapshot > snapshotBytes;
+    }
+
+    // Replaces the journal with the records that rebuild `layers` from a
+    // new, empty drawing. Encoding copies every shape once; the file write
+    // happens on the writer thread
+    void snapshot(const LayerStack& layers) {
+        if (!started) {
+            return;
+        }
+        flush();
+
+        std::vector<char> bytes;
+        std::uint16_t version = AutosaveJournal::Version;
+        std::uint16_t reserved = 0;
+        JournalEncoder::ByteSink sink{ bytes };
+        sink.write(AutosaveJournal::Magic, sizeof(AutosaveJournal::Magic));
+        sink.write(reinterpret_cast<const char*>(&version), sizeof(version));
+        sink.write(reinterpret_cast<const char*>(&reserved), sizeof(reserved));
+
+        encoder.snapshot(bytes, layers);
+
+        snapshotBytes = bytes.size();
+        bytesSinceSnapshot = 0;
+        push(true, bytes);
+    }
+
+    bool failed() const { return writeFailed; }
+};
+
+// Reads a journal back record by record
+class JournalReader {
+public:
+    struct Record {
+        AutosaveJournal::Op op;
+        std::uint8_t flags;
+        std::uint32_t layer;
+        std::int32_t value;
+        std::vector<std::uint32_t> indices; // ModifyShapes: where each shape goes in the layer
+    };
+
+private:
+    // Lets ChunkDecoder read a payload that is already in memory
+    struct ByteSource {
+        const char* data;
+        std::size_t left;
+        bool ok;
+
+        ByteSource& read(char* out, std::size_t size) {
+            if (size > left) {
+                ok = false;
+                return *this;
+            }
+            std::memcpy(out, data, size);
+            data += size;
+            left -= size;
+            return *this;
+        }
+
+        bool operator!() const { return !ok; }
+    };
+
+    std::ifstream file;
+    std::streamoff fileSize = 0;
+    std::vector<char> payload;
+    ChunkDecoder decoder;
+    std::uint16_t chunkVersion = DocumentFile::Version; // Document version of the chunks in this journal
+
+    // Decodes a record whose header and payload have been read
+    bool decode(const AutosaveJournal::RecordHeader& header, const char* data, Record& record, ShapeStore& shapes) {
+        if (AutosaveJournal::checksum(header, data, header.payloadSize) != header.checksum) {
+            return false;
+        }
+        record.op = static_cast<AutosaveJournal::Op>(header.op);
+        record.flags = header.flags;
+        record.layer = header.layer;
+        record.value = header.value;
+        if (record.op == AutosaveJournal::Op::AddShapes) {
+            ByteSource source{ data, header.payloadSize, true };
+            return decoder.read(source, chunkVersion, shapes) == ChunkDecoder::Appended && source.left == 0;
+        }
+        if (record.op == AutosaveJournal::Op::ModifyShapes) {
+            ByteSource source{ data, header.payloadSize, true };
+            std::size_t first = shapes.size();
+            if (decoder.read(source, chunkVersion, shapes) != ChunkDecoder::Appended) {
+                return false;
+            }
+            record.indices.resize(shapes.size() - first);
+            source.read(reinterpret_cast<char*>(record.indices.data()), record.indices.size() * sizeof(std::uint32_t));
+            return source.ok && source.left == 0;
+        }
+        return header.payloadSize == 0;
+    }
+
+public:
+    bool open(const std::string& filename) {
+        file.close();
+        file.clear();
+        file.open(filename, std::ios::binary);
+        file.seekg(0, std::ios::end);
+        fileSize = file ? static_cast<std::streamoff>(file.tellg()) : 0;
+        file.seekg(0, std::ios::beg);
+
+        char magic[4];
+        std::uint16_t version = 0;
+        std::uint16_t reserved = 0;
+        file.read(magic, sizeof(magic));
+        file.read(reinterpret_cast<char*>(&version), sizeof(version));
+        file.read(reinterpret_cast<char*>(&reserved), sizeof(reserved));
+        chunkVersion = version <= 2 ? 2 : version < DocumentFile::Version ? version : DocumentFile::Version;
+        return file && std::memcmp(magic, AutosaveJournal::Magic, sizeof(magic)) == 0
+            && version >= 1 && version <= AutosaveJournal::Version;
+    }
+
+    // Reads the next intact record. The shapes of an AddShapes or
+    // ModifyShapes record are appended to `shapes`. Returns false at the end
+    // of the journal, which is also where a record torn by a crash is
+    bool next(Record& record, ShapeStore& shapes) {
+        AutosaveJournal::RecordHeader header;
+        file.read(reinterpret_cast<char*>(&header), sizeof(header));
+        if (!file) {
+            return false;
+        }
+        // A torn header may claim any size; never allocate more than the file still holds
+        std::streamoff position = file.tellg();
+        if (position < 0 || static_cast<std::streamoff>(header.payloadSize) > fileSize - position) {
+            return false;
+        }
+        payload.resize(header.payloadSize);
+        file.read(payload.data(), payload.size());
+        return file && decode(header, payload.data(), record, shapes);
+    }
+
+    // Reads the next record from `left` bytes at `data`, e.g. records
+    // received from a shared session, and moves past it. The records are
+    // of the current version, unless open() has read an older journal
+    bool next(const char*& data, std::size_t& left, Record& record, ShapeStore& shapes) {
+        AutosaveJournal::RecordHeader header;
+        if (left < sizeof(header)) {
+            return false;
+        }
+        std::memcpy(&header, data, sizeof(header));
+        if (header.payloadSize > left - sizeof(header)) {
+            return false;
+        }
+        data += sizeof(header);
+        left -= sizeof(header);
+        const char* payloadData = data;
+        data += header.payloadSize;
+        left -= header.payloadSize;
+        return decode(header, payloadData, record, shapes);
+    }
+};
\ No newline at end of file
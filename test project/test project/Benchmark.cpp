@@ -0,0 +1,377 @@
+#include <SFML/Graphics.hpp>
+#include <SFML/OpenGL.hpp>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "CommandHistory.h"
+#include "DocumentFile.h"
+#include "GeometryBuilder.h"
+#include "InstancedRenderer.h"
+#include "PngStreamWriter.h"
+#include "RenderBatch.h"
+#include "ShapeStore.h"
+#include "SpatialGrid.h"
+#include "SvgWriter.h"
+#include "TiledExporter.h"
+
+// Headless benchmark harness. Builds synthetic scenes of mixed lines,
+// rectangles, circles and freehand strokes, times the same operations the app performs and
+// prints one JSON object per measurement, so runs can be diffed between builds.
+//
+//   benchmark [--sizes 1000,10000,...] [--out results.jsonl] [--skip-export]
+class Benchmark {
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    static constexpr unsigned CanvasWidth = 800;
+    static constexpr unsigned CanvasHeight = 600;
+
+    std::ofstream output;
+    std::mt19937 random{ 42 };
+    bool failed = false;
+
+    void report(const std::string& name, std::size_t shapes, double milliseconds, std::size_t iterations = 1) {
+        std::ostringstream line;
+        line << "{\"benchmark\":\"" << name << "\",\"shapes\":" << shapes << ",\"iterations\":" << iterations
+             << ",\"total_ms\":" << milliseconds << ",\"ms_per_iteration\":" << milliseconds / iterations << "}";
+        std::cout << line.str() << std::endl;
+        if (output) {
+            output << line.str() << '\n';
+        }
+    }
+
+    template <typename Work>
+    static double measure(Work work) {
+        Clock::time_point start = Clock::now();
+        work();
+        return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    }
+
+    // Mixed scene with the kind of shapes a user would draw on the canvas
+    void fillScene(ShapeStore& shapes, std::size_t count) {
+        std::uniform_real_distribution<float> x(0.f, static_cast<float>(CanvasWidth));
+        std::uniform_real_distribution<float> y(0.f, static_cast<float>(CanvasHeight));
+        std::uniform_real_distribution<float> extent(-60.f, 60.f);
+        std::uniform_real_distribution<float> radius(1.f, 40.f);
+        std::uniform_int_distribution<int> kind(0, 3);
+        std::uniform_int_distribution<int> channel(64, 255);
+        std::uniform_real_distribution<float> step(-6.f, 6.f);
+        sf::Vector2f stroke[32];
+
+        for (std::size_t i = 0; i < count; ++i) {
+            sf::Vector2f start(x(random), y(random));
+            sf::Color color(static_cast<sf::Uint8>(channel(random)), static_cast<sf::Uint8>(channel(random)),
+                            static_cast<sf::Uint8>(channel(random)));
+            switch (kind(random)) {
+            case 0:
+                shapes.addLine(start, start + sf::Vector2f(extent(random), extent(random)), color);
+                break;
+            case 1:
+                shapes.addRectangle(start, sf::Vector2f(extent(random), extent(random)), color);
+                break;
+            case 2:
+                shapes.addCircle(start, radius(random), color);
+                break;
+            default:
+                // A short random walk, about what a simplified pencil stroke keeps
+                stroke[0] = start;
+                for (std::size_t j = 1; j < 32; ++j) {
+                    stroke[j] = stroke[j - 1] + sf::Vector2f(step(random), step(random));
+                }
+                shapes.addStroke(stroke, 32, color);
+                break;
+            }
+        }
+    }
+
+    void benchmarkEditing(std::size_t count) {
+        ShapeStore source;
+        fillScene(source, count);
+
+        // Insertion as the app does it: store, history and index per shape
+        ShapeStore shapes;
+        SpatialGrid index;
+        CommandHistory history(static_cast<std::size_t>(-1));
+        double insert = measure([&] {
+            for (std::size_t i = 0; i < count; ++i) {
+                shapes.append(source, i, 1);
+                history.recordAdd(i, 1);
+                index.insert(static_cast<SpatialGrid::Index>(i), shapes.bounds(i));
+            }
+        });
+        report("insert", count, insert, count);
+
+        // Hit-testing through the grid versus a linear scan of the store
+        const std::size_t picks = 1000;
+        std::uniform_real_distribution<float> x(0.f, static_cast<float>(CanvasWidth));
+        std::uniform_real_distribution<float> y(0.f, static_cast<float>(CanvasHeight));
+        std::vector<sf::Vector2f> points(picks);
+        for (sf::Vector2f& point : points) {
+            point = sf::Vector2f(x(random), y(random));
+        }
+        std::size_t found = 0;
+        double gridPick = measure([&] {
+            for (const sf::Vector2f& point : points) {
+                found += index.pick(shapes, point, 4.f) < shapes.size();
+            }
+        });
+        report("pick_grid", count, gridPick, picks);
+        double linearPick = measure([&] {
+            for (const sf::Vector2f& point : points) {
+                found += shapes.pick(point, 4.f) < shapes.size();
+            }
+        });
+        report("pick_linear", count, linearPick, picks);
+
+        std::vector<SpatialGrid::Index> visible;
+        double query = measure([&] {
+            index.query(sf::FloatRect(200, 150, 400, 300), visible);
+        });
+        report("query_quarter_canvas", count, query);
+
+        // Clearing and undoing the clear only swap columns
+        double clear = measure([&] { history.clear(shapes); });
+        report("clear", count, clear);
+        double undoClear = measure([&] { history.undo(shapes); });
+        report("undo_clear", count, undoClear);
+
+        // Undo every add, one at a time, keeping the index in step
+        double undo = measure([&] {
+            for (std::size_t i = count; i-- > 0;) {
+                HistoryChange change = history.undo(shapes);
+                for (std::size_t j = change.first + change.count; j-- > change.first;) {
+                    index.remove(static_cast<SpatialGrid::Index>(j));
+                }
+            }
+        });
+        report("undo_add", count, undo, count);
+
+        // Undoing and redoing one add, e.g. a user stepping back and forth,
+        // reuses recycled buffers instead of allocating each time
+        for (std::size_t i = 0; i < count; ++i) {
+            history.redo(shapes);
+        }
+        const std::size_t steps = 10000;
+        double undoRedo = measure([&] {
+            for (std::size_t i = 0; i < steps; ++i) {
+                history.undo(shapes);
+                history.redo(shapes);
+            }
+        });
+        report("undo_redo_single", count, undoRedo, steps);
+
+        if (found == static_cast<std::size_t>(-1)) {
+            std::cout << found; // Keeps the picks from being optimized away
+        }
+    }
+
+    // A clear larger than the history's default limit must still be undoable
+    void benchmarkLargeClear() {
+        ShapeStore source;
+        fillScene(source, 100000);
+        ShapeStore shapes;
+        while (shapes.memoryUsage() <= CommandHistory::DefaultMemoryLimit) {
+            shapes.append(source, 0, source.size());
+        }
+        std::size_t count = shapes.size();
+        CommandHistory history;
+        history.recordAdd(0, count);
+        double clear = measure([&] { history.clear(shapes); });
+        report("clear_over_history_limit", count, clear);
+        double undoClear = measure([&] { history.undo(shapes); });
+        report("undo_clear_over_history_limit", count, undoClear);
+        if (shapes.size() != count) {
+            std::cerr << "Undoing a clear of " << count << " shapes restored " << shapes.size() << std::endl;
+            failed = true;
+        }
+    }
+
+    void benchmarkRendering(std::size_t count) {
+        ShapeStore shapes;
+        fillScene(shapes, count);
+
+        RenderBatch batch;
+        double build = measure([&] {
+            shapes.appendTo(batch);
+            batch.upload();
+        });
+        report("batch_build", count, build);
+
+        GeometryBuilder builder;
+        RenderBatch parallel;
+        double parallelBuild = measure([&] {
+            builder.build(shapes, 0, shapes.size(), 1.f, parallel);
+            parallel.upload();
+        });
+        report("batch_build_parallel_" + std::to_string(builder.getThreadCount()) + "t", count, parallelBuild);
+
+        sf::RenderTexture target;
+        if (!target.create(CanvasWidth, CanvasHeight)) {
+            std::cerr << "Failed to create render texture" << std::endl;
+            return;
+        }
+
+        // Warm up once so driver-side setup is not measured
+        target.clear(sf::Color::Black);
+        batch.draw(target);
+        target.display();
+        glFinish();
+
+        const std::size_t frames = 20;
+        double render = measure([&] {
+            for (std::size_t i = 0; i < frames; ++i) {
+                target.clear(sf::Color::Black);
+                batch.draw(target);
+                target.display();
+            }
+            glFinish();
+        });
+        report("render_batch", count, render, frames);
+
+        if (!InstancedRenderer::isAvailable()) {
+            return;
+        }
+
+        // Rectangles and circles as instances, everything else batched as before
+        InstancedRenderer instanced;
+        RenderBatch remainder;
+        double instanceBuild = measure([&] {
+            for (std::size_t i = 0; i < count; ++i) {
+                if (!instanced.add(shapes, i)) {
+                    shapes.appendTo(i, remainder);
+                }
+            }
+            instanced.upload();
+            remainder.upload();
+        });
+        report("instanced_build", count, instanceBuild);
+
+        target.clear(sf::Color::Black);
+        instanced.draw(target, target.getView());
+        remainder.draw(target);
+        target.display();
+        glFinish();
+
+        double renderInstanced = measure([&] {
+            for (std::size_t i = 0; i < frames; ++i) {
+                target.clear(sf::Color::Black);
+                instanced.draw(target, target.getView());
+                remainder.draw(target);
+                target.display();
+            }
+            glFinish();
+        });
+        report("render_instanced", count, renderInstanced, frames);
+    }
+
+    void benchmarkExport(std::size_t count) {
+        ShapeStore shapes;
+        fillScene(shapes, count);
+        SpatialGrid index;
+        index.rebuild(shapes);
+        RenderBatch batch;
+        shapes.appendTo(batch);
+        batch.upload();
+
+        sf::RenderTexture target;
+        if (!target.create(CanvasWidth, CanvasHeight)) {
+            return;
+        }
+        target.clear(sf::Color::Black);
+        batch.draw(target);
+        target.display();
+
+        // What saveDrawing does on the UI thread, and what the export worker does
+        sf::Image image;
+        double readback = measure([&] { image = target.getTexture().copyToImage(); });
+        report("export_readback", count, readback);
+        double png = measure([&] { image.saveToFile("bench_export.png"); });
+        report("export_png_encode", count, png);
+
+        double poster = measure([&] {
+            TiledExporter::save(shapes, index, sf::FloatRect(0, 0, CanvasWidth, CanvasHeight), 4.f, "bench_poster.png");
+        });
+        report("export_poster_4x", count, poster);
+
+        double save = measure([&] { DocumentWriter::save(shapes, "bench_document.2dv"); });
+        report("document_save", count, save);
+
+        ShapeStore loaded;
+        double load = measure([&] {
+            DocumentReader reader;
+            reader.open("bench_document.2dv");
+            while (reader.readChunk(loaded)) {
+            }
+        });
+        report("document_load", count, load);
+
+        double svg = measure([&] { SvgWriter::save(shapes, sf::Vector2u(CanvasWidth, CanvasHeight), "bench_export.svg"); });
+        report("export_svg", count, svg);
+
+        std::remove("bench_export.png");
+        std::remove("bench_poster.png");
+        std::remove("bench_document.2dv");
+        std::remove("bench_export.svg");
+    }
+
+public:
+    bool open(const std::string& filename) {
+        output.open(filename, std::ios::trunc);
+        return static_cast<bool>(output);
+    }
+
+    // Returns false if a check failed
+    bool run(const std::vector<std::size_t>& sizes, bool includeExport) {
+        for (std::size_t count : sizes) {
+            benchmarkEditing(count);
+            benchmarkRendering(count);
+            if (includeExport) {
+                benchmarkExport(count);
+            }
+        }
+        benchmarkLargeClear();
+        return !failed;
+    }
+};
+
+int main(int argc, char** argv) {
+    std::vector<std::size_t> sizes = { 1000, 10000, 100000, 1000000 };
+    std::string outputFile = "bench_results.jsonl";
+    bool includeExport = true;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--sizes" && i + 1 < argc) {
+            sizes.clear();
+            std::stringstream list(argv[++i]);
+            std::string item;
+            while (std::getline(list, item, ',')) {
+                sizes.push_back(static_cast<std::size_t>(std::strtoull(item.c_str(), nullptr, 10)));
+            }
+        }
+        else if (arg == "--out" && i + 1 < argc) {
+            outputFile = argv[++i];
+        }
+        else if (arg == "--skip-export") {
+            includeExport = false;
+        }
+        else {
+            std::cerr << "Usage: benchmark [--sizes 1000,10000,...] [--out results.jsonl] [--skip-export]" << std::endl;
+            return 1;
+        }
+    }
+
+    Benchmark benchmark;
+    if (!benchmark.open(outputFile)) {
+        std::cerr << "Failed to open " << outputFile << std::endl;
+        return 1;
+    }
+    return benchmark.run(sizes, includeExport) ? 0 : 1;
+}
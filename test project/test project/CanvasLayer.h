@@ -0,0 +1,204 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+#include <algorithm>
+#include <cmath>
+
+#include "GeometryBuilder.h"
+#include "InstancedRenderer.h"
+#include "RasterLayer.h"
+#include "RenderBatch.h"
+#include "ShapeStore.h"
+#include "SpatialGrid.h"
+
+// Offscreen copy of the committed shapes, as seen through the camera view.
+// The window composites this texture instead of re-rendering every shape
+// each frame; edits only repaint the part of the layer they touch.
+//
+// Full repaints draw only the shapes near the view, tessellated for the
+// current zoom rounded down to a power of two. That geometry is cached for
+// the view plus a guard band, so panning within the band or zooming
+// within the same power of two is a single draw from the cached buffers.
+// Where OpenGL supports it, rectangles and circles are cached as instances
+// instead of triangles, which also makes the cache independent of the zoom
+class CanvasLayer {
+private:
+    static constexpr float GuardBand = 0.5f; // Margin cached around the view, in view sizes
+
+    sf::RenderTexture texture;
+    sf::View view;
+    RenderBatch scratch; // Reused for incremental draws to avoid reallocating
+    GeometryBuilder* builder = nullptr; // Tessellates large redraws on all cores; shared between layers
+    std::vector<SpatialGrid::Index> visible;
+    sf::Color background = sf::Color::Transparent; // Lets the UI underneath show through
+    const RasterLayer* fills = nullptr; // Drawn under the shapes on every repaint
+
+    RenderBatch cached;  // Shapes overlapping cachedArea, tessellated for cachedScale
+    InstancedRenderer instanced; // Rectangles and circles of the cache, if instancing is used
+    bool useInstancing = false;
+    sf::FloatRect cachedArea;
+    float cachedScale = 0;
+    bool cacheValid = false;
+
+    // Pixels per scene unit, rounded down to a power of two so small zoom
+    // steps reuse the same tessellation
+    float tessellationScale() const {
+        float pixelsPerUnit = texture.getSize().x / view.getSize().x;
+        return std::pow(2.f, std::floor(std::log2(pixelsPerUnit)));
+    }
+
+    static bool covers(const sf::FloatRect& outer, const sf::FloatRect& inner) {
+        return inner.left >= outer.left && inner.top >= outer.top
+            && inner.left + inner.width <= outer.left + outer.width
+            && inner.top + inner.height <= outer.top + outer.height;
+    }
+
+public:
+    // Creates or recreates the texture, e.g. with a different multisample
+    // level. Resets the view; the contents must be repainted
+    bool create(unsigned width, unsigned height, GeometryBuilder& geometry,
+                const sf::ContextSettings& settings = sf::ContextSettings()) {
+        builder = &geometry;
+        if (!texture.create(width, height, settings)) {
+            return false;
+        }
+        view = texture.getDefaultView();
+        useInstancing = InstancedRenderer::isAvailable();
+        cacheValid = false;
+        texture.clear(background);
+        texture.display();
+        return true;
+    }
+
+    // The camera the layer is rendered through. Call repaintAll() afterwards
+    void setView(const sf::View& camera) {
+        view = camera;
+    }
+
+    const sf::View& getView() const { return view; }
+
+    // Bucket fills to paint beneath the shapes; they must outlive the layer
+    void setFills(const RasterLayer& raster) {
+        fills = &raster;
+    }
+
+    // Scene area currently shown, assuming the view is not rotated
+    sf::FloatRect getVisibleArea() const {
+        return sf::FloatRect(view.getCenter() - view.getSize() / 2.f, view.getSize());
+    }
+
+    const sf::Texture& getTexture() const {
+        return texture.getTexture();
+    }
+
+    // Draws one newly added shape on top of the existing contents
+    void drawShape(const ShapeStore& shapes, std::size_t index) {
+        drawShapes(shapes, index, index + 1);
+    }
+
+    // Draws the shapes in [first, last) on top of the existing contents
+    void drawShapes(const ShapeStore& shapes, std::size_t first, std::size_t last) {
+        scratch.clear();
+        builder->build(shapes, first, last, tessellationScale(), scratch);
+        texture.setView(view);
+        scratch.draw(texture);
+        texture.display();
+        cacheValid = false;
+    }
+
+    // Redraws every shape in view, rebuilding the cached geometry only if
+    // the view has left the cached area or changed tessellation scale
+    void repaintAll(const ShapeStore& shapes, const SpatialGrid& index) {
+        float scale = tessellationScale();
+        sf::FloatRect area = getVisibleArea();
+        if (!cacheValid || (!useInstancing && scale != cachedScale) || !covers(cachedArea, area)) {
+            cachedArea = sf::FloatRect(area.left - area.width * GuardBand, area.top - area.height * GuardBand,
+                                       area.width * (1 + 2 * GuardBand), area.height * (1 + 2 * GuardBand));
+            cachedScale = scale;
+            cached.clear();
+            instanced.clear();
+            index.query(cachedArea, visible);
+            if (useInstancing) {
+                // Instance records need no tessellation; only lines and strokes remain
+                for (SpatialGrid::Index i : visible) {
+                    if (!instanced.add(shapes, i)) {
+                        shapes.appendTo(i, cached, scale);
+                    }
+                }
+            }
+            else {
+                builder->build(shapes, visible, scale, cached);
+            }
+            if (useInstancing && !instanced.upload()) {
+                // Shader setup failed; fall back to triangles from now on
+                useInstancing = false;
+                cacheValid = false;
+                repaintAll(shapes, index);
+                return;
+            }
+            cached.upload();
+            cacheValid = true;
+        }
+
+        texture.setView(view);
+        texture.clear(background);
+        if (fills) {
+            fills->draw(texture);
+        }
+        if (useInstancing) {
+            instanced.draw(texture, view);
+        }
+        cached.draw(texture);
+        texture.display();
+    }
+
+    // Marks the cached geometry as out of date, e.g. after shapes were removed
+    void invalidate() {
+        cacheValid = false;
+    }
+
+    // Clears the scene area `region` and redraws only the shapes that
+    // overlap it, clipped to the pixels it covers
+    void repaint(const ShapeStore& shapes, const SpatialGrid& index, const sf::FloatRect& region) {
+        cacheValid = false;
+
+        sf::Vector2u size = texture.getSize();
+        sf::Vector2i topLeft = texture.mapCoordsToPixel(sf::Vector2f(region.left, region.top), view);
+        sf::Vector2i bottomRight = texture.mapCoordsToPixel(
+            sf::Vector2f(region.left + region.width, region.top + region.height), view);
+        float left = std::max(0.f, static_cast<float>(topLeft.x) - 1);
+        float top = std::max(0.f, static_cast<float>(topLeft.y) - 1);
+        float right = std::min(static_cast<float>(size.x), static_cast<float>(bottomRight.x) + 2);
+        float bottom = std::min(static_cast<float>(size.y), static_cast<float>(bottomRight.y) + 2);
+        if (right <= left || bottom <= top) {
+            return;
+        }
+        sf::FloatRect clip(left, top, right - left, bottom - top);
+
+        // A view whose viewport covers only the clip rectangle keeps the
+        // redraw from touching pixels outside it
+        sf::Vector2f worldTopLeft = texture.mapPixelToCoords(sf::Vector2i(static_cast<int>(left), static_cast<int>(top)), view);
+        sf::Vector2f worldBottomRight = texture.mapPixelToCoords(sf::Vector2i(static_cast<int>(right), static_cast<int>(bottom)), view);
+        sf::FloatRect world(worldTopLeft, worldBottomRight - worldTopLeft);
+        sf::View clipView(world);
+        clipView.setViewport(sf::FloatRect(clip.left / size.x, clip.top / size.y,
+                                           clip.width / size.x, clip.height / size.y));
+
+        scratch.clear();
+        index.query(world, visible);
+        builder->build(shapes, visible, tessellationScale(), scratch);
+
+        texture.setView(clipView);
+        sf::RectangleShape eraser(world.getSize());
+        eraser.setPosition(world.left, world.top);
+        eraser.setFillColor(background);
+        texture.draw(eraser, sf::BlendNone);
+        if (fills) {
+            fills->draw(texture);
+        }
+
+        scratch.draw(texture);
+        texture.setView(view);
+        texture.display();
+    }
+};
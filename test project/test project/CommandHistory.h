@@ -0,0 +1,347 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include "ShapeStore.h"
+
+// Describes what an undo or redo did to the document, so callers can update
+// indexes and cached rendering incrementally
+struct HistoryChange {
+    enum class Kind {
+        None,          // Nothing to undo or redo
+        RemovedTail,   // Shapes [first, first + count) were removed from the end
+        AppendedTail,  // Shapes [first, first + count) were appended at the end
+        ReplacedAll,   // The whole store was swapped out
+        Modified       // The shapes in `indices` were changed in place
+    };
+
+    Kind kind = Kind::None;
+    std::size_t first = 0;
+    std::size_t count = 0;
+    std::vector<std::uint32_t> indices;
+    sf::FloatRect region; // Area covered by the shapes removed or appended, or by both versions of those modified
+};
+
+// Keeps the column buffers of stores that are no longer needed so the next
+// store can reuse their capacity instead of allocating. Stores that come and
+// go all the time, like those of commands being undone and redone, then no
+// longer touch the heap. Buffers are kept up to a byte budget and all freed
+// together when the pool is released
+class ShapeStorePool {
+private:
+    static const std::size_t MaxStores = 64; // Keeps take() a short scan
+
+    std::vector<ShapeStore> stores;
+    std::size_t bytes = 0;
+    std::size_t budget;
+
+public:
+    explicit ShapeStorePool(std::size_t budget = 16 * 1024 * 1024)
+        : budget(budget) {
+    }
+
+    // Empties `store`, moving its buffers into the pool if they fit the budget
+    void recycle(ShapeStore& store) {
+        std::size_t size = store.memoryUsage();
+        if (size == 0) {
+            return;
+        }
+        if (bytes + size > budget || stores.size() >= MaxStores) {
+            ShapeStore().swap(store);
+            return;
+        }
+        store.clear();
+        stores.emplace_back();
+        stores.back().swap(store);
+        bytes += size;
+    }
+
+    // Gives the empty `store` the smallest pooled buffers that hold `count`
+    // shapes without growing. Leaves it alone if there are none
+    void take(ShapeStore& store, std::size_t count) {
+        std::size_t best = stores.size();
+        for (std::size_t i = 0; i < stores.size(); ++i) {
+            if (stores[i].capacity() >= count && (best == stores.size() || stores[i].capacity() < stores[best].capacity())) {
+                best = i;
+            }
+        }
+        if (best == stores.size()) {
+            return;
+        }
+        bytes -= stores[best].memoryUsage();
+        store.swap(stores[best]);
+        stores[best].swap(stores.back());
+        stores.pop_back();
+    }
+
+    void release() {
+        std::vector<ShapeStore>().swap(stores);
+        bytes = 0;
+    }
+
+    std::size_t getMemoryUsage() const { return bytes; }
+};
+
+// Undo/redo history of edits to a ShapeStore. Commands keep only the delta
+// they need: an applied "add" stores nothing but its index range and takes
+// the shapes over only while undone, and a "clear" keeps the cleared columns
+// by swapping them out of the document, so undoing it is O(1) whatever the
+// number of shapes. A "modify" keeps the other version of only the shapes
+// it changed, exchanged with the document on every undo and redo. The
+// oldest commands are dropped once the history holds more than its memory
+// limit, but never the newest, so the last edit can always be undone
+// however large it is. Buffers of commands that are dropped, or that no
+// longer need their shapes, are recycled through a ShapeStorePool
+class CommandHistory {
+private:
+    struct Command {
+        enum class Type { Add, Clear, Modify } type;
+        std::size_t first = 0;
+        std::size_t count = 0;
+        std::vector<std::uint32_t> indices; // Modify: the shapes changed
+        ShapeStore shapes; // Add: the shapes while undone. Clear: the cleared shapes while applied.
+                           // Modify: the version of the changed shapes not in the document
+
+        std::size_t memoryUsage() const {
+            return sizeof(Command) + indices.capacity() * sizeof(std::uint32_t) + shapes.memoryUsage();
+        }
+    };
+
+    std::deque<Command> done;
+    std::vector<Command> undone;
+    std::size_t memoryLimit;
+    std::size_t memoryUsed = 0;
+    ShapeStorePool pool;
+
+    static void include(sf::FloatRect& region, const sf::FloatRect& b) {
+        float right = std::max(region.left + region.width, b.left + b.width);
+        float bottom = std::max(region.top + region.height, b.top + b.height);
+        region.left = std::min(region.left, b.left);
+        region.top = std::min(region.top, b.top);
+        region.width = right - region.left;
+        region.height = bottom - region.top;
+    }
+
+    static sf::FloatRect unionBounds(const ShapeStore& shapes, std::size_t first, std::size_t count) {
+        if (count == 0) {
+            return sf::FloatRect();
+        }
+        sf::FloatRect result = shapes.bounds(first);
+        for (std::size_t i = first + 1; i < first + count; ++i) {
+            include(result, shapes.bounds(i));
+        }
+        return result;
+    }
+
+    // Swaps the two versions of the shapes a Modify changed
+    static void exchange(ShapeStore& shapes, Command& command, HistoryChange& change) {
+        change.kind = HistoryChange::Kind::Modified;
+        change.count = command.indices.size();
+        change.indices = command.indices;
+        if (!command.indices.empty()) {
+            change.region = shapes.bounds(command.indices[0]);
+        }
+        for (std::size_t i = 0; i < command.indices.size(); ++i) {
+            include(change.region, shapes.bounds(command.indices[i]));
+            shapes.exchange(command.indices[i], command.shapes, i);
+            include(change.region, shapes.bounds(command.indices[i]));
+        }
+    }
+
+    void discardRedo() {
+        for (Command& command : undone) {
+            memoryUsed -= command.memoryUsage();
+            pool.recycle(command.shapes);
+        }
+        undone.clear();
+    }
+
+    void enforceLimit() {
+        while (memoryUsed > memoryLimit && done.size() > 1) {
+            memoryUsed -= done.front().memoryUsage();
+            pool.recycle(done.front().shapes);
+            done.pop_front();
+        }
+    }
+
+    void pushDone(Command&& command) {
+        memoryUsed += command.memoryUsage();
+        done.push_back(std::move(command));
+        enforceLimit();
+    }
+
+public:
+    static const std::size_t DefaultMemoryLimit = 64 * 1024 * 1024;
+
+    explicit CommandHistory(std::size_t memoryLimit = DefaultMemoryLimit)
+        : memoryLimit(memoryLimit) {
+    }
+
+    void setMemoryLimit(std::size_t bytes) {
+        memoryLimit = bytes;
+        enforceLimit();
+    }
+
+    std::size_t getMemoryUsage() const { return memoryUsed; }
+    std::size_t getPoolUsage() const { return pool.getMemoryUsage(); }
+
+    // Frees the recycled buffers kept for reuse
+    void releasePool() {
+        pool.release();
+    }
+    bool canUndo() const { return !done.empty(); }
+    bool canRedo() const { return !undone.empty(); }
+
+    // Records that `count` shapes were appended at `first`. With `merge`, a
+    // directly preceding add is extended instead, e.g. while a file streams
+    // in. Returns false if it was merged rather than recorded as a new command
+    bool recordAdd(std::size_t first, std::size_t count, bool merge = false) {
+        discardRedo();
+        if (merge && !done.empty()) {
+            Command& last = done.back();
+            if (last.type == Command::Type::Add && last.first + last.count == first) {
+                last.count += count;
+                return false;
+            }
+        }
+        Command command;
+        command.type = Command::Type::Add;
+        command.first = first;
+        command.count = count;
+        pushDone(std::move(command));
+        return true;
+    }
+
+    // Records that the `count` shapes at `indices` were changed in place;
+    // `before` holds their previous versions, in the same order. With
+    // `merge`, a directly preceding modify is extended instead. Returns
+    // false if it was merged rather than recorded as a new command
+    bool recordModify(const std::uint32_t* indices, std::size_t count, const ShapeStore& before, bool merge = false) {
+        discardRedo();
+        if (merge && !done.empty() && done.back().type == Command::Type::Modify) {
+            Command& last = done.back();
+            memoryUsed -= last.memoryUsage();
+            last.indices.insert(last.indices.end(), indices, indices + count);
+            last.shapes.append(before, 0, count);
+            memoryUsed += last.memoryUsage();
+            enforceLimit();
+            return false;
+        }
+        Command command;
+        command.type = Command::Type::Modify;
+        command.indices.assign(indices, indices + count);
+        pool.take(command.shapes, count);
+        command.shapes.append(before, 0, count);
+        pushDone(std::move(command));
+        return true;
+    }
+
+    // Drops everything that could be redone, e.g. after an edit recorded elsewhere
+    void clearRedo() {
+        discardRedo();
+    }
+
+    // Drops the whole history; the shapes stay as they are
+    void forget() {
+        discardRedo();
+        for (Command& command : done) {
+            pool.recycle(command.shapes);
+        }
+        done.clear();
+        memoryUsed = 0;
+    }
+
+    // Clears `shapes`, keeping its contents in the history. Does nothing,
+    // and returns false, if it is empty
+    bool clear(ShapeStore& shapes) {
+        if (shapes.empty()) {
+            return false;
+        }
+        discardRedo();
+        Command command;
+        command.type = Command::Type::Clear;
+        command.count = shapes.size();
+        command.shapes.swap(shapes);
+        pool.take(shapes, 0); // The document starts over with recycled capacity, if any
+        pushDone(std::move(command));
+        return true;
+    }
+
+    HistoryChange undo(ShapeStore& shapes) {
+        HistoryChange change;
+        if (done.empty()) {
+            return change;
+        }
+        Command command = std::move(done.back());
+        done.pop_back();
+        memoryUsed -= command.memoryUsage();
+
+        if (command.type == Command::Type::Add) {
+            change.kind = HistoryChange::Kind::RemovedTail;
+            change.first = command.first;
+            change.count = command.count;
+            change.region = unionBounds(shapes, command.first, command.count);
+            pool.take(command.shapes, command.count);
+            shapes.moveTailTo(command.shapes, command.count);
+        }
+        else if (command.type == Command::Type::Modify) {
+            exchange(shapes, command, change);
+        }
+        else {
+            change.kind = HistoryChange::Kind::ReplacedAll;
+            change.count = command.count;
+            shapes.swap(command.shapes);
+        }
+
+        memoryUsed += command.memoryUsage();
+        undone.push_back(std::move(command));
+        return change;
+    }
+
+    // Undoes the most recent command and forgets it, as if it had never
+    // been recorded, e.g. to take back an edit that has to be reordered
+    HistoryChange retract(ShapeStore& shapes) {
+        HistoryChange change = undo(shapes);
+        if (change.kind != HistoryChange::Kind::None) {
+            memoryUsed -= undone.back().memoryUsage();
+            pool.recycle(undone.back().shapes);
+            undone.pop_back();
+        }
+        return change;
+    }
+
+    HistoryChange redo(ShapeStore& shapes) {
+        HistoryChange change;
+        if (undone.empty()) {
+            return change;
+        }
+        Command command = std::move(undone.back());
+        undone.pop_back();
+        memoryUsed -= command.memoryUsage();
+
+        if (command.type == Command::Type::Add) {
+            change.kind = HistoryChange::Kind::AppendedTail;
+            change.first = shapes.size();
+            change.count = command.count;
+            command.shapes.moveTailTo(shapes, command.count);
+            pool.recycle(command.shapes); // The add no longer needs its buffers
+            change.region = unionBounds(shapes, change.first, change.count);
+        }
+        else if (command.type == Command::Type::Modify) {
+            exchange(shapes, command, change);
+        }
+        else {
+            change.kind = HistoryChange::Kind::ReplacedAll;
+            change.count = command.count;
+            shapes.swap(command.shapes);
+        }
+
+        pushDone(std::move(command));
+        return change;
+    }
+};
@@ -0,0 +1,630 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "ShapeStore.h"
+#include "StyleTable.h"
+
+// Binary vector document format (.2dv). All values are little-endian.
+//
+//   header  "2DDV" magic, uint16 version, uint16 reserved
+//   chunk*  uint32 shape count N (> 0), uint32 byte size, then that many bytes:
+//             varint palette size P, then P x (4 uint8 RGBA color, float32 width)
+//             N x shape record
+//   end     uint32 0
+//
+// A shape record is a uint8 tag, either the shape's kind or Repeat followed
+// by a varint distance back to an identical shape earlier in the chunk.
+// Otherwise the kind is followed by the varint palette index of its style,
+// a stroke's varint point count, and the geometry. Coordinates are stored
+// as whole multiples of 1 / CoordinateSteps units, as zigzag varints
+// (small magnitudes of either sign take few bytes) relative to something
+// nearby: the shape's origin (a line's start, a rectangle or circle's
+// position, a stroke's first point) to the previous shape's origin, a
+// line's end to its start, each stroke point to the one before it. A
+// rectangle's size and a circle's radius are stored as they are. Stroke
+// bounds are not stored but recomputed from the points.
+//
+// Drawings repeat a few styles and place each shape near the last one, so
+// most shapes take a handful of bytes instead of the 33 of version 3.
+// Quantizing to 1/256 unit keeps coordinates within 1/8 of a pixel at the
+// deepest zoom. Versions 1 to 3 stored the columns of ShapeStore raw:
+//
+//   chunk   uint32 shape count N (> 0), then N x uint8 kind,
+//           N x 2 float32 start, N x 2 float32 extent, N x 4 uint8 RGBA color,
+//           N x uint32 point count (version 2), N x float32 width (version 3),
+//           then the points of the chunk's strokes as 2 float32 each
+//
+// and are still read. Versions 1 and 2, which predate freehand strokes and
+// shape widths respectively, give their shapes the default width of their
+// kind. Either way a reader can hand each chunk to the renderer as soon as
+// it arrives
+namespace DocumentFile {
+    const char Magic[4] = { '2', 'D', 'D', 'V' };
+    const std::uint16_t Version = 4;
+    const std::uint32_t DefaultChunkSize = 16384;
+    const std::uint32_t MaxChunkSize = 1u << 20;
+    const std::uint32_t MaxChunkPoints = 1u << 24;
+    const std::uint32_t MaxChunkBytes = 1u << 28;
+    const float MaxWidth = 1e6f;
+    const float CoordinateSteps = 256.f;
+    const float MaxCoordinate = 1e9f; // Coordinates are clamped to this magnitude when saved
+    const std::uint8_t Repeat = 0xFF;
+
+    static_assert(sizeof(sf::Vector2f) == 8 && sizeof(sf::Color) == 4, "Unexpected SFML type layout");
+
+    // Picks the shapes of the chunk starting at `first`: at most `chunkSize`,
+    // and fewer if their strokes would exceed the point limit. Fills
+    // `pointCounts` with one entry per shape and returns the total
+    inline std::size_t chunkExtent(const ShapeStore& shapes, std::size_t first, std::size_t chunkSize,
+                                   std::vector<std::uint32_t>& pointCounts) {
+        std::size_t totalPoints = 0;
+        pointCounts.clear();
+        while (first + pointCounts.size() < shapes.size() && pointCounts.size() < chunkSize) {
+            std::size_t points = shapes.pointCount(first + pointCounts.size());
+            if (!pointCounts.empty() && totalPoints + points > MaxChunkPoints) {
+                break;
+            }
+            pointCounts.push_back(static_cast<std::uint32_t>(points));
+            totalPoints += points;
+        }
+        return totalPoints;
+    }
+
+    inline std::int64_t quantize(float value) {
+        if (!(value == value)) {
+            return 0;
+        }
+        float clamped = value < -MaxCoordinate ? -MaxCoordinate : value > MaxCoordinate ? MaxCoordinate : value;
+        return static_cast<std::int64_t>(std::llround(static_cast<double>(clamped) * CoordinateSteps));
+    }
+
+    inline float dequantize(std::int64_t value) {
+        return static_cast<float>(static_cast<double>(value) / CoordinateSteps);
+    }
+
+    inline void putVarint(std::vector<char>& out, std::uint64_t value) {
+        while (value >= 0x80) {
+            out.push_back(static_cast<char>((value & 0x7F) | 0x80));
+            value >>= 7;
+        }
+        out.push_back(static_cast<char>(value));
+    }
+
+    inline void putSigned(std::vector<char>& out, std::int64_t value) {
+        putVarint(out, (static_cast<std::uint64_t>(value) << 1) ^ (value < 0 ? ~std::uint64_t(0) : 0));
+    }
+
+    // Reads the values above back from a chunk in memory. Running past the
+    // end or an overlong varint clears `ok` rather than throwing
+    struct ByteReader {
+        const char* next;
+        const char* end;
+        bool ok = true;
+
+        ByteReader(const char* data, std::size_t size) : next(data), end(data + size) {}
+
+        std::uint8_t byte() {
+            if (next == end) {
+                ok = false;
+                return 0;
+            }
+            return static_cast<std::uint8_t>(*next++);
+        }
+
+        std::uint64_t varint() {
+            std::uint64_t value = 0;
+            for (int shift = 0; shift < 64; shift += 7) {
+                std::uint8_t b = byte();
+                value |= static_cast<std::uint64_t>(b & 0x7F) << shift;
+                if (!(b & 0x80)) {
+                    return value;
+                }
+            }
+            ok = false;
+            return 0;
+        }
+
+        std::int64_t signedVarint() {
+            std::uint64_t value = varint();
+            return static_cast<std::int64_t>(value >> 1) ^ -static_cast<std::int64_t>(value & 1);
+        }
+
+        void read(void* out, std::size_t size) {
+            if (static_cast<std::size_t>(end - next) < size) {
+                ok = false;
+                std::memset(out, 0, size);
+                return;
+            }
+            std::memcpy(out, next, size);
+            next += size;
+        }
+
+        bool finished() const { return ok && next == end; }
+    };
+}
+
+// Encodes chunks in the current format. Holds the scratch buffers, so
+// writing many chunks does not reallocate
+class ChunkEncoder {
+private:
+    std::vector<char> bytes;
+    std::vector<ShapeStyle> palette;
+    std::unordered_map<std::uint64_t, std::uint32_t> paletteIndex;
+    std::vector<std::uint32_t> styleIndices; // Palette index of each shape of the chunk
+    std::unordered_map<std::size_t, std::uint32_t> seen; // Hash of a shape's record to its position in the chunk
+    std::string record;
+    std::string candidate;
+
+    // Origin a shape's coordinates are stored relative to
+    static sf::Vector2f origin(const ShapeStore& shapes, std::size_t index) {
+        return shapes.kind(index) == ShapeKind::Stroke && shapes.pointCount(index) > 0
+            ? shapes.pointData(index)[0] : shapes.start(index);
+    }
+
+    // Everything stored about shape `index`, with absolute coordinates, so
+    // equal descriptions mean the shapes read back the same
+    void describe(const ShapeStore& shapes, std::size_t index, std::uint32_t style, std::string& out) const {
+        auto put = [&out](std::int64_t value) {
+            out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+        };
+        out.clear();
+        put(static_cast<std::int64_t>(shapes.kind(index)));
+        put(style);
+        if (shapes.kind(index) == ShapeKind::Stroke) {
+            const sf::Vector2f* points = shapes.pointData(index);
+            std::size_t count = shapes.pointCount(index);
+            put(static_cast<std::int64_t>(count));
+            for (std::size_t i = 0; i < count; ++i) {
+                put(DocumentFile::quantize(points[i].x));
+                put(DocumentFile::quantize(points[i].y));
+            }
+        }
+        else {
+            put(DocumentFile::quantize(shapes.start(index).x));
+            put(DocumentFile::quantize(shapes.start(index).y));
+            put(DocumentFile::quantize(shapes.extent(index).x));
+            put(DocumentFile::quantize(shapes.extent(index).y));
+        }
+    }
+
+public:
+    // Writes shapes [first, first + count), as picked by
+    // DocumentFile::chunkExtent(). `Sink` is anything with
+    // write(const char*, size), e.g. a std::ostream
+    template <typename Sink>
+    void write(Sink& out, const ShapeStore& shapes, std::size_t first, std::size_t count) {
+        palette.clear();
+        paletteIndex.clear();
+        styleIndices.clear();
+        for (std::size_t i = first; i < first + count; ++i) {
+            auto inserted = paletteIndex.emplace(StyleTable::key(shapes.color(i), shapes.width(i)),
+                                                 static_cast<std::uint32_t>(palette.size()));
+            if (inserted.second) {
+                palette.push_back(ShapeStyle{ shapes.color(i), shapes.width(i) });
+            }
+            styleIndices.push_back(inserted.first->second);
+        }
+
+        bytes.clear();
+        DocumentFile::putVarint(bytes, palette.size());
+        for (const ShapeStyle& style : palette) {
+            const char rgba[4] = { static_cast<char>(style.color.r), static_cast<char>(style.color.g),
+                                   static_cast<char>(style.color.b), static_cast<char>(style.color.a) };
+            bytes.insert(bytes.end(), rgba, rgba + 4);
+            bytes.insert(bytes.end(), reinterpret_cast<const char*>(&style.width),
+                         reinterpret_cast<const char*>(&style.width) + sizeof(float));
+        }
+
+        seen.clear();
+        std::int64_t previousX = 0, previousY = 0;
+        for (std::size_t n = 0; n < count; ++n) {
+            std::size_t i = first + n;
+            describe(shapes, i, styleIndices[n], record);
+            auto found = seen.find(std::hash<std::string>()(record));
+            if (found != seen.end()) {
+                describe(shapes, first + found->second, styleIndices[found->second], candidate);
+                if (candidate == record) {
+                    bytes.push_back(static_cast<char>(DocumentFile::Repeat));
+                    DocumentFile::putVarint(bytes, n - found->second);
+                    sf::Vector2f o = origin(shapes, i);
+                    previousX = DocumentFile::quantize(o.x);
+                    previousY = DocumentFile::quantize(o.y);
+                    found->second = static_cast<std::uint32_t>(n);
+                    continue;
+                }
+            }
+            seen[std::hash<std::string>()(record)] = static_cast<std::uint32_t>(n);
+
+            ShapeKind kind = shapes.kind(i);
+            bytes.push_back(static_cast<char>(kind));
+            DocumentFile::putVarint(bytes, styleIndices[n]);
+            std::size_t pointCount = shapes.pointCount(i);
+            if (kind == ShapeKind::Stroke) {
+                DocumentFile::putVarint(bytes, pointCount);
+            }
+
+            sf::Vector2f o = origin(shapes, i);
+            std::int64_t x = DocumentFile::quantize(o.x);
+            std::int64_t y = DocumentFile::quantize(o.y);
+            DocumentFile::putSigned(bytes, x - previousX);
+            DocumentFile::putSigned(bytes, y - previousY);
+            previousX = x;
+            previousY = y;
+
+            const sf::Vector2f& e = shapes.extent(i);
+            switch (kind) {
+            case ShapeKind::Line:
+                DocumentFile::putSigned(bytes, DocumentFile::quantize(e.x) - x);
+                DocumentFile::putSigned(bytes, DocumentFile::quantize(e.y) - y);
+                break;
+            case ShapeKind::Rectangle:
+                DocumentFile::putSigned(bytes, DocumentFile::quantize(e.x));
+                DocumentFile::putSigned(bytes, DocumentFile::quantize(e.y));
+                break;
+            case ShapeKind::Circle:
+                // The radius is normally the same in x and y
+                DocumentFile::putSigned(bytes, DocumentFile::quantize(e.x));
+                DocumentFile::putSigned(bytes, DocumentFile::quantize(e.y) - DocumentFile::quantize(e.x));
+                break;
+            case ShapeKind::Stroke: {
+                const sf::Vector2f* points = shapes.pointData(i);
+                for (std::size_t k = 1; k < pointCount; ++k) {
+                    std::int64_t px = DocumentFile::quantize(points[k].x);
+                    std::int64_t py = DocumentFile::quantize(points[k].y);
+                    DocumentFile::putSigned(bytes, px - x);
+                    DocumentFile::putSigned(bytes, py - y);
+                    x = px;
+                    y = py;
+                }
+                break;
+            }
+            }
+        }
+
+        std::uint32_t shapeCount = static_cast<std::uint32_t>(count);
+        std::uint32_t byteSize = static_cast<std::uint32_t>(bytes.size());
+        out.write(reinterpret_cast<const char*>(&shapeCount), sizeof(shapeCount));
+        out.write(reinterpret_cast<const char*>(&byteSize), sizeof(byteSize));
+        out.write(bytes.data(), bytes.size());
+    }
+};
+
+// Decodes chunks, validating them before anything is appended. Holds the
+// scratch columns, so reading many chunks does not reallocate
+class ChunkDecoder {
+public:
+    enum Result { Appended, End, Malformed };
+
+private:
+    std::vector<ShapeKind> kinds;
+    std::vector<sf::Vector2f> starts;
+    std::vector<sf::Vector2f> extents;
+    std::vector<sf::Color> colors;
+    std::vector<std::uint32_t> pointCounts;
+    std::vector<float> widths;
+    std::vector<sf::Vector2f> points;
+    std::vector<char> bytes;
+    std::vector<ShapeStyle> palette;
+    std::vector<std::int64_t> origins;        // Quantized x and y of each shape's origin
+    std::vector<std::uint32_t> firstPoints;   // Offset of each shape's points in `points`
+
+    static bool validWidth(float width) {
+        return std::isfinite(width) && width >= 0.f && width <= DocumentFile::MaxWidth;
+    }
+
+    static bool validCoordinate(std::int64_t value) {
+        return value >= DocumentFile::quantize(-DocumentFile::MaxCoordinate)
+            && value <= DocumentFile::quantize(DocumentFile::MaxCoordinate);
+    }
+
+    // Reads the columns of a version 1 to 3 chunk of `count` shapes
+    template <typename Source>
+    Result readColumns(Source& in, std::uint16_t version, std::uint32_t count) {
+        kinds.resize(count);
+        starts.resize(count);
+        extents.resize(count);
+        colors.resize(count);
+        in.read(reinterpret_cast<char*>(kinds.data()), count * sizeof(ShapeKind));
+        in.read(reinterpret_cast<char*>(starts.data()), count * sizeof(sf::Vector2f));
+        in.read(reinterpret_cast<char*>(extents.data()), count * sizeof(sf::Vector2f));
+        in.read(reinterpret_cast<char*>(colors.data()), count * sizeof(sf::Color));
+        if (!in) {
+            return Malformed;
+        }
+
+        pointCounts.assign(count, 0);
+        if (version >= 2) {
+            in.read(reinterpret_cast<char*>(pointCounts.data()), count * sizeof(std::uint32_t));
+        }
+        std::size_t totalPoints = 0;
+        for (std::uint32_t i = 0; i < count; ++i) {
+            // Only strokes have points
+            if (kinds[i] > ShapeKind::Stroke || (kinds[i] != ShapeKind::Stroke && pointCounts[i] != 0)) {
+                return Malformed;
+            }
+            totalPoints += pointCounts[i];
+        }
+        if (!in || totalPoints > DocumentFile::MaxChunkPoints) {
+            return Malformed;
+        }
+        if (version >= 3) {
+            widths.resize(count);
+            in.read(reinterpret_cast<char*>(widths.data()), count * sizeof(float));
+            for (std::uint32_t i = 0; i < count; ++i) {
+                if (!validWidth(widths[i])) {
+                    return Malformed;
+                }
+            }
+        }
+        points.resize(totalPoints);
+        in.read(reinterpret_cast<char*>(points.data()), totalPoints * sizeof(sf::Vector2f));
+        return !in ? Malformed : Appended;
+    }
+
+    // Parses the records of a current chunk of `count` shapes from `bytes`
+    Result readRecords(std::uint32_t count) {
+        DocumentFile::ByteReader reader(bytes.data(), bytes.size());
+        std::uint64_t paletteSize = reader.varint();
+        if (!reader.ok || paletteSize == 0 || paletteSize > count) {
+            return Malformed;
+        }
+        palette.resize(static_cast<std::size_t>(paletteSize));
+        for (ShapeStyle& style : palette) {
+            std::uint8_t rgba[4];
+            reader.read(rgba, sizeof(rgba));
+            reader.read(&style.width, sizeof(float));
+            style.color = sf::Color(rgba[0], rgba[1], rgba[2], rgba[3]);
+            if (!reader.ok || !validWidth(style.width)) {
+                return Malformed;
+            }
+        }
+
+        kinds.resize(count);
+        starts.resize(count);
+        extents.resize(count);
+        colors.resize(count);
+        widths.resize(count);
+        pointCounts.assign(count, 0);
+        origins.resize(2 * static_cast<std::size_t>(count));
+        firstPoints.resize(count);
+        points.clear();
+        std::int64_t x = 0, y = 0;
+        for (std::uint32_t i = 0; i < count; ++i) {
+            firstPoints[i] = static_cast<std::uint32_t>(points.size());
+            std::uint8_t tag = reader.byte();
+            if (tag == DocumentFile::Repeat) {
+                std::uint64_t distance = reader.varint();
+                if (!reader.ok || distance == 0 || distance > i) {
+                    return Malformed;
+                }
+                std::uint32_t from = i - static_cast<std::uint32_t>(distance);
+                if (points.size() + pointCounts[from] > DocumentFile::MaxChunkPoints) {
+                    return Malformed;
+                }
+                kinds[i] = kinds[from];
+                starts[i] = starts[from];
+                extents[i] = extents[from];
+                colors[i] = colors[from];
+                widths[i] = widths[from];
+                pointCounts[i] = pointCounts[from];
+                for (std::uint32_t k = 0; k < pointCounts[from]; ++k) {
+                    points.push_back(points[firstPoints[from] + k]);
+                }
+                x = origins[2 * from];
+                y = origins[2 * from + 1];
+                origins[2 * i] = x;
+                origins[2 * i + 1] = y;
+                continue;
+            }
+
+            std::uint64_t style = reader.varint();
+            if (!reader.ok || tag > static_cast<std::uint8_t>(ShapeKind::Stroke) || style >= palette.size()) {
+                return Malformed;
+            }
+            ShapeKind kind = static_cast<ShapeKind>(tag);
+            kinds[i] = kind;
+            colors[i] = palette[static_cast<std::size_t>(style)].color;
+            widths[i] = palette[static_cast<std::size_t>(style)].width;
+            std::uint64_t pointCount = kind == ShapeKind::Stroke ? reader.varint() : 0;
+            if (pointCount > DocumentFile::MaxChunkPoints - points.size()) {
+                return Malformed;
+            }
+            pointCounts[i] = static_cast<std::uint32_t>(pointCount);
+
+            x += reader.signedVarint();
+            y += reader.signedVarint();
+            if (!reader.ok || !validCoordinate(x) || !validCoordinate(y)) {
+                return Malformed;
+            }
+            origins[2 * i] = x;
+            origins[2 * i + 1] = y;
+            sf::Vector2f o(DocumentFile::dequantize(x), DocumentFile::dequantize(y));
+
+            if (kind != ShapeKind::Stroke) {
+                std::int64_t ex = reader.signedVarint();
+                std::int64_t ey = reader.signedVarint();
+                if (kind == ShapeKind::Line) {
+                    ex += x;
+                    ey += y;
+                }
+                else if (kind == ShapeKind::Circle) {
+                    ey += ex;
+                }
+                if (!reader.ok || !validCoordinate(ex) || !validCoordinate(ey)) {
+                    return Malformed;
+                }
+                starts[i] = o;
+                extents[i] = sf::Vector2f(DocumentFile::dequantize(ex), DocumentFile::dequantize(ey));
+                continue;
+            }
+
+            // Strokes: the points, and their bounds
+            sf::Vector2f low = pointCount > 0 ? o : sf::Vector2f();
+            sf::Vector2f high = low;
+            std::int64_t px = x, py = y;
+            for (std::uint64_t k = 0; k < pointCount; ++k) {
+                if (k > 0) {
+                    px += reader.signedVarint();
+                    py += reader.signedVarint();
+                    if (!reader.ok || !validCoordinate(px) || !validCoordinate(py)) {
+                        return Malformed;
+                    }
+                }
+                sf::Vector2f p(DocumentFile::dequantize(px), DocumentFile::dequantize(py));
+                low.x = std::min(low.x, p.x);
+                low.y = std::min(low.y, p.y);
+                high.x = std::max(high.x, p.x);
+                high.y = std::max(high.y, p.y);
+                points.push_back(p);
+            }
+            starts[i] = low;
+            extents[i] = high;
+        }
+        return reader.finished() ? Appended : Malformed;
+    }
+
+public:
+    // Reads one chunk of a `version` document from `in` and appends it to
+    // `shapes`. `Source` is anything with read(char*, size) and a stream-like
+    // failure test, e.g. a std::istream
+    template <typename Source>
+    Result read(Source& in, std::uint16_t version, ShapeStore& shapes) {
+        std::uint32_t count = 0;
+        in.read(reinterpret_cast<char*>(&count), sizeof(count));
+        if (!in || count > DocumentFile::MaxChunkSize) {
+            return Malformed;
+        }
+        if (count == 0) {
+            return End;
+        }
+
+        Result result;
+        if (version >= 4) {
+            std::uint32_t byteSize = 0;
+            in.read(reinterpret_cast<char*>(&byteSize), sizeof(byteSize));
+            if (!in || byteSize > DocumentFile::MaxChunkBytes) {
+                return Malformed;
+            }
+            bytes.resize(byteSize);
+            in.read(bytes.data(), byteSize);
+            result = !in ? Malformed : readRecords(count);
+        }
+        else {
+            result = readColumns(in, version, count);
+        }
+        if (result != Appended) {
+            return result;
+        }
+
+        shapes.append(count, kinds.data(), starts.data(), extents.data(), colors.data(),
+                      pointCounts.data(), points.data(), version >= 3 ? widths.data() : nullptr);
+        return Appended;
+    }
+};
+
+// Writes a ShapeStore to disk chunk by chunk
+class DocumentWriter {
+public:
+    static bool save(const ShapeStore& shapes, const std::string& filename,
+                     std::uint32_t chunkSize = DocumentFile::DefaultChunkSize) {
+        std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+        if (!file) {
+            return false;
+        }
+
+        std::uint16_t version = DocumentFile::Version;
+        std::uint16_t reserved = 0;
+        file.write(DocumentFile::Magic, sizeof(DocumentFile::Magic));
+        file.write(reinterpret_cast<const char*>(&version), sizeof(version));
+        file.write(reinterpret_cast<const char*>(&reserved), sizeof(reserved));
+
+        std::vector<std::uint32_t> pointCounts;
+        ChunkEncoder encoder;
+        for (std::size_t first = 0; first < shapes.size(); first += pointCounts.size()) {
+            DocumentFile::chunkExtent(shapes, first, chunkSize, pointCounts);
+            encoder.write(file, shapes, first, pointCounts.size());
+        }
+
+        std::uint32_t end = 0;
+        file.write(reinterpret_cast<const char*>(&end), sizeof(end));
+        return static_cast<bool>(file);
+    }
+};
+
+// Reads a document one chunk at a time, so large files can be shown while
+// they are still loading
+class DocumentReader {
+private:
+    std::ifstream file;
+    bool finished = true;
+    bool error = false;
+    std::uint16_t version = 0;
+    ChunkDecoder decoder;
+
+    bool fail() {
+        error = true;
+        finished = true;
+        file.close();
+        return false;
+    }
+
+public:
+    bool open(const std::string& filename) {
+        file.close();
+        file.clear();
+        file.open(filename, std::ios::binary);
+        finished = false;
+        error = false;
+        if (!file) {
+            return fail();
+        }
+
+        char magic[4];
+        std::uint16_t reserved = 0;
+        file.read(magic, sizeof(magic));
+        file.read(reinterpret_cast<char*>(&version), sizeof(version));
+        file.read(reinterpret_cast<char*>(&reserved), sizeof(reserved));
+        if (!file || std::memcmp(magic, DocumentFile::Magic, sizeof(magic)) != 0 || version < 1 || version > DocumentFile::Version) {
+            return fail();
+        }
+        return true;
+    }
+
+    // Appends the next chunk to `shapes`. Returns false once the document
+    // has been read completely or is malformed
+    bool readChunk(ShapeStore& shapes) {
+        if (finished) {
+            return false;
+        }
+
+        switch (decoder.read(file, version, shapes)) {
+        case ChunkDecoder::Appended:
+            return true;
+        case ChunkDecoder::End:
+            finished = true;
+            file.close();
+            return false;
+        default:
+            return fail();
+        }
+    }
+
+    // Stops reading; shapes already appended are kept
+    void cancel() {
+        finished = true;
+        file.close();
+    }
+
+    bool isLoading() const { return !finished; }
+    bool failed() const { return error; }
+};
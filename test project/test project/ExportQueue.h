@@ -0,0 +1,140 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Writes images and documents to disk on a background thread. The UI
+// thread only does the GPU readback or copies the shapes and queues the
+// result; flattening, PNG compression, encoding and the file write happen
+// on the worker, one job after another
+class ExportQueue {
+private:
+    struct Job {
+        std::unique_ptr<sf::Image> image; // Null for a task
+        std::function<bool()> task;
+        std::string filename;
+        sf::Color background;
+    };
+
+    mutable std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<Job> jobs;
+    bool stopping = false;
+
+    std::atomic<unsigned> pendingCount{ 0 };
+    std::atomic<unsigned> completedCount{ 0 };
+    std::atomic<bool> lastSucceeded{ true };
+    std::string lastFilename; // Guarded by the mutex
+
+    std::thread worker; // Declared last so it starts after the state above exists
+
+    // Composites a possibly transparent image over an opaque background
+    static void flatten(sf::Image& image, const sf::Color& background) {
+        sf::Vector2u size = image.getSize();
+        const sf::Uint8* pixels = image.getPixelsPtr();
+        for (unsigned y = 0; y < size.y; ++y) {
+            for (unsigned x = 0; x < size.x; ++x) {
+                const sf::Uint8* p = pixels + (static_cast<std::size_t>(y) * size.x + x) * 4;
+                if (p[3] == 255) {
+                    continue;
+                }
+                unsigned a = p[3];
+                image.setPixel(x, y, sf::Color(
+                    static_cast<sf::Uint8>((p[0] * a + background.r * (255 - a)) / 255),
+                    static_cast<sf::Uint8>((p[1] * a + background.g * (255 - a)) / 255),
+                    static_cast<sf::Uint8>((p[2] * a + background.b * (255 - a)) / 255)));
+            }
+        }
+    }
+
+    void run() {
+        for (;;) {
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this] { return stopping || !jobs.empty(); });
+                if (jobs.empty()) {
+                    return; // Stopping, and everything queued has been written
+                }
+                job = std::move(jobs.front());
+                jobs.pop_front();
+            }
+
+            bool saved;
+            if (job.task) {
+                saved = job.task();
+            }
+            else {
+                flatten(*job.image, job.background);
+                saved = job.image->saveToFile(job.filename);
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                lastFilename = job.filename;
+            }
+            lastSucceeded = saved;
+            --pendingCount;
+            ++completedCount;
+        }
+    }
+
+public:
+    ExportQueue()
+        : worker(&ExportQueue::run, this) {
+    }
+
+    // Finishes the queued exports before returning, so no save is lost on exit
+    ~ExportQueue() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_one();
+        worker.join();
+    }
+
+    ExportQueue(const ExportQueue&) = delete;
+    ExportQueue& operator=(const ExportQueue&) = delete;
+
+    void push(std::unique_ptr<sf::Image> image, const std::string& filename,
+              const sf::Color& background = sf::Color::Black) {
+        ++pendingCount;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs.push_back(Job{ std::move(image), nullptr, filename, background });
+        }
+        wake.notify_one();
+    }
+
+    // Runs `task` on the worker, e.g. writing a document from a copy of the
+    // shapes. It returns whether `filename` was written
+    void push(std::function<bool()> task, const std::string& filename) {
+        ++pendingCount;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs.push_back(Job{ nullptr, std::move(task), filename, sf::Color::Black });
+        }
+        wake.notify_one();
+    }
+
+    // Number of exports queued or in progress
+    unsigned pending() const { return pendingCount; }
+
+    // Total number of exports finished since startup; changes whenever one completes
+    unsigned completed() const { return completedCount; }
+
+    bool succeeded() const { return lastSucceeded; }
+
+    // File of the export that finished last
+    std::string lastFile() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return lastFilename;
+    }
+};
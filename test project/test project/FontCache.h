@@ -0,0 +1,47 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+#include <initializer_list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+// Process-wide cache of fonts. Each file is parsed once and every user
+// shares the same sf::Font, and therefore the same glyph atlases
+class FontCache {
+private:
+    // Fonts are heap-allocated so references handed out stay valid as the map grows
+    std::unordered_map<std::string, std::unique_ptr<sf::Font>> fonts;
+
+    static FontCache& instance() {
+        static FontCache cache;
+        return cache;
+    }
+
+public:
+    // Returns the font loaded from `filename`, loading it on first use. A font
+    // that fails to load is cached as well, so the failure is only reported once
+    static const sf::Font& get(const std::string& filename) {
+        auto& fonts = instance().fonts;
+        auto found = fonts.find(filename);
+        if (found != fonts.end()) {
+            return *found->second;
+        }
+
+        std::unique_ptr<sf::Font> font(new sf::Font);
+        if (!font->loadFromFile(filename)) {
+            // SFML already reports the error; the empty font just renders nothing
+        }
+        return *fonts.emplace(filename, std::move(font)).first->second;
+    }
+
+    // Rasterizes the printable ASCII glyphs at the given sizes up front, so the
+    // first frame does not stall building the glyph atlas character by character
+    static void prewarm(const sf::Font& font, std::initializer_list<unsigned> characterSizes) {
+        for (unsigned size : characterSizes) {
+            for (sf::Uint32 c = 32; c < 127; ++c) {
+                font.getGlyph(c, size, false);
+            }
+        }
+    }
+};
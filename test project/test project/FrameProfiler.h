@@ -0,0 +1,197 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <fstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+
+// Records how long each part of a frame takes, for the profiling overlay
+// and for CSV / Chrome trace dumps attached to regression reports. Keeps a
+// fixed-size ring of the most recent frames
+class FrameProfiler {
+public:
+    enum Section { Events, Draw, Display, SectionCount };
+
+    struct Frame {
+        double start = 0;                    // Microseconds since the profiler was created
+        double offset[SectionCount] = {};    // First start of each section, relative to `start`
+        double duration[SectionCount] = {};  // Total time spent in each section, in microseconds
+        std::size_t drawCalls = 0;
+        std::size_t vertices = 0;
+        std::size_t shapes = 0;
+        double inputLatency = -1;            // Input to presented frame in microseconds, -1 without input
+
+        double total() const {
+            double sum = 0;
+            for (double d : duration) sum += d;
+            return sum;
+        }
+    };
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    Clock::time_point origin = Clock::now();
+    Clock::time_point sectionStart[SectionCount];
+    Frame current;
+    bool inFrame = false;
+    Clock::time_point inputTime; // Oldest input not yet shown on screen
+    bool inputPending = false;
+
+    std::vector<Frame> history;
+    std::size_t capacity;
+    std::size_t next = 0;
+
+    double now() const {
+        return std::chrono::duration<double, std::micro>(Clock::now() - origin).count();
+    }
+
+    static const char* sectionName(int section) {
+        static const char* names[SectionCount] = { "handleEvents", "drawShapes", "display" };
+        return names[section];
+    }
+
+    // Calls `visit` on the recorded frames, oldest first
+    template <typename Visitor>
+    void forEachFrame(Visitor visit) const {
+        std::size_t first = history.size() < capacity ? 0 : next;
+        for (std::size_t i = 0; i < history.size(); ++i) {
+            visit(history[(first + i) % history.size()]);
+        }
+    }
+
+public:
+    explicit FrameProfiler(std::size_t capacity = 600)
+        : capacity(capacity) {
+        history.reserve(capacity);
+    }
+
+    void beginFrame() {
+        current = Frame();
+        current.start = now();
+        for (double& offset : current.offset) offset = -1;
+        inFrame = true;
+    }
+
+    void begin(Section section) {
+        sectionStart[section] = Clock::now();
+        if (inFrame && current.offset[section] < 0) {
+            current.offset[section] = now() - current.start;
+        }
+    }
+
+    void end(Section section) {
+        current.duration[section] += std::chrono::duration<double, std::micro>(Clock::now() - sectionStart[section]).count();
+    }
+
+    // Notes that input changed what will be shown. Only the oldest input
+    // counts until the frame reflecting it is presented
+    void markInput() {
+        if (!inputPending) {
+            inputTime = Clock::now();
+            inputPending = true;
+        }
+    }
+
+    // Call once the frame has been handed to the display. The swap may still
+    // be queued in the driver, so this is a lower bound on input-to-photon
+    void presented() {
+        if (inputPending) {
+            current.inputLatency = std::chrono::duration<double, std::micro>(Clock::now() - inputTime).count();
+            inputPending = false;
+        }
+    }
+
+    void endFrame(std::size_t drawCalls, std::size_t vertices, std::size_t shapes) {
+        if (!inFrame) {
+            return;
+        }
+        inFrame = false;
+        current.drawCalls = drawCalls;
+        current.vertices = vertices;
+        current.shapes = shapes;
+
+        if (history.size() < capacity) {
+            history.push_back(current);
+        }
+        else {
+            history[next] = current;
+        }
+        next = (next + 1) % capacity;
+    }
+
+    bool empty() const { return history.empty(); }
+
+    const Frame& last() const {
+        return history[(next + capacity - 1) % capacity];
+    }
+
+    // Average section times and input latency over the last `frames` recorded
+    // frames. Frames without input are left out of the latency average
+    Frame average(std::size_t frames = 60) const {
+        Frame result;
+        std::size_t count = frames < history.size() ? frames : history.size();
+        double latency = 0;
+        std::size_t latencyFrames = 0;
+        for (std::size_t i = 0; i < count; ++i) {
+            const Frame& frame = history[(next + capacity - 1 - i) % capacity];
+            for (int s = 0; s < SectionCount; ++s) {
+                result.duration[s] += frame.duration[s] / count;
+            }
+            if (frame.inputLatency >= 0) {
+                latency += frame.inputLatency;
+                ++latencyFrames;
+            }
+        }
+        if (latencyFrames > 0) {
+            result.inputLatency = latency / latencyFrames;
+        }
+        return result;
+    }
+
+    bool writeCsv(const std::string& filename) const {
+        std::ofstream file(filename, std::ios::trunc);
+        if (!file) {
+            return false;
+        }
+        file << std::fixed << std::setprecision(1);
+        file << "start_us,handleEvents_us,drawShapes_us,display_us,total_us,draw_calls,vertices,shapes,input_latency_us\n";
+        forEachFrame([&file](const Frame& frame) {
+            file << frame.start << ',' << frame.duration[Events] << ',' << frame.duration[Draw] << ','
+                 << frame.duration[Display] << ',' << frame.total() << ',' << frame.drawCalls << ','
+                 << frame.vertices << ',' << frame.shapes << ',';
+            if (frame.inputLatency >= 0) {
+                file << frame.inputLatency;
+            }
+            file << '\n';
+        });
+        return static_cast<bool>(file);
+    }
+
+    // Writes the frames in the Chrome trace event format (chrome://tracing, Perfetto)
+    bool writeChromeTrace(const std::string& filename) const {
+        std::ofstream file(filename, std::ios::trunc);
+        if (!file) {
+            return false;
+        }
+        file << std::fixed << std::setprecision(1);
+        file << "{\"traceEvents\":[\n";
+        bool first = true;
+        forEachFrame([&](const Frame& frame) {
+            for (int s = 0; s < SectionCount; ++s) {
+                if (frame.offset[s] < 0) {
+                    continue;
+                }
+                file << (first ? "" : ",\n") << "{\"name\":\"" << sectionName(s) << "\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":"
+                     << frame.start + frame.offset[s] << ",\"dur\":" << frame.duration[s]
+                     << ",\"args\":{\"draw_calls\":" << frame.drawCalls << ",\"vertices\":" << frame.vertices
+                     << ",\"shapes\":" << frame.shapes << "}}";
+                first = false;
+            }
+        });
+        file << "\n]}\n";
+        return static_cast<bool>(file);
+    }
+};
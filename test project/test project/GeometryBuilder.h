@@ -0,0 +1,177 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "RenderBatch.h"
+#include "ShapeStore.h"
+#include "SpatialGrid.h"
+
+// Tessellates shapes into render batches across all cores. A build is cut
+// into fixed-size chunks; worker threads and the calling thread claim
+// chunks from a shared atomic counter, so faster threads simply take more
+// of them. Each finished chunk is published with its own atomic flag and
+// the calling thread, the only consumer, appends chunks to the output in
+// order as soon as they are ready, tessellating unclaimed chunks itself
+// while it waits. No locks are taken per chunk; the mutex only parks idle
+// workers between builds
+class GeometryBuilder {
+public:
+    static const std::size_t ChunkShapes = 4096;
+
+private:
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    unsigned long long generation = 0;
+    std::size_t finishedWorkers = 0; // Workers done with the current generation
+    bool stopping = false;
+
+    // The build in progress; written only while every worker is parked
+    const ShapeStore* jobShapes = nullptr;
+    const SpatialGrid::Index* jobIndices = nullptr; // Null to build [jobFirst, jobFirst + jobCount)
+    std::size_t jobFirst = 0;
+    std::size_t jobCount = 0;
+    float jobScale = 1.f;
+    std::size_t chunkCount = 0;
+    std::atomic<std::size_t> nextChunk{ 0 };
+
+    std::vector<std::unique_ptr<RenderBatch>> chunks;
+    std::unique_ptr<std::atomic<bool>[]> ready;
+    std::size_t readyCapacity = 0;
+
+    void buildChunk(std::size_t chunk) {
+        RenderBatch& batch = *chunks[chunk];
+        batch.clear();
+        std::size_t begin = chunk * ChunkShapes;
+        std::size_t end = std::min(begin + ChunkShapes, jobCount);
+        for (std::size_t i = begin; i < end; ++i) {
+            jobShapes->appendTo(jobIndices ? jobIndices[i] : jobFirst + i, batch, jobScale);
+        }
+        ready[chunk].store(true, std::memory_order_release);
+    }
+
+    // Claims and builds one chunk; returns false once every chunk is claimed
+    bool buildNextChunk() {
+        std::size_t chunk = nextChunk.fetch_add(1, std::memory_order_relaxed);
+        if (chunk >= chunkCount) {
+            return false;
+        }
+        buildChunk(chunk);
+        return true;
+    }
+
+    void workerLoop() {
+        unsigned long long seen = 0;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&] { return stopping || generation != seen; });
+                if (stopping) {
+                    return;
+                }
+                seen = generation;
+            }
+
+            while (buildNextChunk()) {
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if (++finishedWorkers == workers.size()) {
+                idle.notify_all();
+            }
+        }
+    }
+
+    void run(const ShapeStore& shapes, const SpatialGrid::Index* indices, std::size_t first,
+             std::size_t count, float scale, RenderBatch& out) {
+        // Small builds are not worth waking the workers for
+        if (workers.empty() || count < 2 * ChunkShapes) {
+            for (std::size_t i = 0; i < count; ++i) {
+                shapes.appendTo(indices ? indices[i] : first + i, out, scale);
+            }
+            return;
+        }
+
+        chunkCount = (count + ChunkShapes - 1) / ChunkShapes;
+        while (chunks.size() < chunkCount) {
+            chunks.emplace_back(new RenderBatch());
+        }
+        if (readyCapacity < chunkCount) {
+            ready.reset(new std::atomic<bool>[chunkCount]);
+            readyCapacity = chunkCount;
+        }
+        for (std::size_t i = 0; i < chunkCount; ++i) {
+            ready[i].store(false, std::memory_order_relaxed);
+        }
+        jobShapes = &shapes;
+        jobIndices = indices;
+        jobFirst = first;
+        jobCount = count;
+        jobScale = scale;
+        nextChunk.store(0, std::memory_order_relaxed);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            finishedWorkers = 0;
+            ++generation;
+        }
+        wake.notify_all();
+
+        for (std::size_t i = 0; i < chunkCount; ++i) {
+            while (!ready[i].load(std::memory_order_acquire)) {
+                if (!buildNextChunk()) {
+                    std::this_thread::yield();
+                }
+            }
+            out.append(*chunks[i]);
+        }
+
+        // Every worker takes part in every build, if only to find nothing
+        // left to claim; the job must stay untouched until all have
+        std::unique_lock<std::mutex> lock(mutex);
+        idle.wait(lock, [&] { return finishedWorkers == workers.size(); });
+    }
+
+public:
+    // Uses one worker per core besides the calling thread by default
+    explicit GeometryBuilder(unsigned threads = std::max(1u, std::thread::hardware_concurrency()) - 1) {
+        for (unsigned i = 0; i < threads; ++i) {
+            workers.emplace_back(&GeometryBuilder::workerLoop, this);
+        }
+    }
+
+    GeometryBuilder(const GeometryBuilder&) = delete;
+    GeometryBuilder& operator=(const GeometryBuilder&) = delete;
+
+    ~GeometryBuilder() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+    }
+
+    // Appends the geometry of shapes [first, last) to `out`, in order
+    void build(const ShapeStore& shapes, std::size_t first, std::size_t last, float scale, RenderBatch& out) {
+        run(shapes, nullptr, first, last - first, scale, out);
+    }
+
+    // Appends the geometry of the listed shapes to `out`, in order
+    void build(const ShapeStore& shapes, const std::vector<SpatialGrid::Index>& indices, float scale, RenderBatch& out) {
+        run(shapes, indices.data(), 0, indices.size(), scale, out);
+    }
+
+    std::size_t getThreadCount() const { return workers.size() + 1; }
+};
@@ -0,0 +1,427 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+#include <SFML/OpenGL.hpp>
+#include <cmath>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include "RenderBatch.h"
+#include "ShapeStore.h"
+
+// Draws rectangle and circle outlines with instanced OpenGL calls. All
+// rectangles share one outline mesh and circles share one mesh per LOD
+// bucket; each shape only adds a 24-byte instance record (start, extent,
+// color, width) to a buffer that is uploaded once, and a vertex shader
+// places the mesh. The mesh has the same feathered cross-section as
+// StrokeTessellator, sized for the current zoom by the shader, so outlines
+// are anti-aliased here too. The shader and meshes are shared by every
+// renderer in the process. SFML has no instancing API, so this talks to
+// OpenGL directly through the context SFML manages, and resets SFML's
+// state afterwards
+class InstancedRenderer : private sf::GlResource {
+private:
+    struct Instance {
+        sf::Vector2f start;
+        sf::Vector2f extent;
+        sf::Color color;
+        float width;
+    };
+
+    // Circles are grouped by radius into power-of-two classes and each class
+    // is drawn with the mesh its largest circles need at the current zoom.
+    // Neighbouring classes that need the same mesh share a draw call
+    static const int RadiusClasses = 24;
+    static const int RadiusClassOffset = 3; // Class 0 holds radii below 1/4
+
+    static const GLenum ArrayBuffer = 0x8892;
+    static const GLenum StaticDraw = 0x88E4;
+
+    typedef void (APIENTRY* GenBuffersFunction)(GLsizei, GLuint*);
+    typedef void (APIENTRY* DeleteBuffersFunction)(GLsizei, const GLuint*);
+    typedef void (APIENTRY* BindBufferFunction)(GLenum, GLuint);
+    typedef void (APIENTRY* BufferDataFunction)(GLenum, std::ptrdiff_t, const void*, GLenum);
+    typedef void (APIENTRY* VertexAttribPointerFunction)(GLuint, GLint, GLenum, GLboolean, GLsizei, const void*);
+    typedef void (APIENTRY* AttribArrayFunction)(GLuint);
+    typedef void (APIENTRY* VertexAttribDivisorFunction)(GLuint, GLuint);
+    typedef void (APIENTRY* DrawArraysInstancedFunction)(GLenum, GLint, GLsizei, GLsizei);
+    typedef GLint (APIENTRY* GetAttribLocationFunction)(GLuint, const char*);
+    typedef void (APIENTRY* BindAttribLocationFunction)(GLuint, GLuint, const char*);
+    typedef void (APIENTRY* LinkProgramFunction)(GLuint);
+
+    // Entry points beyond OpenGL 1.1, resolved once through SFML
+    struct Functions {
+        GenBuffersFunction genBuffers;
+        DeleteBuffersFunction deleteBuffers;
+        BindBufferFunction bindBuffer;
+        BufferDataFunction bufferData;
+        VertexAttribPointerFunction vertexAttribPointer;
+        AttribArrayFunction enableVertexAttribArray;
+        AttribArrayFunction disableVertexAttribArray;
+        VertexAttribDivisorFunction vertexAttribDivisor;
+        DrawArraysInstancedFunction drawArraysInstanced;
+        GetAttribLocationFunction getAttribLocation;
+        BindAttribLocationFunction bindAttribLocation;
+        LinkProgramFunction linkProgram;
+        bool loaded;
+
+        template <typename Function>
+        static Function load(const char* name, const char* alternative = nullptr) {
+            sf::GlFunctionPointer function = sf::Context::getFunction(name);
+            if (!function && alternative) {
+                function = sf::Context::getFunction(alternative);
+            }
+            return reinterpret_cast<Function>(function);
+        }
+
+        Functions() {
+            genBuffers = load<GenBuffersFunction>("glGenBuffers");
+            deleteBuffers = load<DeleteBuffersFunction>("glDeleteBuffers");
+            bindBuffer = load<BindBufferFunction>("glBindBuffer");
+            bufferData = load<BufferDataFunction>("glBufferData");
+            vertexAttribPointer = load<VertexAttribPointerFunction>("glVertexAttribPointer");
+            enableVertexAttribArray = load<AttribArrayFunction>("glEnableVertexAttribArray");
+            disableVertexAttribArray = load<AttribArrayFunction>("glDisableVertexAttribArray");
+            vertexAttribDivisor = load<VertexAttribDivisorFunction>("glVertexAttribDivisor", "glVertexAttribDivisorARB");
+            drawArraysInstanced = load<DrawArraysInstancedFunction>("glDrawArraysInstanced", "glDrawArraysInstancedARB");
+            getAttribLocation = load<GetAttribLocationFunction>("glGetAttribLocation");
+            bindAttribLocation = load<BindAttribLocationFunction>("glBindAttribLocation");
+            linkProgram = load<LinkProgramFunction>("glLinkProgram");
+            loaded = genBuffers && deleteBuffers && bindBuffer && bufferData && vertexAttribPointer
+                && enableVertexAttribArray && disableVertexAttribArray && vertexAttribDivisor
+                && drawArraysInstanced && getAttribLocation && bindAttribLocation && linkProgram;
+        }
+    };
+
+    // Needs an active context the first time
+    static const Functions& gl() {
+        static const Functions functions;
+        return functions;
+    }
+
+    // `corner` is a mesh vertex: for rectangles, xy is the corner in units of
+    // the size; for circles, the unit direction from the centre. z is the
+    // miter length of the mesh's corners. w picks the vertex's ring across
+    // the outline, from the inner edge of the feather (0) through the opaque
+    // core (1, 2) to the outer edge (3); `pixel` is a pixel in scene units
+    static const char* vertexShader() {
+        return R"(
+            #version 120
+            uniform mat4 viewMatrix;
+            uniform float pixel;
+            uniform float circle;
+            attribute vec4 corner;
+            attribute vec2 start;
+            attribute vec2 extent;
+            attribute vec4 color;
+            attribute float width;
+            varying vec4 vertexColor;
+
+            void main() {
+                float halfWidth = width * 0.5;
+                float core = max(halfWidth - pixel * 0.5, 0.0);
+                float feather = max(halfWidth, pixel * 0.5) + pixel * 0.5;
+                float inner = corner.w > 0.5 && corner.w < 2.5 ? 1.0 : 0.0;
+                float offset = halfWidth + (corner.w < 1.5 ? -1.0 : 1.0) * mix(feather, core, inner);
+
+                vec2 position;
+                if (circle > 0.5) {
+                    float radius = extent.x;
+                    position = start + vec2(radius) + corner.xy * (radius + corner.z * offset);
+                }
+                else {
+                    vec2 outward = (corner.xy * 2.0 - 1.0) * sign(extent);
+                    position = start + corner.xy * extent + outward * corner.z * offset;
+                }
+                gl_Position = viewMatrix * vec4(position, 0.0, 1.0);
+                vertexColor = vec4(color.rgb, color.a * inner * min(1.0, 2.0 * halfWidth / pixel));
+            })";
+    }
+
+    static const char* fragmentShader() {
+        return R"(
+            #version 120
+            varying vec4 vertexColor;
+
+            void main() {
+                gl_FragColor = vertexColor;
+            })";
+    }
+
+    static const int MeshRings = 4;
+    static const GLsizei RectangleMeshSize = 4 * (MeshRings - 1) * 6;
+
+    // The shader and the outline meshes, which are the same for every
+    // renderer. SFML's contexts share their programs and buffers, so one
+    // copy serves the layers of every window. Built by the first renderer
+    // to upload, on the UI thread, and freed with the last one
+    struct Program : private sf::GlResource {
+        sf::Shader shader;
+        GLuint meshBuffer = 0;
+        GLint startAttribute = -1;
+        GLint extentAttribute = -1;
+        GLint colorAttribute = -1;
+        GLint widthAttribute = -1;
+        GLint circleMeshFirst[ShapeStore::CircleLodCount];
+        GLsizei circleMeshSize[ShapeStore::CircleLodCount];
+        bool ready = false;
+
+        Program() {
+            TransientContextLock lock;
+            ready = build();
+        }
+
+        Program(const Program&) = delete;
+        Program& operator=(const Program&) = delete;
+
+        ~Program() {
+            if (meshBuffer != 0) {
+                TransientContextLock lock;
+                gl().deleteBuffers(1, &meshBuffer);
+            }
+        }
+
+        bool build() {
+            if (!shader.loadFromMemory(vertexShader(), fragmentShader())) {
+                return false;
+            }
+
+            // Compatibility contexts need attribute 0 to be an enabled array, and
+            // sf::Shader offers no hook before linking, so bind it and relink
+            const Functions& f = gl();
+            GLuint program = shader.getNativeHandle();
+            f.bindAttribLocation(program, 0, "corner");
+            f.linkProgram(program);
+            startAttribute = f.getAttribLocation(program, "start");
+            extentAttribute = f.getAttribLocation(program, "extent");
+            colorAttribute = f.getAttribLocation(program, "color");
+            widthAttribute = f.getAttribLocation(program, "width");
+            if (startAttribute < 0 || extentAttribute < 0 || colorAttribute < 0 || widthAttribute < 0) {
+                return false;
+            }
+
+            // Rectangle outline around the four corners, whose diagonal
+            // directions already are their miters, then one circle outline per
+            // LOD bucket, as sf::Shape mitres them
+            std::vector<GLfloat> mesh;
+            const float corners[12] = { 0, 0, 1, 1, 0, 1, 1, 1, 1, 0, 1, 1 };
+            addOutlineMesh(mesh, corners, 4);
+            std::vector<float> circle;
+            for (std::size_t lod = 0; lod < ShapeStore::CircleLodCount; ++lod) {
+                const std::vector<sf::Vector2f>& directions = ShapeStore::unitCircle(lod);
+                float miter = 1.f / std::cos(3.141592654f / directions.size());
+                circle.clear();
+                for (const sf::Vector2f& d : directions) {
+                    circle.insert(circle.end(), { d.x, d.y, miter });
+                }
+                circleMeshFirst[lod] = static_cast<GLint>(mesh.size() / 4);
+                circleMeshSize[lod] = static_cast<GLsizei>(directions.size() * (MeshRings - 1) * 6);
+                addOutlineMesh(mesh, circle.data(), directions.size());
+            }
+
+            f.genBuffers(1, &meshBuffer);
+            f.bindBuffer(ArrayBuffer, meshBuffer);
+            f.bufferData(ArrayBuffer, static_cast<std::ptrdiff_t>(mesh.size() * sizeof(GLfloat)), mesh.data(), StaticDraw);
+            f.bindBuffer(ArrayBuffer, 0);
+            return true;
+        }
+    };
+
+    static std::shared_ptr<Program> sharedProgram() {
+        static std::weak_ptr<Program> shared;
+        std::shared_ptr<Program> program = shared.lock();
+        if (!program) {
+            program = std::make_shared<Program>();
+            shared = program;
+        }
+        return program;
+    }
+
+    std::shared_ptr<Program> program;
+    GLuint instanceBuffer = 0;
+    bool initialized = false;
+    bool ready = false;
+
+    std::vector<Instance> rectangles;
+    std::vector<Instance> circles[RadiusClasses];
+    std::vector<Instance> staging;
+    std::size_t classFirst[RadiusClasses + 1] = {}; // Offsets into the buffer, after the rectangles
+    std::size_t uploadedRectangles = 0;
+
+    static int radiusClass(float radius) {
+        int exponent = radius > 0.f ? static_cast<int>(std::floor(std::log2(radius))) + RadiusClassOffset : 0;
+        return exponent < 0 ? 0 : exponent >= RadiusClasses ? RadiusClasses - 1 : exponent;
+    }
+
+    // Largest radius in a class, in scene units
+    static float classRadius(int radiusClass) {
+        return std::pow(2.f, static_cast<float>(radiusClass + 1 - RadiusClassOffset));
+    }
+
+    // Appends the triangles of a closed outline through `count` corners,
+    // each as 3 floats (x, y, miter), with MeshRings rings across it
+    static void addOutlineMesh(std::vector<GLfloat>& mesh, const float* corners, std::size_t count) {
+        for (std::size_t i = 0; i < count; ++i) {
+            const float* a = corners + i * 3;
+            const float* b = corners + (i + 1) % count * 3;
+            for (int ring = 0; ring + 1 < MeshRings; ++ring) {
+                GLfloat r0 = static_cast<GLfloat>(ring);
+                GLfloat r1 = static_cast<GLfloat>(ring + 1);
+                mesh.insert(mesh.end(), { a[0], a[1], a[2], r0, b[0], b[1], b[2], r0, b[0], b[1], b[2], r1,
+                                          a[0], a[1], a[2], r0, b[0], b[1], b[2], r1, a[0], a[1], a[2], r1 });
+            }
+        }
+    }
+
+    bool initialize() {
+        if (initialized) {
+            return ready;
+        }
+        initialized = true;
+        if (!isAvailable()) {
+            return false;
+        }
+        program = sharedProgram();
+        if (!program->ready) {
+            return false;
+        }
+        gl().genBuffers(1, &instanceBuffer);
+        ready = true;
+        return true;
+    }
+
+    void drawInstances(GLenum primitive, GLint meshFirst, GLsizei meshSize, std::size_t first, std::size_t count) {
+        if (count == 0) {
+            return;
+        }
+        const Functions& f = gl();
+        const Program& p = *program;
+        const char* base = reinterpret_cast<const char*>(first * sizeof(Instance));
+        f.vertexAttribPointer(p.startAttribute, 2, GL_FLOAT, GL_FALSE, sizeof(Instance), base);
+        f.vertexAttribPointer(p.extentAttribute, 2, GL_FLOAT, GL_FALSE, sizeof(Instance), base + sizeof(sf::Vector2f));
+        f.vertexAttribPointer(p.colorAttribute, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Instance), base + 2 * sizeof(sf::Vector2f));
+        f.vertexAttribPointer(p.widthAttribute, 1, GL_FLOAT, GL_FALSE, sizeof(Instance),
+                              base + 2 * sizeof(sf::Vector2f) + sizeof(sf::Color));
+        f.drawArraysInstanced(primitive, meshFirst, meshSize, static_cast<GLsizei>(count));
+        RenderStats::count(static_cast<std::size_t>(meshSize) * count);
+    }
+
+public:
+    InstancedRenderer() = default;
+    InstancedRenderer(const InstancedRenderer&) = delete;
+    InstancedRenderer& operator=(const InstancedRenderer&) = delete;
+
+    ~InstancedRenderer() {
+        if (ready) {
+            TransientContextLock lock;
+            gl().deleteBuffers(1, &instanceBuffer);
+        }
+    }
+
+    // True if the OpenGL implementation supports shaders and instancing
+    static bool isAvailable() {
+        TransientContextLock lock;
+        return sf::Shader::isAvailable() && gl().loaded;
+    }
+
+    void clear() {
+        rectangles.clear();
+        for (std::vector<Instance>& list : circles) {
+            list.clear();
+        }
+    }
+
+    // Queues shape `index` if it is a rectangle or circle; returns false otherwise
+    bool add(const ShapeStore& shapes, std::size_t index) {
+        Instance instance = { shapes.start(index), shapes.extent(index), shapes.color(index), shapes.width(index) };
+        switch (shapes.kind(index)) {
+        case ShapeKind::Rectangle:
+            rectangles.push_back(instance);
+            return true;
+        case ShapeKind::Circle:
+            circles[radiusClass(instance.extent.x)].push_back(instance);
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    // Copies the queued instances to the GPU; returns false if instancing
+    // could not be set up
+    bool upload() {
+        TransientContextLock lock;
+        if (!initialize()) {
+            return false;
+        }
+
+        staging.assign(rectangles.begin(), rectangles.end());
+        for (int c = 0; c < RadiusClasses; ++c) {
+            classFirst[c] = staging.size();
+            staging.insert(staging.end(), circles[c].begin(), circles[c].end());
+        }
+        classFirst[RadiusClasses] = staging.size();
+        uploadedRectangles = rectangles.size();
+
+        const Functions& f = gl();
+        f.bindBuffer(ArrayBuffer, instanceBuffer);
+        f.bufferData(ArrayBuffer, static_cast<std::ptrdiff_t>(staging.size() * sizeof(Instance)), staging.data(), StaticDraw);
+        f.bindBuffer(ArrayBuffer, 0);
+        return true;
+    }
+
+    void draw(sf::RenderTarget& target, const sf::View& view) {
+        if (!ready || classFirst[RadiusClasses] == 0 || !target.setActive(true)) {
+            return;
+        }
+        const Functions& f = gl();
+        Program& p = *program;
+        target.resetGLStates();
+        sf::IntRect viewport = target.getViewport(view);
+        glViewport(viewport.left, static_cast<GLint>(target.getSize().y) - viewport.top - viewport.height,
+                   viewport.width, viewport.height);
+        glDisableClientState(GL_VERTEX_ARRAY);
+        glDisableClientState(GL_COLOR_ARRAY);
+        glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+
+        float pixelsPerUnit = viewport.width / view.getSize().x;
+        p.shader.setUniform("viewMatrix", sf::Glsl::Mat4(view.getTransform().getMatrix()));
+        p.shader.setUniform("pixel", 1.f / pixelsPerUnit);
+        sf::Shader::bind(&p.shader);
+
+        f.bindBuffer(ArrayBuffer, p.meshBuffer);
+        f.vertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), nullptr);
+        f.enableVertexAttribArray(0);
+        f.bindBuffer(ArrayBuffer, instanceBuffer);
+        for (GLint attribute : { p.startAttribute, p.extentAttribute, p.colorAttribute, p.widthAttribute }) {
+            f.enableVertexAttribArray(attribute);
+            f.vertexAttribDivisor(attribute, 1);
+        }
+
+        p.shader.setUniform("circle", 0.f);
+        drawInstances(GL_TRIANGLES, 0, RectangleMeshSize, 0, uploadedRectangles);
+
+        p.shader.setUniform("circle", 1.f);
+        for (int c = 0; c < RadiusClasses;) {
+            std::size_t lod = c + 1 < RadiusClasses ? ShapeStore::circleLod(classRadius(c) * pixelsPerUnit)
+                : ShapeStore::CircleLodCount - 1;
+            int end = c + 1;
+            while (end + 1 < RadiusClasses && ShapeStore::circleLod(classRadius(end) * pixelsPerUnit) == lod) {
+                ++end;
+            }
+            drawInstances(GL_TRIANGLES, p.circleMeshFirst[lod], p.circleMeshSize[lod], classFirst[c], classFirst[end] - classFirst[c]);
+            c = end;
+        }
+
+        for (GLint attribute : { p.startAttribute, p.extentAttribute, p.colorAttribute, p.widthAttribute }) {
+            f.vertexAttribDivisor(attribute, 0);
+            f.disableVertexAttribArray(attribute);
+        }
+        f.disableVertexAttribArray(0);
+        f.bindBuffer(ArrayBuffer, 0);
+        sf::Shader::bind(nullptr);
+        target.resetGLStates();
+    }
+
+    std::size_t getInstanceCount() const { return classFirst[RadiusClasses]; }
+};
@@ -0,0 +1,296 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Antialiasing.h"
+#include "CanvasLayer.h"
+#include "CommandHistory.h"
+#include "GeometryBuilder.h"
+#include "RasterLayer.h"
+#include "ShapeStore.h"
+#include "SpatialGrid.h"
+
+// One layer of a drawing. It has its own shapes, index, history, bucket
+// fills and cached image, so editing one layer never redraws another
+struct Layer {
+    std::string name;
+    ShapeStore shapes;
+    SpatialGrid index;
+    CommandHistory history;
+    RasterLayer fills;
+    CanvasLayer canvas;
+    bool visible = true;
+    bool locked = false; // Locked layers take no edits
+};
+
+// The layers of a drawing, bottom to top. Each layer keeps its own undo
+// history; the stack remembers which layer every edit went to, so undo and
+// redo walk back and forth through the edits of all layers in order
+class LayerStack {
+private:
+    std::vector<std::unique_ptr<Layer>> layers; // Bottom to top
+    std::size_t active = 0;
+    std::vector<Layer*> undoOrder;
+    std::vector<Layer*> redoOrder;
+    GeometryBuilder& geometry; // Shared by the layers' canvases, and with other documents
+    sf::RenderTexture composite; // Created on first use by compositeImage()
+    sf::ContextSettings canvasSettings; // Multisampling of the layers' canvases
+    sf::View view;
+    unsigned width = 0;
+    unsigned height = 0;
+    unsigned nextNumber = 1;
+
+public:
+    explicit LayerStack(GeometryBuilder& builder)
+        : geometry(builder) {
+    }
+
+    // Creates the first, empty layer
+    bool create(unsigned layerWidth, unsigned layerHeight) {
+        width = layerWidth;
+        height = layerHeight;
+        view = sf::View(sf::FloatRect(0, 0, static_cast<float>(width), static_cast<float>(height)));
+        return add() != nullptr;
+    }
+
+    // Adds an empty layer above the active one and makes it active
+    Layer* add() {
+        std::unique_ptr<Layer> layer(new Layer());
+        if (!layer->canvas.create(width, height, geometry, canvasSettings)) {
+            return nullptr;
+        }
+        layer->canvas.setView(view);
+        layer->canvas.setFills(layer->fills);
+        layer->name = "Layer " + std::to_string(nextNumber++);
+        std::size_t position = layers.empty() ? 0 : active + 1;
+        layers.insert(layers.begin() + position, std::move(layer));
+        active = position;
+        return layers[active].get();
+    }
+
+    std::size_t size() const { return layers.size(); }
+    Layer& operator[](std::size_t position) { return *layers[position]; }
+    const Layer& operator[](std::size_t position) const { return *layers[position]; }
+
+    Layer& getActive() { return *layers[active]; }
+
+    // Position of `layer` in the stack, or size() if it is not in it
+    std::size_t indexOf(const Layer& layer) const {
+        for (std::size_t i = 0; i < layers.size(); ++i) {
+            if (layers[i].get() == &layer) {
+                return i;
+            }
+        }
+        return layers.size();
+    }
+    std::size_t getActiveIndex() const { return active; }
+
+    void setActive(std::size_t position) {
+        if (position < layers.size()) {
+            active = position;
+        }
+    }
+
+    // Moves the active layer one step up (+1) or down (-1). Only the
+    // compositing order changes; no layer is redrawn
+    bool moveActive(int direction) {
+        std::size_t target = active + direction;
+        if (direction == 0 || target >= layers.size()) {
+            return false;
+        }
+        std::swap(layers[active], layers[target]);
+        active = target;
+        return true;
+    }
+
+    // Total number of shapes in all layers
+    std::size_t shapeCount() const {
+        std::size_t count = 0;
+        for (const std::unique_ptr<Layer>& layer : layers) {
+            count += layer->shapes.size();
+        }
+        return count;
+    }
+
+    // Notes that a new command was recorded in `layer`'s history. Whatever
+    // could be redone, in any layer, is no longer reachable
+    void recordEdit(Layer& layer) {
+        for (Layer* undone : redoOrder) {
+            undone->history.clearRedo();
+        }
+        redoOrder.clear();
+        undoOrder.push_back(&layer);
+    }
+
+    // Drops the undo history of every layer, e.g. when the drawing starts
+    // being shared and everyone's history has to start from the same point
+    void forgetHistory() {
+        for (std::unique_ptr<Layer>& layer : layers) {
+            layer->history.forget();
+        }
+        undoOrder.clear();
+        redoOrder.clear();
+    }
+
+    // Replaces the drawing with one empty layer, e.g. before rebuilding it
+    // from records sent by another program. Returns false if the layer's
+    // canvas could not be created
+    bool reset() {
+        layers.clear();
+        undoOrder.clear();
+        redoOrder.clear();
+        active = 0;
+        nextNumber = 1;
+        return add() != nullptr;
+    }
+
+    // Undoes the most recent edit of any layer. Returns the layer it
+    // applied to, or null if there was nothing to undo
+    Layer* undo(HistoryChange& change) {
+        while (!undoOrder.empty()) {
+            Layer* layer = undoOrder.back();
+            undoOrder.pop_back();
+            change = layer->history.undo(layer->shapes);
+            // Commands past a layer's memory limit are gone; skip them
+            if (change.kind != HistoryChange::Kind::None) {
+                redoOrder.push_back(layer);
+                return layer;
+            }
+        }
+        return nullptr;
+    }
+
+    // Undoes the most recent edit of any layer and forgets it; nothing can
+    // redo it. Returns the layer it applied to, or null
+    Layer* retract(HistoryChange& change) {
+        while (!undoOrder.empty()) {
+            Layer* layer = undoOrder.back();
+            undoOrder.pop_back();
+            change = layer->history.retract(layer->shapes);
+            if (change.kind != HistoryChange::Kind::None) {
+                return layer;
+            }
+        }
+        return nullptr;
+    }
+
+    // True if some layer may have an edit to redo
+    bool canRedo() const { return !redoOrder.empty(); }
+
+    Layer* redo(HistoryChange& change) {
+        while (!redoOrder.empty()) {
+            Layer* layer = redoOrder.back();
+            redoOrder.pop_back();
+            change = layer->history.redo(layer->shapes);
+            if (change.kind != HistoryChange::Kind::None) {
+                undoOrder.push_back(layer);
+                return layer;
+            }
+        }
+        return nullptr;
+    }
+
+    // Points every layer's canvas at a new camera view and repaints it
+    void setView(const sf::View& camera) {
+        view = camera;
+        for (std::unique_ptr<Layer>& layer : layers) {
+            layer->canvas.setView(view);
+            layer->canvas.repaintAll(layer->shapes, layer->index);
+        }
+    }
+
+    // Recreates every layer's canvas with `quality`'s multisampling and
+    // repaints it. Returns false if a canvas could not be created
+    bool setAntialiasing(const Antialiasing& quality) {
+        canvasSettings = quality.contextSettings();
+        bool created = true;
+        for (std::unique_ptr<Layer>& layer : layers) {
+            created = layer->canvas.create(width, height, geometry, canvasSettings) && created;
+            layer->canvas.setView(view);
+            layer->canvas.repaintAll(layer->shapes, layer->index);
+        }
+        return created;
+    }
+
+    // Draws the visible layers onto `target`, bottom to top
+    void draw(sf::RenderTarget& target) const {
+        for (const std::unique_ptr<Layer>& layer : layers) {
+            if (layer->visible) {
+                target.draw(sf::Sprite(layer->canvas.getTexture()));
+                RenderStats::count(4);
+            }
+        }
+    }
+
+    // Copies the shapes of the visible layers, bottom to top, into `out`,
+    // e.g. for exporting the drawing as one document
+    void flatten(ShapeStore& out) const {
+        out.clear();
+        for (const std::unique_ptr<Layer>& layer : layers) {
+            if (layer->visible) {
+                out.append(layer->shapes, 0, layer->shapes.size());
+            }
+        }
+    }
+
+    // The visible layers as they appear on screen, on a transparent
+    // background. Without antialiasing this copies the layers' canvases;
+    // otherwise the shapes are rendered again at the requested quality
+    sf::Image compositeImage(const Antialiasing& quality = Antialiasing()) {
+        if (!quality.isOff()) {
+            return renderImage(quality);
+        }
+        if (composite.getSize().x == 0 && !composite.create(width, height)) {
+            return sf::Image();
+        }
+        composite.clear(sf::Color::Transparent);
+        draw(composite);
+        composite.display();
+        return composite.getTexture().copyToImage();
+    }
+
+private:
+    sf::Image renderImage(const Antialiasing& quality) {
+        unsigned factor = quality.supersampleFor(width, height);
+        sf::RenderTexture target;
+        if (!target.create(width * factor, height * factor, quality.contextSettings())) {
+            return sf::Image();
+        }
+        target.setView(view);
+        target.clear(sf::Color::Transparent);
+
+        sf::FloatRect area(view.getCenter() - view.getSize() / 2.f, view.getSize());
+        float pixelsPerUnit = width * factor / view.getSize().x;
+        std::vector<SpatialGrid::Index> visible;
+        RenderBatch batch;
+        for (const std::unique_ptr<Layer>& layer : layers) {
+            if (!layer->visible) {
+                continue;
+            }
+            layer->fills.draw(target);
+            layer->index.query(area, visible);
+            batch.clear();
+            for (SpatialGrid::Index i : visible) {
+                layer->shapes.appendTo(i, batch, pixelsPerUnit);
+            }
+            batch.draw(target);
+        }
+        target.display();
+
+        sf::Image rendered = target.getTexture().copyToImage();
+        if (factor == 1) {
+            return rendered;
+        }
+        std::vector<sf::Uint8> pixels(static_cast<std::size_t>(width) * height * 4);
+        Antialiasing::downsample(rendered.getPixelsPtr(), width * factor, factor, width, height,
+                                 pixels.data(), static_cast<std::size_t>(width) * 4);
+        sf::Image image;
+        image.create(width, height, pixels.data());
+        return image;
+    }
+};
@@ -0,0 +1,525 @@
+#pragma once
+
+#include <SFML/Network.hpp>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "AutosaveJournal.h"
+#include "LayerStack.h"
+#include "ShapeStore.h"
+
+// Shares one drawing between programs over TCP. One program hosts and the
+// others join it. A client gets the whole drawing once, when it joins;
+// after that only edits travel, as the same records the autosave journal
+// writes (AutosaveJournal.h), so a new shape costs a record header and its
+// compact chunk rather than the scene. The edits of a frame go out in one
+// message, and no socket ever blocks the frame.
+//
+// The host decides the order of all edits. It applies edits as they reach
+// it and relays each one to every client, its author included, tagged with
+// the author's site and the author's own sequence number; the echo tells a
+// client where its edit went. A client applies its new shapes, moves and
+// clears at once. If anything reaches it before the echo of such an edit,
+// the window retracts its unconfirmed edits, applies what came first and
+// reapplies them, so every copy applies the same edits in the same order
+// and ends up with the same drawing and undo history. Undo and redo, and
+// edits that would drop something a retract could not bring back, wait for
+// the echo instead. A Baseline edit sent when a client joins makes everyone
+// forget their undo history, as the new client has none. All values are
+// little-endian.
+//
+//   message  uint32 size of the rest, uint8 type, then
+//     Welcome  uint32 site of the client, then records rebuilding the drawing
+//     Edits    edit*: uint32 site, uint32 sequence, uint8 kind, uint32 size, records
+class NetworkSession {
+public:
+    static const unsigned short DefaultPort = 53020;
+    static const std::uint32_t HostSite = 0;
+
+    enum class Kind : std::uint8_t { Records = 1, Baseline };
+
+    struct Edit {
+        std::uint32_t site;
+        std::uint32_t sequence;
+        Kind kind;
+        std::vector<char> records; // Journal records of the current version
+        bool applied;   // Own unconfirmed edits: applied before the host ordered them
+        bool effective; // Applying it added a command to the history, which a retract takes back
+    };
+
+private:
+    enum class Role { Offline, Connecting, Joining, Joined, Hosting };
+    enum MessageType : std::uint8_t { Welcome = 1, Edits };
+    enum ConnectState { Pending, Connected, Refused };
+
+    static const std::uint32_t MaxMessageBytes = 1u << 30;
+    static const std::size_t MaxBacklogBytes = 1u << 28; // Unsent bytes before a peer that stopped reading is dropped
+    static const std::size_t MaxReadBytes = 1u << 24;    // Read from one peer per frame
+    static const std::size_t EditHeaderBytes = 13;
+    static const int ConnectSeconds = 5;
+
+    struct Peer {
+        std::unique_ptr<sf::TcpSocket> socket;
+        std::uint32_t site;
+        std::vector<char> outgoing; // Not yet taken by the socket
+        std::vector<char> incoming; // Received, not yet a whole message
+        bool dropped = false;
+    };
+
+    Role role = Role::Offline;
+    sf::TcpListener listener;
+    std::vector<Peer> peers; // The clients when hosting, the host when joined
+    std::uint32_t site = HostSite;
+    std::uint32_t nextSite = 1;
+    std::uint32_t nextSequence = 1;
+    JournalEncoder encoder;
+    std::vector<char> batch;      // Edits of this frame, sent by the next update()
+    std::deque<Edit> received;    // In the host's order
+    std::deque<Edit> unconfirmed; // Own edits the host has not echoed yet
+    std::vector<char> welcome;    // Records of the drawing, until taken
+    bool hasWelcome = false;
+    unsigned joins = 0;
+    unsigned leaves = 0;
+    bool failed = false;
+
+    // SFML can only wait for a connection by blocking, so connecting
+    // happens on a thread, which owns `connecting` until it finishes
+    std::thread connector;
+    std::atomic<int> connectState{ Pending };
+    std::unique_ptr<sf::TcpSocket> connecting;
+
+    static void put32(std::vector<char>& out, std::uint32_t value) {
+        char bytes[4];
+        std::memcpy(bytes, &value, sizeof(bytes));
+        out.insert(out.end(), bytes, bytes + sizeof(bytes));
+    }
+
+    static std::uint32_t get32(const char* data) {
+        std::uint32_t value;
+        std::memcpy(&value, data, sizeof(value));
+        return value;
+    }
+
+    static std::size_t beginMessage(std::vector<char>& out, MessageType type) {
+        std::size_t at = out.size();
+        put32(out, 0);
+        out.push_back(static_cast<char>(type));
+        return at;
+    }
+
+    static void endMessage(std::vector<char>& out, std::size_t at) {
+        std::uint32_t size = static_cast<std::uint32_t>(out.size() - at - 4);
+        std::memcpy(out.data() + at, &size, sizeof(size));
+    }
+
+    static std::size_t beginEdit(std::vector<char>& out, std::uint32_t editSite, std::uint32_t sequence, Kind kind) {
+        put32(out, editSite);
+        put32(out, sequence);
+        out.push_back(static_cast<char>(kind));
+        std::size_t at = out.size();
+        put32(out, 0);
+        return at;
+    }
+
+    static void endEdit(std::vector<char>& out, std::size_t at) {
+        std::uint32_t size = static_cast<std::uint32_t>(out.size() - at - 4);
+        std::memcpy(out.data() + at, &size, sizeof(size));
+    }
+
+    // Starts an edit of our own in the batch; returns where its records begin
+    std::size_t beginOwnEdit(Kind kind) {
+        return beginEdit(batch, site, nextSequence++, kind);
+    }
+
+    // Finishes an edit begun at `at`. A client keeps it until the host
+    // echoes it, with whether it has already been applied
+    void endOwnEdit(std::size_t at, bool applied) {
+        endEdit(batch, at);
+        if (role == Role::Joined) {
+            Edit edit = { site, nextSequence - 1, Kind::Records,
+                          std::vector<char>(batch.begin() + at + 4, batch.end()), applied, applied };
+            unconfirmed.push_back(std::move(edit));
+        }
+    }
+
+    void recordOp(AutosaveJournal::Op op, std::size_t layer, bool applied) {
+        if (isSharing()) {
+            std::size_t at = beginOwnEdit(Kind::Records);
+            JournalEncoder::record(batch, op, 0, static_cast<std::uint32_t>(layer));
+            endOwnEdit(at, applied);
+        }
+    }
+
+    // Hands the edits of this frame to every peer's socket buffer
+    void sendBatch() {
+        if (batch.empty()) {
+            return;
+        }
+        for (Peer& peer : peers) {
+            std::size_t at = beginMessage(peer.outgoing, Edits);
+            peer.outgoing.insert(peer.outgoing.end(), batch.begin(), batch.end());
+            endMessage(peer.outgoing, at);
+        }
+        batch.clear();
+    }
+
+    // Admits the clients waiting to join. Each starts from the drawing as
+    // it is now, with no history, so everyone else forgets theirs too
+    void acceptClients(const LayerStack& layers) {
+        bool admitted = false;
+        for (;;) {
+            Peer peer;
+            peer.socket.reset(new sf::TcpSocket());
+            if (listener.accept(*peer.socket) != sf::Socket::Done) {
+                break;
+            }
+            peer.socket->setBlocking(false);
+            peer.site = nextSite++;
+            std::size_t at = beginMessage(peer.outgoing, Welcome);
+            put32(peer.outgoing, peer.site);
+            encoder.snapshot(peer.outgoing, layers);
+            endMessage(peer.outgoing, at);
+            peers.push_back(std::move(peer));
+            admitted = true;
+            ++joins;
+        }
+        if (admitted) {
+            std::size_t at = beginEdit(batch, HostSite, nextSequence++, Kind::Baseline);
+            endEdit(batch, at);
+        }
+    }
+
+    // Sends what the socket takes and reads what has arrived, without blocking
+    void exchange(Peer& peer) {
+        if (!peer.outgoing.empty()) {
+            std::size_t sent = 0;
+            sf::Socket::Status status = peer.socket->send(peer.outgoing.data(), peer.outgoing.size(), sent);
+            if (status == sf::Socket::Done) {
+                sent = peer.outgoing.size();
+            }
+            else if (status != sf::Socket::Partial && status != sf::Socket::NotReady) {
+                peer.dropped = true;
+                return;
+            }
+            peer.outgoing.erase(peer.outgoing.begin(), peer.outgoing.begin() + sent);
+            if (peer.outgoing.size() > MaxBacklogBytes) {
+                peer.dropped = true;
+                return;
+            }
+        }
+
+        char buffer[65536];
+        for (std::size_t total = 0; total < MaxReadBytes;) {
+            std::size_t count = 0;
+            sf::Socket::Status status = peer.socket->receive(buffer, sizeof(buffer), count);
+            if (status == sf::Socket::NotReady) {
+                break;
+            }
+            if (status != sf::Socket::Done) {
+                peer.dropped = true;
+                break;
+            }
+            peer.incoming.insert(peer.incoming.end(), buffer, buffer + count);
+            total += count;
+        }
+        parse(peer);
+    }
+
+    // Handles every whole message `peer` has sent
+    void parse(Peer& peer) {
+        std::size_t at = 0;
+        while (!peer.dropped && peer.incoming.size() - at >= 4) {
+            std::uint32_t size = get32(peer.incoming.data() + at);
+            if (size == 0 || size > MaxMessageBytes) {
+                peer.dropped = true;
+                break;
+            }
+            if (peer.incoming.size() - at - 4 < size) {
+                break;
+            }
+            const char* body = peer.incoming.data() + at + 4;
+            if (!handle(peer, static_cast<std::uint8_t>(body[0]), body + 1, size - 1)) {
+                peer.dropped = true;
+            }
+            at += 4 + static_cast<std::size_t>(size);
+        }
+        peer.incoming.erase(peer.incoming.begin(), peer.incoming.begin() + at);
+    }
+
+    bool handle(const Peer& peer, std::uint8_t type, const char* data, std::size_t size) {
+        if (type == Welcome) {
+            if (role != Role::Joining || size < 4) {
+                return false;
+            }
+            site = get32(data);
+            welcome.assign(data + 4, data + size);
+            hasWelcome = true;
+            role = Role::Joined;
+            return true;
+        }
+        if (type != Edits || (role != Role::Joined && role != Role::Hosting)) {
+            return false;
+        }
+        while (size > 0) {
+            if (size < EditHeaderBytes) {
+                return false;
+            }
+            Edit edit = { get32(data), get32(data + 4), static_cast<Kind>(data[8]), std::vector<char>(), false, false };
+            std::uint32_t length = get32(data + 9);
+            data += EditHeaderBytes;
+            size -= EditHeaderBytes;
+            if (length > size) {
+                return false;
+            }
+            // Clients only send their own edits, and only the host starts a baseline
+            bool valid = role == Role::Hosting ? edit.site == peer.site && edit.kind == Kind::Records
+                : edit.kind == Kind::Records || edit.kind == Kind::Baseline;
+            if (!valid) {
+                return false;
+            }
+            edit.records.assign(data, data + length);
+            received.push_back(std::move(edit));
+            data += length;
+            size -= length;
+        }
+        return true;
+    }
+
+    // Ends the session after a failure. Unconfirmed edits stay until
+    // leave(), as the window may be reapplying them
+    void disconnect() {
+        for (Peer& peer : peers) {
+            peer.socket->disconnect();
+        }
+        peers.clear();
+        listener.close();
+        batch.clear();
+        received.clear();
+        role = Role::Offline;
+        failed = true;
+    }
+
+public:
+    NetworkSession() = default;
+    NetworkSession(const NetworkSession&) = delete;
+    NetworkSession& operator=(const NetworkSession&) = delete;
+
+    ~NetworkSession() {
+        leave();
+    }
+
+    // Starts sharing the drawing with the clients that connect to `port`
+    bool host(unsigned short port) {
+        leave();
+        if (listener.listen(port) != sf::Socket::Done) {
+            return false;
+        }
+        listener.setBlocking(false);
+        role = Role::Hosting;
+        site = HostSite;
+        return true;
+    }
+
+    // Starts connecting to the host at `address`, a name or an IP address,
+    // in the background. The drawing is replaced by the host's once
+    // takeWelcome() returns it
+    void join(const std::string& address, unsigned short port) {
+        leave();
+        role = Role::Connecting;
+        connectState = Pending;
+        connecting.reset(new sf::TcpSocket());
+        sf::TcpSocket* socket = connecting.get();
+        connector = std::thread([this, socket, address, port] {
+            sf::Socket::Status status = socket->connect(sf::IpAddress(address), port, sf::seconds(ConnectSeconds));
+            connectState = status == sf::Socket::Done ? Connected : Refused;
+        });
+    }
+
+    // Stops sharing, closing every connection. Waits for a connection
+    // attempt still in progress, at most ConnectSeconds
+    void leave() {
+        if (connector.joinable()) {
+            connector.join();
+        }
+        connecting.reset();
+        for (Peer& peer : peers) {
+            peer.socket->disconnect();
+        }
+        peers.clear();
+        listener.close();
+        batch.clear();
+        received.clear();
+        unconfirmed.clear();
+        welcome.clear();
+        hasWelcome = false;
+        joins = leaves = 0;
+        failed = false;
+        nextSite = 1;
+        nextSequence = 1;
+        role = Role::Offline;
+    }
+
+    bool isActive() const { return role != Role::Offline; }
+    bool isHosting() const { return role == Role::Hosting; }
+    bool isJoined() const { return role == Role::Joined; }
+
+    // Edits are only recorded while hosting or joined; until a client has
+    // the host's drawing, its edits are its own
+    bool isSharing() const { return role == Role::Hosting || role == Role::Joined; }
+
+    std::size_t peerCount() const { return role == Role::Hosting ? peers.size() : 0; }
+
+    // Records shapes [first, first + count) as added to `layer`. `applied`
+    // is false for a client's edit that waits for the host's order
+    void addShapes(std::size_t layer, const ShapeStore& shapes, std::size_t first, std::size_t count,
+                   bool merge = false, bool applied = true) {
+        if (isSharing()) {
+            std::size_t at = beginOwnEdit(Kind::Records);
+            encoder.shapes(batch, static_cast<std::uint32_t>(layer), shapes, first, count, merge ? AutosaveJournal::Merge : 0);
+            endOwnEdit(at, applied);
+        }
+    }
+
+    // Records the current versions of the `count` shapes at `indices` of `layer`
+    void modifyShapes(std::size_t layer, const ShapeStore& shapes, const std::uint32_t* indices, std::size_t count,
+                      bool applied = true) {
+        if (isSharing()) {
+            std::size_t at = beginOwnEdit(Kind::Records);
+            encoder.modifiedShapes(batch, static_cast<std::uint32_t>(layer), shapes, indices, count);
+            endOwnEdit(at, applied);
+        }
+    }
+
+    void clear(std::size_t layer, bool applied = true) { recordOp(AutosaveJournal::Op::Clear, layer, applied); }
+
+    // A client's undo and redo always wait for the host's order, as
+    // everyone has to undo the same edit
+    void undo() { recordOp(AutosaveJournal::Op::Undo, 0, !isJoined()); }
+    void redo() { recordOp(AutosaveJournal::Op::Redo, 0, !isJoined()); }
+
+    // Sends this frame's edits, admits new clients, and sends and receives
+    // what the sockets take without blocking. Call once per frame, when
+    // `layers` can be sent as it is
+    void update(const LayerStack& layers) {
+        if (role == Role::Connecting) {
+            if (connectState == Pending) {
+                return;
+            }
+            connector.join();
+            if (connectState == Refused) {
+                connecting.reset();
+                disconnect();
+                return;
+            }
+            connecting->setBlocking(false);
+            Peer host;
+            host.socket = std::move(connecting);
+            host.site = HostSite;
+            peers.push_back(std::move(host));
+            role = Role::Joining;
+        }
+        if (role == Role::Offline) {
+            return;
+        }
+
+        sendBatch();
+        if (role == Role::Hosting) {
+            acceptClients(layers);
+        }
+        for (Peer& peer : peers) {
+            exchange(peer);
+        }
+        for (std::size_t i = peers.size(); i-- > 0;) {
+            if (!peers[i].dropped) {
+                continue;
+            }
+            if (role != Role::Hosting) {
+                disconnect();
+                return;
+            }
+            peers[i].socket->disconnect();
+            peers.erase(peers.begin() + i);
+            ++leaves;
+        }
+    }
+
+    // Returns the records of the host's drawing once, after joining
+    bool takeWelcome(std::vector<char>& records) {
+        if (!hasWelcome) {
+            return false;
+        }
+        records.swap(welcome);
+        welcome.clear();
+        hasWelcome = false;
+        return true;
+    }
+
+    // Clients admitted since the last call; the host forgets its history
+    // when there are any, as the Baseline sent to the others says
+    unsigned takeJoins() {
+        unsigned count = joins;
+        joins = 0;
+        return count;
+    }
+
+    unsigned takeLeaves() {
+        unsigned count = leaves;
+        leaves = 0;
+        return count;
+    }
+
+    // Returns true once, after connecting failed or the host was lost
+    bool takeFailure() {
+        bool result = failed;
+        failed = false;
+        return result;
+    }
+
+    // Takes the next edit to apply, in the host's order. When hosting,
+    // the edit is also relayed to every client
+    bool receive(Edit& edit) {
+        if (received.empty()) {
+            return false;
+        }
+        edit = std::move(received.front());
+        received.pop_front();
+        if (role == Role::Hosting) {
+            std::size_t at = beginEdit(batch, edit.site, edit.sequence, edit.kind);
+            batch.insert(batch.end(), edit.records.begin(), edit.records.end());
+            endEdit(batch, at);
+        }
+        else if (edit.site == site && (unconfirmed.empty() || unconfirmed.front().sequence != edit.sequence)) {
+            disconnect(); // The host's order does not match ours
+            return false;
+        }
+        return true;
+    }
+
+    // True if `edit`, from receive(), is the echo of our oldest unconfirmed
+    // edit; confirm() then drops it
+    bool isOwn(const Edit& edit) const { return role == Role::Joined && edit.site == site && !unconfirmed.empty(); }
+
+    void confirm() {
+        unconfirmed.pop_front();
+    }
+
+    // Own edits the host has not ordered yet, oldest first
+    std::deque<Edit>& unconfirmedEdits() { return unconfirmed; }
+
+    bool hasAppliedEdits() const {
+        for (const Edit& edit : unconfirmed) {
+            if (edit.applied) {
+                return true;
+            }
+        }
+        return false;
+    }
+};
@@ -0,0 +1,239 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Writes an RGBA PNG one row at a time, so images far larger than memory
+// can be produced. Rows use the Sub filter and are deflated with the fixed
+// Huffman code plus run-length matches, which is cheap and compresses the
+// large flat areas of a drawing well. Output is flushed in bounded IDAT
+// chunks as it is produced
+class PngStreamWriter {
+private:
+    static const std::size_t ChunkSize = 1 << 16;
+
+    std::ofstream file;
+    unsigned width = 0;
+    unsigned height = 0;
+    unsigned rowsWritten = 0;
+
+    std::vector<std::uint8_t> output;   // Compressed bytes not yet written as an IDAT chunk
+    std::vector<std::uint8_t> filtered; // One filtered row, reused
+    std::uint32_t bitBuffer = 0;
+    int bitCount = 0;
+
+    std::uint32_t adlerA = 1;
+    std::uint32_t adlerB = 0;
+
+    // Run-length state: the last byte emitted and how many copies are pending
+    int lastByte = -1;
+    unsigned runLength = 0;
+
+    static std::array<std::uint32_t, 256> makeCrcTable() {
+        std::array<std::uint32_t, 256> table;
+        for (std::uint32_t n = 0; n < 256; ++n) {
+            std::uint32_t c = n;
+            for (int k = 0; k < 8; ++k) {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            table[n] = c;
+        }
+        return table;
+    }
+
+    // Built once, safely even when several export workers start together
+    static const std::uint32_t* crcTable() {
+        static const std::array<std::uint32_t, 256> table = makeCrcTable();
+        return table.data();
+    }
+
+    static std::uint32_t crc(std::uint32_t crc, const std::uint8_t* data, std::size_t size) {
+        const std::uint32_t* table = crcTable();
+        for (std::size_t i = 0; i < size; ++i) {
+            crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+        }
+        return crc;
+    }
+
+    static void putBigEndian(std::vector<std::uint8_t>& out, std::uint32_t value) {
+        out.push_back(static_cast<std::uint8_t>(value >> 24));
+        out.push_back(static_cast<std::uint8_t>(value >> 16));
+        out.push_back(static_cast<std::uint8_t>(value >> 8));
+        out.push_back(static_cast<std::uint8_t>(value));
+    }
+
+    void writeChunk(const char type[4], const std::uint8_t* data, std::size_t size) {
+        std::vector<std::uint8_t> header;
+        putBigEndian(header, static_cast<std::uint32_t>(size));
+        header.insert(header.end(), type, type + 4);
+
+        std::uint32_t checksum = crc(0xFFFFFFFFu, header.data() + 4, 4);
+        checksum = crc(checksum, data, size) ^ 0xFFFFFFFFu;
+        std::vector<std::uint8_t> trailer;
+        putBigEndian(trailer, checksum);
+
+        file.write(reinterpret_cast<const char*>(header.data()), header.size());
+        file.write(reinterpret_cast<const char*>(data), size);
+        file.write(reinterpret_cast<const char*>(trailer.data()), trailer.size());
+    }
+
+    void flushOutput() {
+        if (!output.empty()) {
+            writeChunk("IDAT", output.data(), output.size());
+            output.clear();
+        }
+    }
+
+    // Deflate streams are packed least-significant bit first
+    void putBits(std::uint32_t value, int count) {
+        bitBuffer |= value << bitCount;
+        bitCount += count;
+        while (bitCount >= 8) {
+            output.push_back(static_cast<std::uint8_t>(bitBuffer));
+            bitBuffer >>= 8;
+            bitCount -= 8;
+        }
+        if (output.size() >= ChunkSize) {
+            flushOutput();
+        }
+    }
+
+    // Huffman codes are defined most-significant bit first
+    void putCode(std::uint32_t code, int length) {
+        std::uint32_t reversed = 0;
+        for (int i = 0; i < length; ++i) {
+            reversed = (reversed << 1) | ((code >> i) & 1);
+        }
+        putBits(reversed, length);
+    }
+
+    void putLiteral(unsigned symbol) {
+        if (symbol < 144) putCode(0x30 + symbol, 8);
+        else if (symbol < 256) putCode(0x190 + symbol - 144, 9);
+        else if (symbol < 280) putCode(symbol - 256, 7);
+        else putCode(0xC0 + symbol - 280, 8);
+    }
+
+    // Emits a back-reference of `length` (3 to 258) bytes at distance 1
+    void putRepeat(unsigned length) {
+        static const unsigned base[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                           35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+        static const int extra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                       3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+        int code = 28;
+        while (base[code] > length) {
+            --code;
+        }
+        putLiteral(257 + code);
+        putBits(length - base[code], extra[code]);
+        putCode(0, 5); // Distance code 0: distance 1
+    }
+
+    void flushRun() {
+        while (runLength >= 3) {
+            unsigned length = runLength > 258 ? 258 : runLength;
+            if (runLength - length > 0 && runLength - length < 3) {
+                length = runLength - 3; // Leave a remainder long enough for another match
+            }
+            putRepeat(length);
+            runLength -= length;
+        }
+        for (; runLength > 0; --runLength) {
+            putLiteral(static_cast<unsigned>(lastByte));
+        }
+    }
+
+    void putByte(std::uint8_t value) {
+        adlerA = (adlerA + value) % 65521;
+        adlerB = (adlerB + adlerA) % 65521;
+
+        if (value == lastByte) {
+            ++runLength;
+            return;
+        }
+        flushRun();
+        putLiteral(value);
+        lastByte = value;
+    }
+
+public:
+    ~PngStreamWriter() {
+        if (file.is_open()) {
+            close();
+        }
+    }
+
+    bool open(const std::string& filename, unsigned imageWidth, unsigned imageHeight) {
+        file.open(filename, std::ios::binary | std::ios::trunc);
+        if (!file || imageWidth == 0 || imageHeight == 0) {
+            return false;
+        }
+        width = imageWidth;
+        height = imageHeight;
+        rowsWritten = 0;
+        output.clear();
+        filtered.resize(static_cast<std::size_t>(width) * 4 + 1);
+        bitBuffer = 0;
+        bitCount = 0;
+        adlerA = 1;
+        adlerB = 0;
+        lastByte = -1;
+        runLength = 0;
+
+        static const std::uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+        file.write(reinterpret_cast<const char*>(signature), sizeof(signature));
+
+        std::vector<std::uint8_t> header;
+        putBigEndian(header, width);
+        putBigEndian(header, height);
+        header.push_back(8); // Bit depth
+        header.push_back(6); // RGBA
+        header.push_back(0); // Deflate
+        header.push_back(0); // Adaptive filtering
+        header.push_back(0); // No interlace
+        writeChunk("IHDR", header.data(), header.size());
+
+        // zlib header, then a single final block using the fixed Huffman code
+        output.push_back(0x78);
+        output.push_back(0x01);
+        putBits(1, 1);
+        putBits(1, 2);
+        return static_cast<bool>(file);
+    }
+
+    // Appends one row of `width` RGBA pixels
+    void writeRow(const std::uint8_t* pixels) {
+        std::size_t rowBytes = static_cast<std::size_t>(width) * 4;
+        filtered[0] = 1; // Sub filter: each byte minus the same channel of the pixel to its left
+        for (std::size_t i = 0; i < rowBytes; ++i) {
+            filtered[i + 1] = static_cast<std::uint8_t>(pixels[i] - (i >= 4 ? pixels[i - 4] : 0));
+        }
+        for (std::uint8_t value : filtered) {
+            putByte(value);
+        }
+        ++rowsWritten;
+    }
+
+    unsigned getWidth() const { return width; }
+
+    // Finishes the stream; returns false if fewer rows than the height were written
+    // or the file could not be written
+    bool close() {
+        flushRun();
+        putLiteral(256); // End of block
+        if (bitCount > 0) {
+            putBits(0, 8 - bitCount);
+        }
+        putBigEndian(output, (adlerB << 16) | adlerA);
+        flushOutput();
+        writeChunk("IEND", nullptr, 0);
+
+        bool complete = rowsWritten == height && static_cast<bool>(file);
+        file.close();
+        return complete;
+    }
+};
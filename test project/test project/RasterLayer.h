@@ -0,0 +1,438 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define RASTER_LAYER_SSE2 1
+#endif
+
+#include "RenderBatch.h"
+#include "ShapeStore.h"
+#include "SpatialGrid.h"
+
+// Bitmap fills of one layer, painted by the bucket tool at one pixel per
+// scene unit. The bitmap is sparse: only 64x64 tiles that were filled
+// exist, so a fill never touches more of the scene than the region it
+// paints. Tiles live in slots of large atlas textures and are uploaded one
+// sub-rectangle at a time when they change, and each atlas page is drawn
+// with a single call.
+//
+// Fills are bounded by the outlines of the layer's shapes, rasterized on
+// the CPU tile by tile as the fill reaches them, and by pixels filled with
+// a different colour. They spread a scanline at a time, comparing four
+// pixels per instruction where SSE2 is available
+class RasterLayer {
+public:
+    static const int TileSize = 64;
+    static const int MaxFillSize = 4096; // Largest fill, in pixels per side, centred on the seed
+
+private:
+    static const std::size_t PageTiles = 32; // Tiles per side of one atlas texture
+    static const std::uint32_t Boundary = 1; // Transparent but non-zero, so never a fill colour
+    static constexpr float BoundaryTolerance = 0.75f; // Wide enough that diagonal lines do not leak
+
+    struct Tile {
+        std::vector<std::uint32_t> pixels; // RGBA, row by row
+        std::size_t slot = 0;
+        bool dirty = true;
+    };
+
+    std::unordered_map<std::uint64_t, Tile> tiles;
+    std::vector<std::uint64_t> dirtyTiles;
+    std::vector<std::unique_ptr<sf::Texture>> pages;
+    std::vector<sf::VertexArray> quads; // One triangle list per atlas page
+    std::size_t usedSlots = 0;
+
+    // Used while a fill runs: what the pixels look like to the fill, with
+    // outlines rasterized in as Boundary
+    std::unordered_map<std::uint64_t, std::vector<std::uint32_t>> source;
+    std::vector<SpatialGrid::Index> candidates;
+    std::vector<sf::Vector2i> seeds;
+
+    static std::uint64_t key(int x, int y) {
+        return (static_cast<std::uint64_t>(static_cast<std::uint32_t>(x)) << 32) | static_cast<std::uint32_t>(y);
+    }
+
+    // Tile containing pixel coordinate `v`, rounding towards negative infinity
+    static int tileOf(int v) {
+        return v >= 0 ? v / TileSize : -((-v - 1) / TileSize) - 1;
+    }
+
+    static int offsetIn(int v) {
+        return v - tileOf(v) * TileSize;
+    }
+
+    static std::uint32_t pixelValue(const sf::Color& color) {
+        sf::Uint8 bytes[4] = { color.r, color.g, color.b, color.a };
+        std::uint32_t value;
+        std::memcpy(&value, bytes, sizeof(value));
+        return value;
+    }
+
+    // Length of the run of `value` at the start of p[0, n)
+    static int countMatches(const std::uint32_t* p, int n, std::uint32_t value) {
+        int i = 0;
+#ifdef RASTER_LAYER_SSE2
+        __m128i wanted = _mm_set1_epi32(static_cast<int>(value));
+        for (; i + 4 <= n; i += 4) {
+            __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+            if (_mm_movemask_epi8(_mm_cmpeq_epi32(pixels, wanted)) != 0xFFFF) {
+                break;
+            }
+        }
+#endif
+        while (i < n && p[i] == value) {
+            ++i;
+        }
+        return i;
+    }
+
+    // Length of the run of `value` ending at `last`, looking back at most n pixels
+    static int countMatchesBackward(const std::uint32_t* last, int n, std::uint32_t value) {
+        int i = 0;
+#ifdef RASTER_LAYER_SSE2
+        __m128i wanted = _mm_set1_epi32(static_cast<int>(value));
+        for (; i + 4 <= n; i += 4) {
+            __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(last - i - 3));
+            if (_mm_movemask_epi8(_mm_cmpeq_epi32(pixels, wanted)) != 0xFFFF) {
+                break;
+            }
+        }
+#endif
+        while (i < n && last[-i] == value) {
+            ++i;
+        }
+        return i;
+    }
+
+    Tile& tileAt(int tx, int ty) {
+        auto found = tiles.find(key(tx, ty));
+        if (found != tiles.end()) {
+            return found->second;
+        }
+
+        Tile& tile = tiles[key(tx, ty)];
+        tile.pixels.assign(TileSize * TileSize, 0);
+        tile.slot = usedSlots++;
+        dirtyTiles.push_back(key(tx, ty));
+
+        std::size_t page = tile.slot / (PageTiles * PageTiles);
+        if (quads.size() <= page) {
+            quads.resize(page + 1, sf::VertexArray(sf::Triangles));
+        }
+        float left = static_cast<float>(tx * TileSize);
+        float top = static_cast<float>(ty * TileSize);
+        float u = static_cast<float>(tile.slot % PageTiles * TileSize);
+        float v = static_cast<float>(tile.slot / PageTiles % PageTiles * TileSize);
+        float size = static_cast<float>(TileSize);
+        sf::Vertex corners[4] = {
+            sf::Vertex({ left, top }, { u, v }),
+            sf::Vertex({ left + size, top }, { u + size, v }),
+            sf::Vertex({ left + size, top + size }, { u + size, v + size }),
+            sf::Vertex({ left, top + size }, { u, v + size }),
+        };
+        for (int i : { 0, 1, 2, 0, 2, 3 }) {
+            quads[page].append(corners[i]);
+        }
+        return tile;
+    }
+
+    // Marks the pixels of row `y` of the fill's view of the tile at `left`
+    // whose centres lie in [low, high] and pass `inside`
+    template <typename Inside>
+    static void markSpan(std::vector<std::uint32_t>& pixels, int left, int top, int y, float low, float high, Inside inside) {
+        int x0 = std::max(left, static_cast<int>(std::floor(low - 0.5f)));
+        int x1 = std::min(left + TileSize, static_cast<int>(std::ceil(high - 0.5f)) + 1);
+        std::uint32_t* row = &pixels[(y - top) * TileSize];
+        for (int x = x0; x < x1; ++x) {
+            if (row[x - left] != Boundary && inside(sf::Vector2f(x + 0.5f, y + 0.5f))) {
+                row[x - left] = Boundary;
+            }
+        }
+    }
+
+    // Rows of the tile at `top` that [low, high] reaches
+    static int firstRow(int top, float low) { return std::max(top, static_cast<int>(std::floor(low - 0.5f))); }
+    static int endRow(int top, float high) { return std::min(top + TileSize, static_cast<int>(std::ceil(high - 0.5f)) + 1); }
+
+    // Marks the pixels whose centres lie within `reach` of segment a..b. Each
+    // row only visits the pixels beside the part of the segment that reaches it
+    static void rasterizeSegment(std::vector<std::uint32_t>& pixels, int left, int top,
+                                 const sf::Vector2f& a, const sf::Vector2f& b, float reach) {
+        if (std::max(a.x, b.x) + reach < left || std::min(a.x, b.x) - reach > left + TileSize) {
+            return;
+        }
+        float dx = b.x - a.x;
+        float dy = b.y - a.y;
+        int y1 = endRow(top, std::max(a.y, b.y) + reach);
+        for (int y = firstRow(top, std::min(a.y, b.y) - reach); y < y1; ++y) {
+            float cy = y + 0.5f;
+            float t0 = 0.f, t1 = 1.f;
+            if (dy != 0.f) {
+                float ta = (cy - reach - a.y) / dy;
+                float tb = (cy + reach - a.y) / dy;
+                t0 = std::max(0.f, std::min(ta, tb));
+                t1 = std::min(1.f, std::max(ta, tb));
+                if (t0 > t1) {
+                    continue;
+                }
+            }
+            float xa = a.x + dx * t0;
+            float xb = a.x + dx * t1;
+            markSpan(pixels, left, top, y, std::min(xa, xb) - reach, std::max(xa, xb) + reach,
+                     [&](const sf::Vector2f& p) { return ShapeStore::distanceToSegment(p, a, b) <= reach; });
+        }
+    }
+
+    // Marks the pixels of tile (left, top) on the outline of shape `i`,
+    // exactly those ShapeStore::hitTest finds within BoundaryTolerance
+    static void rasterizeOutline(std::vector<std::uint32_t>& pixels, int left, int top, const ShapeStore& shapes, SpatialGrid::Index i) {
+        const sf::Vector2f& a = shapes.start(i);
+        const sf::Vector2f& e = shapes.extent(i);
+        float width = shapes.width(i);
+        switch (shapes.kind(i)) {
+        case ShapeKind::Line:
+            rasterizeSegment(pixels, left, top, a, e, BoundaryTolerance + width / 2);
+            break;
+        case ShapeKind::Rectangle: {
+            sf::Vector2f corners[4] = { a, { a.x + e.x, a.y }, a + e, { a.x, a.y + e.y } };
+            for (int side = 0; side < 4; ++side) {
+                rasterizeSegment(pixels, left, top, corners[side], corners[(side + 1) % 4], BoundaryTolerance + width);
+            }
+            break;
+        }
+        case ShapeKind::Circle: {
+            // A ring: each row crosses it in one span, or two beside the hole
+            sf::Vector2f center = a + sf::Vector2f(e.x, e.x);
+            float inner = std::max(0.f, e.x - BoundaryTolerance);
+            float outer = e.x + width + BoundaryTolerance;
+            auto inside = [&](const sf::Vector2f& p) { return shapes.hitTest(i, p, BoundaryTolerance); };
+            int y1 = endRow(top, center.y + outer);
+            for (int y = firstRow(top, center.y - outer); y < y1; ++y) {
+                float dy = y + 0.5f - center.y;
+                if (std::abs(dy) > outer) {
+                    continue;
+                }
+                float outerHalf = std::sqrt(outer * outer - dy * dy);
+                if (std::abs(dy) >= inner) {
+                    markSpan(pixels, left, top, y, center.x - outerHalf, center.x + outerHalf, inside);
+                }
+                else {
+                    float innerHalf = std::sqrt(inner * inner - dy * dy);
+                    markSpan(pixels, left, top, y, center.x - outerHalf, center.x - innerHalf, inside);
+                    markSpan(pixels, left, top, y, center.x + innerHalf, center.x + outerHalf, inside);
+                }
+            }
+            break;
+        }
+        case ShapeKind::Stroke: {
+            const sf::Vector2f* p = shapes.pointData(i);
+            std::size_t count = shapes.pointCount(i);
+            float reach = BoundaryTolerance + width / 2;
+            for (std::size_t k = 1; k < count; ++k) {
+                rasterizeSegment(pixels, left, top, p[k - 1], p[k], reach);
+            }
+            if (count == 1) {
+                rasterizeSegment(pixels, left, top, p[0], p[0], reach);
+            }
+            break;
+        }
+        }
+    }
+
+    // The fill's view of tile (tx, ty), rasterizing the outlines over it on first use
+    std::vector<std::uint32_t>& sourceTile(int tx, int ty, const ShapeStore& shapes, const SpatialGrid& index) {
+        std::vector<std::uint32_t>& pixels = source[key(tx, ty)];
+        if (!pixels.empty()) {
+            return pixels;
+        }
+
+        auto tile = tiles.find(key(tx, ty));
+        if (tile != tiles.end()) {
+            pixels = tile->second.pixels;
+        }
+        else {
+            pixels.assign(TileSize * TileSize, 0);
+        }
+
+        int left = tx * TileSize;
+        int top = ty * TileSize;
+        float margin = BoundaryTolerance; // Shape bounds already include their widths
+        index.query(sf::FloatRect(left - margin, top - margin, TileSize + 2 * margin, TileSize + 2 * margin), candidates);
+        for (SpatialGrid::Index i : candidates) {
+            rasterizeOutline(pixels, left, top, shapes, i);
+        }
+        return pixels;
+    }
+
+    std::uint32_t* sourcePixel(int x, int y, const ShapeStore& shapes, const SpatialGrid& index) {
+        std::vector<std::uint32_t>& pixels = sourceTile(tileOf(x), tileOf(y), shapes, index);
+        return &pixels[offsetIn(y) * TileSize + offsetIn(x)];
+    }
+
+    // Number of pixels matching `value` from x towards +x, at most `limit`
+    int runRight(int x, int y, int limit, std::uint32_t value, const ShapeStore& shapes, const SpatialGrid& index) {
+        int count = 0;
+        while (count < limit) {
+            int px = x + count;
+            int inTile = std::min(limit - count, TileSize - offsetIn(px));
+            int matched = countMatches(sourcePixel(px, y, shapes, index), inTile, value);
+            count += matched;
+            if (matched < inTile) {
+                break;
+            }
+        }
+        return count;
+    }
+
+    // Number of pixels matching `value` from x towards -x, at most `limit`
+    int runLeft(int x, int y, int limit, std::uint32_t value, const ShapeStore& shapes, const SpatialGrid& index) {
+        int count = 0;
+        while (count < limit) {
+            int px = x - count;
+            int inTile = std::min(limit - count, offsetIn(px) + 1);
+            int matched = countMatchesBackward(sourcePixel(px, y, shapes, index), inTile, value);
+            count += matched;
+            if (matched < inTile) {
+                break;
+            }
+        }
+        return count;
+    }
+
+    // Paints pixels [x0, x1) of row y, in the bitmap and in the fill's view of it
+    void paintSpan(int x0, int x1, int y, std::uint32_t value, const ShapeStore& shapes, const SpatialGrid& index) {
+        while (x0 < x1) {
+            int tx = tileOf(x0);
+            int end = std::min(x1, (tx + 1) * TileSize);
+            std::uint32_t* painted = sourcePixel(x0, y, shapes, index);
+            std::fill(painted, painted + (end - x0), value);
+
+            Tile& tile = tileAt(tx, tileOf(y));
+            std::uint32_t* pixels = &tile.pixels[offsetIn(y) * TileSize + offsetIn(x0)];
+            std::fill(pixels, pixels + (end - x0), value);
+            if (!tile.dirty) {
+                tile.dirty = true;
+                dirtyTiles.push_back(key(tx, tileOf(y)));
+            }
+            x0 = end;
+        }
+    }
+
+public:
+    bool empty() const { return tiles.empty(); }
+
+    void clear() {
+        tiles.clear();
+        dirtyTiles.clear();
+        quads.clear();
+        usedSlots = 0;
+    }
+
+    // Flood-fills the region around `seed` that is bounded by the outlines
+    // of `shapes` and by pixels of other colours, within `area`. Returns
+    // false if the seed is on an outline or already has `color`; otherwise
+    // `changed` receives the bounds of the painted pixels. Call upload()
+    // before the next draw
+    bool fill(const sf::Vector2f& seed, const sf::Color& color, const ShapeStore& shapes,
+              const SpatialGrid& index, const sf::IntRect& area, sf::IntRect& changed) {
+        int sx = static_cast<int>(std::floor(seed.x));
+        int sy = static_cast<int>(std::floor(seed.y));
+        int left = std::max(area.left, sx - MaxFillSize / 2);
+        int top = std::max(area.top, sy - MaxFillSize / 2);
+        int right = std::min(area.left + area.width, sx + MaxFillSize / 2);
+        int bottom = std::min(area.top + area.height, sy + MaxFillSize / 2);
+        if (sx < left || sx >= right || sy < top || sy >= bottom) {
+            return false;
+        }
+
+        std::uint32_t value = pixelValue(color);
+        std::uint32_t target = *sourcePixel(sx, sy, shapes, index);
+        if (target == Boundary || target == value) {
+            source.clear();
+            return false;
+        }
+
+        int minX = sx, minY = sy, maxX = sx, maxY = sy;
+        seeds.assign(1, sf::Vector2i(sx, sy));
+        while (!seeds.empty()) {
+            sf::Vector2i s = seeds.back();
+            seeds.pop_back();
+            if (*sourcePixel(s.x, s.y, shapes, index) != target) {
+                continue; // Painted since it was pushed
+            }
+
+            int x0 = s.x - runLeft(s.x, s.y, s.x - left + 1, target, shapes, index) + 1;
+            int x1 = s.x + runRight(s.x, s.y, right - s.x, target, shapes, index);
+            paintSpan(x0, x1, s.y, value, shapes, index);
+            minX = std::min(minX, x0);
+            maxX = std::max(maxX, x1 - 1);
+            minY = std::min(minY, s.y);
+            maxY = std::max(maxY, s.y);
+
+            // One seed for every run of the target colour above and below the span
+            for (int y : { s.y - 1, s.y + 1 }) {
+                if (y < top || y >= bottom) {
+                    continue;
+                }
+                int x = x0;
+                while (x < x1) {
+                    int run = runRight(x, y, x1 - x, target, shapes, index);
+                    if (run > 0) {
+                        seeds.push_back(sf::Vector2i(x, y));
+                        x += run;
+                    }
+                    else {
+                        ++x;
+                    }
+                }
+            }
+        }
+
+        source.clear();
+        changed = sf::IntRect(minX, minY, maxX - minX + 1, maxY - minY + 1);
+        return true;
+    }
+
+    // Copies the tiles changed since the last upload into their atlas slots
+    bool upload() {
+        std::size_t pageCount = (usedSlots + PageTiles * PageTiles - 1) / (PageTiles * PageTiles);
+        while (pages.size() < pageCount) {
+            std::unique_ptr<sf::Texture> page(new sf::Texture());
+            if (!page->create(PageTiles * TileSize, PageTiles * TileSize)) {
+                return false;
+            }
+            pages.push_back(std::move(page));
+        }
+
+        for (std::uint64_t k : dirtyTiles) {
+            Tile& tile = tiles[k];
+            sf::Texture& page = *pages[tile.slot / (PageTiles * PageTiles)];
+            page.update(reinterpret_cast<const sf::Uint8*>(tile.pixels.data()), TileSize, TileSize,
+                        static_cast<unsigned>(tile.slot % PageTiles * TileSize),
+                        static_cast<unsigned>(tile.slot / PageTiles % PageTiles * TileSize));
+            tile.dirty = false;
+        }
+        dirtyTiles.clear();
+        return true;
+    }
+
+    // Draws the uploaded tiles in scene coordinates, through the target's view
+    void draw(sf::RenderTarget& target) const {
+        for (std::size_t i = 0; i < quads.size() && i < pages.size(); ++i) {
+            sf::RenderStates states;
+            states.texture = pages[i].get();
+            target.draw(quads[i], states);
+            RenderStats::count(quads[i].getVertexCount());
+        }
+    }
+};
@@ -0,0 +1,316 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "RenderBatch.h"
+
+// A photo or scan placed beneath the drawing to trace over. The file is
+// decoded on a background thread, which also builds a pyramid of half-size
+// copies down to one that fits in a single tile. The UI thread then
+// uploads only the TileSize tiles of the pyramid level that matches the
+// zoom and covers the view, a few per frame, each with its own mipmaps.
+// Tiles still missing are drawn from the nearest coarser level already on
+// the GPU, so the image never disappears while it sharpens, and the least
+// recently shown tiles are released once too many are resident. Images of
+// any size therefore stay within texture limits and never stall a frame
+class ReferenceImage {
+public:
+    static const unsigned TileSize = 512;
+    static const std::size_t MaxResidentTiles = 96; // About 130 MB of texture memory with mipmaps
+    static const unsigned UploadsPerFrame = 4;
+
+private:
+    enum State { Empty, Loading, Decoded, Ready, Failed };
+
+    struct Tile {
+        sf::Texture texture;
+        unsigned long long lastUsed = 0;
+    };
+
+    struct DrawItem {
+        const sf::Texture* texture;
+        sf::Vertex quad[4];
+    };
+
+    std::thread worker;
+    std::atomic<int> state{ Empty };
+    std::atomic<bool> cancelled{ false };
+    std::string filename;
+    std::vector<sf::Image> levels; // Written by the worker until Decoded, then owned by the UI thread
+
+    sf::FloatRect fitArea;  // Where a newly loaded image is fitted
+    sf::Vector2f position;  // Scene position of the top left corner
+    float pixelSize = 1.f;  // Scene units per pixel of the full-size image
+
+    std::map<std::uint64_t, Tile> tiles;
+    std::vector<DrawItem> drawList;
+    unsigned long long frame = 0;
+    bool pendingTiles = false;
+
+    static std::uint64_t key(unsigned level, unsigned tx, unsigned ty) {
+        return (static_cast<std::uint64_t>(level) << 56) | (static_cast<std::uint64_t>(tx) << 28) | ty;
+    }
+
+    // Half-size copy of `source`; odd edges average what they have.
+    // Colours are weighted by alpha, so transparent pixels leave no fringe
+    static void halve(const sf::Image& source, sf::Image& out) {
+        sf::Vector2u size = source.getSize();
+        unsigned width = (size.x + 1) / 2;
+        unsigned height = (size.y + 1) / 2;
+        std::vector<sf::Uint8> pixels(static_cast<std::size_t>(width) * height * 4);
+        const sf::Uint8* in = source.getPixelsPtr();
+        for (unsigned y = 0; y < height; ++y) {
+            for (unsigned x = 0; x < width; ++x) {
+                unsigned sum[4] = {};
+                unsigned count = 0;
+                for (unsigned sy = y * 2; sy < y * 2 + 2 && sy < size.y; ++sy) {
+                    for (unsigned sx = x * 2; sx < x * 2 + 2 && sx < size.x; ++sx) {
+                        const sf::Uint8* p = in + (static_cast<std::size_t>(sy) * size.x + sx) * 4;
+                        sum[0] += p[0] * p[3];
+                        sum[1] += p[1] * p[3];
+                        sum[2] += p[2] * p[3];
+                        sum[3] += p[3];
+                        ++count;
+                    }
+                }
+                sf::Uint8* p = &pixels[(static_cast<std::size_t>(y) * width + x) * 4];
+                for (int c = 0; c < 3; ++c) {
+                    p[c] = static_cast<sf::Uint8>(sum[3] > 0 ? (sum[c] + sum[3] / 2) / sum[3] : 0);
+                }
+                p[3] = static_cast<sf::Uint8>((sum[3] + count / 2) / count);
+            }
+        }
+        out.create(width, height, pixels.data());
+    }
+
+    void decode() {
+        std::vector<sf::Image> pyramid(1);
+        if (!pyramid[0].loadFromFile(filename) || pyramid[0].getSize().x == 0 || pyramid[0].getSize().y == 0) {
+            state = Failed;
+            return;
+        }
+        while (!cancelled && (pyramid.back().getSize().x > TileSize || pyramid.back().getSize().y > TileSize)) {
+            sf::Image smaller;
+            halve(pyramid.back(), smaller);
+            pyramid.push_back(std::move(smaller));
+        }
+        levels = std::move(pyramid);
+        state = cancelled ? Failed : Decoded;
+    }
+
+    void stopWorker() {
+        if (worker.joinable()) {
+            cancelled = true;
+            worker.join();
+        }
+        cancelled = false;
+    }
+
+    std::size_t tilesAcross(unsigned level) const {
+        return (levels[level].getSize().x + TileSize - 1) / TileSize;
+    }
+
+    std::size_t tilesDown(unsigned level) const {
+        return (levels[level].getSize().y + TileSize - 1) / TileSize;
+    }
+
+    // Uploads a tile of the pyramid; returns null if the texture could not be created
+    Tile* upload(unsigned level, unsigned tx, unsigned ty) {
+        const sf::Image& image = levels[level];
+        unsigned left = tx * TileSize;
+        unsigned top = ty * TileSize;
+        unsigned width = image.getSize().x - left;
+        unsigned height = image.getSize().y - top;
+        sf::IntRect area(static_cast<int>(left), static_cast<int>(top),
+                         static_cast<int>(width < TileSize ? width : TileSize),
+                         static_cast<int>(height < TileSize ? height : TileSize));
+        Tile& tile = tiles[key(level, tx, ty)];
+        if (!tile.texture.loadFromImage(image, area)) {
+            tiles.erase(key(level, tx, ty));
+            return nullptr;
+        }
+        tile.texture.generateMipmap();
+        tile.texture.setSmooth(true);
+        return &tile;
+    }
+
+    Tile* find(unsigned level, unsigned tx, unsigned ty) {
+        auto it = tiles.find(key(level, tx, ty));
+        return it != tiles.end() ? &it->second : nullptr;
+    }
+
+    // Queues the part of tile (tx, ty) of `level` drawn from `source`, a
+    // resident tile of `sourceLevel` at or above it that covers the same area
+    void addDrawItem(unsigned level, unsigned tx, unsigned ty, const Tile& source, unsigned sourceLevel) {
+        const sf::Image& image = levels[level];
+        float levelPixel = pixelSize * static_cast<float>(1u << level);
+        float x0 = static_cast<float>(tx * TileSize);
+        float y0 = static_cast<float>(ty * TileSize);
+        float x1 = static_cast<float>(std::min((tx + 1) * TileSize, image.getSize().x));
+        float y1 = static_cast<float>(std::min((ty + 1) * TileSize, image.getSize().y));
+
+        // Texture coordinates of those level pixels within the source tile
+        unsigned shift = sourceLevel - level;
+        float ratio = 1.f / static_cast<float>(1u << shift);
+        float originX = static_cast<float>((tx >> shift) * TileSize) / ratio;
+        float originY = static_cast<float>((ty >> shift) * TileSize) / ratio;
+
+        DrawItem item;
+        item.texture = &source.texture;
+        const float corners[4][2] = { { x0, y0 }, { x1, y0 }, { x0, y1 }, { x1, y1 } };
+        for (int i = 0; i < 4; ++i) {
+            sf::Vector2f scene = position + sf::Vector2f(corners[i][0], corners[i][1]) * levelPixel;
+            sf::Vector2f texel((corners[i][0] - originX) * ratio, (corners[i][1] - originY) * ratio);
+            item.quad[i] = sf::Vertex(scene, texel);
+        }
+        drawList.push_back(item);
+    }
+
+public:
+    ReferenceImage() = default;
+    ReferenceImage(const ReferenceImage&) = delete;
+    ReferenceImage& operator=(const ReferenceImage&) = delete;
+
+    ~ReferenceImage() {
+        stopWorker();
+    }
+
+    // Starts decoding `file` in the background, replacing any current
+    // image. It will be fitted into the scene area `area`
+    void load(const std::string& file, const sf::FloatRect& area) {
+        clear();
+        filename = file;
+        fitArea = area;
+        state = Loading;
+        worker = std::thread(&ReferenceImage::decode, this);
+    }
+
+    void clear() {
+        stopWorker();
+        state = Empty;
+        levels.clear();
+        tiles.clear();
+        drawList.clear();
+        pendingTiles = false;
+    }
+
+    bool isEmpty() const { return state == Empty; }
+    bool isLoading() const { return state == Loading || state == Decoded; }
+
+    // True while the image still needs frames to load or sharpen
+    bool isBusy() const { return state == Loading || state == Decoded || pendingTiles; }
+
+    // Returns true once, after a load failed
+    bool takeFailure() {
+        if (state != Failed) {
+            return false;
+        }
+        stopWorker();
+        state = Empty;
+        return true;
+    }
+
+    sf::Vector2u getSize() const {
+        return levels.empty() ? sf::Vector2u() : levels[0].getSize();
+    }
+
+    // Streams in the tiles `view` needs, at most UploadsPerFrame of them,
+    // for `pixelsPerUnit` window pixels per scene unit. Returns true if what
+    // draw() shows changed
+    bool update(const sf::View& view, float pixelsPerUnit) {
+        if (state == Decoded) {
+            worker.join();
+            sf::Vector2u size = levels[0].getSize();
+            pixelSize = std::min(fitArea.width / size.x, fitArea.height / size.y);
+            position = sf::Vector2f(fitArea.left + (fitArea.width - size.x * pixelSize) / 2,
+                                    fitArea.top + (fitArea.height - size.y * pixelSize) / 2);
+            state = Ready;
+
+            // The coarsest level is always resident, as the fallback for everything else
+            if (!upload(static_cast<unsigned>(levels.size() - 1), 0, 0)) {
+                clear();
+                state = Failed;
+                return false;
+            }
+        }
+        if (state != Ready) {
+            return false;
+        }
+        ++frame;
+
+        // Coarsest level whose pixels are still no larger than the screen's
+        unsigned top = static_cast<unsigned>(levels.size() - 1);
+        float screenPixelsPerImagePixel = pixelSize * pixelsPerUnit;
+        int wanted = static_cast<int>(std::floor(-std::log2(screenPixelsPerImagePixel)));
+        unsigned level = wanted < 0 ? 0 : static_cast<unsigned>(wanted) > top ? top : static_cast<unsigned>(wanted);
+
+        // Tiles of that level overlapping the view
+        float levelTile = pixelSize * static_cast<float>(1u << level) * TileSize;
+        sf::FloatRect area(view.getCenter() - view.getSize() / 2.f, view.getSize());
+        int tx0 = std::max(0, static_cast<int>(std::floor((area.left - position.x) / levelTile)));
+        int ty0 = std::max(0, static_cast<int>(std::floor((area.top - position.y) / levelTile)));
+        int tx1 = std::min(static_cast<int>(tilesAcross(level)), static_cast<int>(std::ceil((area.left + area.width - position.x) / levelTile)));
+        int ty1 = std::min(static_cast<int>(tilesDown(level)), static_cast<int>(std::ceil((area.top + area.height - position.y) / levelTile)));
+
+        bool changed = false;
+        unsigned uploads = 0;
+        pendingTiles = false;
+        drawList.clear();
+        for (int ty = ty0; ty < ty1; ++ty) {
+            for (int tx = tx0; tx < tx1; ++tx) {
+                unsigned x = static_cast<unsigned>(tx), y = static_cast<unsigned>(ty);
+                Tile* tile = find(level, x, y);
+                if (!tile && uploads < UploadsPerFrame) {
+                    tile = upload(level, x, y);
+                    ++uploads;
+                    changed = true;
+                }
+                unsigned source = level;
+                while (!tile) {
+                    pendingTiles = true;
+                    ++source;
+                    tile = find(source, x >> (source - level), y >> (source - level));
+                }
+                tile->lastUsed = frame;
+                addDrawItem(level, x, y, *tile, source);
+            }
+        }
+
+        // Release the tiles shown longest ago; the ones drawn this frame stay
+        std::uint64_t topKey = key(top, 0, 0);
+        while (tiles.size() > MaxResidentTiles) {
+            auto oldest = tiles.end();
+            for (auto it = tiles.begin(); it != tiles.end(); ++it) {
+                if (it->first != topKey && it->second.lastUsed < frame
+                    && (oldest == tiles.end() || it->second.lastUsed < oldest->second.lastUsed)) {
+                    oldest = it;
+                }
+            }
+            if (oldest == tiles.end()) {
+                break;
+            }
+            tiles.erase(oldest);
+        }
+        return changed;
+    }
+
+    // Draws the image through the target's current view, as of the last update()
+    void draw(sf::RenderTarget& target) const {
+        for (const DrawItem& item : drawList) {
+            sf::RenderStates states;
+            states.texture = item.texture;
+            target.draw(item.quad, 4, sf::TriangleStrip, states);
+            RenderStats::count(4);
+        }
+    }
+};
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+#include <cstddef>
+#include <vector>
+
+#include "StrokeTessellator.h"
+
+// Rendering counters for the current frame, shown by the profiling overlay.
+// Code that issues draw calls adds to them; the main loop resets them
+struct RenderStats {
+    std::size_t drawCalls = 0;
+    std::size_t vertices = 0;
+
+    // Per thread, so exports rendering on a worker do not disturb the
+    // counts of the UI thread's frame
+    static RenderStats& frame() {
+        static thread_local RenderStats stats;
+        return stats;
+    }
+
+    static void count(std::size_t vertexCount, std::size_t calls = 1) {
+        frame().drawCalls += calls;
+        frame().vertices += vertexCount;
+    }
+};
+
+// Collects the geometry of many shapes into shared vertex storage so a
+// whole scene is drawn with one call per primitive type instead of one
+// call per shape
+class RenderBatch {
+private:
+    std::vector<sf::Vertex> lineVertices;
+    std::vector<sf::Vertex> triangleVertices;
+    sf::VertexBuffer lineBuffer;
+    sf::VertexBuffer triangleBuffer;
+    bool useBuffers = false;
+    bool uploaded = false;
+
+public:
+    RenderBatch()
+        : lineBuffer(sf::Lines, sf::VertexBuffer::Static),
+        triangleBuffer(sf::Triangles, sf::VertexBuffer::Static) {
+    }
+
+    void clear() {
+        lineVertices.clear();
+        triangleVertices.clear();
+        uploaded = false;
+    }
+
+    // A one pixel, aliased line, e.g. for overlays. Shapes use addPolyline()
+    void addLine(const sf::Vector2f& start, const sf::Vector2f& end, const sf::Color& color) {
+        lineVertices.emplace_back(start, color);
+        lineVertices.emplace_back(end, color);
+        uploaded = false;
+    }
+
+    // Appends all the geometry collected by another batch
+    void append(const RenderBatch& other) {
+        lineVertices.insert(lineVertices.end(), other.lineVertices.begin(), other.lineVertices.end());
+        triangleVertices.insert(triangleVertices.end(), other.triangleVertices.begin(), other.triangleVertices.end());
+        uploaded = false;
+    }
+
+    // Appends an anti-aliased polyline `width` scene units wide, for pixels
+    // `pixelSize` scene units across
+    void addPolyline(const sf::Vector2f* points, std::size_t count, float width, const sf::Color& color, float pixelSize,
+                     StrokeTessellator::Join join = StrokeTessellator::Join::Round,
+                     StrokeTessellator::Cap cap = StrokeTessellator::Cap::Round) {
+        StrokeTessellator::polyline(triangleVertices, points, count, width, color, pixelSize, join, cap);
+        uploaded = false;
+    }
+
+    // Appends the anti-aliased outline of a closed polygon. The outline grows
+    // outwards by `thickness`, matching sf::Shape::setOutlineThickness
+    void addOutline(const sf::Vector2f* points, std::size_t count, float thickness, const sf::Color& color,
+                    float pixelSize = 1.f) {
+        StrokeTessellator::outline(triangleVertices, points, count, thickness, color, pixelSize);
+        uploaded = false;
+    }
+
+    // Copies the collected vertices to the GPU, if vertex buffers are supported.
+    // Batches that are never uploaded are drawn straight from client memory,
+    // which is cheaper for small, short-lived batches
+    void upload() {
+        useBuffers = sf::VertexBuffer::isAvailable();
+        if (useBuffers) {
+            lineBuffer.create(lineVertices.size());
+            triangleBuffer.create(triangleVertices.size());
+            if (!lineVertices.empty()) {
+                lineBuffer.update(lineVertices.data());
+            }
+            if (!triangleVertices.empty()) {
+                triangleBuffer.update(triangleVertices.data());
+            }
+        }
+        uploaded = true;
+    }
+
+    void draw(sf::RenderTarget& target, const sf::RenderStates& states = sf::RenderStates::Default) const {
+        bool fromBuffers = uploaded && useBuffers;
+        RenderStats::count(getVertexCount(), (triangleVertices.empty() ? 0 : 1) + (lineVertices.empty() ? 0 : 1));
+
+        if (!triangleVertices.empty()) {
+            if (fromBuffers) target.draw(triangleBuffer, states);
+            else target.draw(triangleVertices.data(), triangleVertices.size(), sf::Triangles, states);
+        }
+        if (!lineVertices.empty()) {
+            if (fromBuffers) target.draw(lineBuffer, states);
+            else target.draw(lineVertices.data(), lineVertices.size(), sf::Lines, states);
+        }
+    }
+
+    std::size_t getVertexCount() const {
+        return lineVertices.size() + triangleVertices.size();
+    }
+};
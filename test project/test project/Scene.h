@@ -0,0 +1,134 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "DocumentFile.h"
+#include "ShapeStore.h"
+#include "SpatialGrid.h"
+#include "SvgWriter.h"
+#include "TiledExporter.h"
+
+// A drawing built from code rather than the mouse, e.g. by a diagram
+// generator or a script. Shapes are added in batches: reserve() the batch
+// up front, add the shapes, then commit() registers all of them in the
+// spatial index at once. Nothing is indexed or tessellated per shape, so
+// batches of millions of shapes cost a few passes over flat arrays.
+// Exports commit any pending shapes first and need no window
+class Scene {
+private:
+    ShapeStore shapes;
+    SpatialGrid index;
+    std::size_t indexed = 0; // Shapes below this are in the index
+
+public:
+    // Makes room for `count` more shapes holding `pointCount` more stroke points
+    void reserve(std::size_t count, std::size_t pointCount = 0) {
+        shapes.reserve(shapes.size() + count, shapes.totalPointCount() + pointCount);
+        index.reserve(shapes.size() + count);
+    }
+
+    // Each add returns the index of the new shape. `width` is the stroke
+    // width of lines and strokes and the outline thickness of the others
+    std::size_t addLine(const sf::Vector2f& start, const sf::Vector2f& end, const sf::Color& color,
+                        float width = ShapeStore::DefaultLineWidth) {
+        shapes.addLine(start, end, color, width);
+        return shapes.size() - 1;
+    }
+
+    std::size_t addRectangle(const sf::Vector2f& position, const sf::Vector2f& size, const sf::Color& color,
+                             float width = ShapeStore::OutlineThickness) {
+        shapes.addRectangle(position, size, color, width);
+        return shapes.size() - 1;
+    }
+
+    std::size_t addCircle(const sf::Vector2f& center, float radius, const sf::Color& color,
+                          float width = ShapeStore::OutlineThickness) {
+        shapes.addCircle(center - sf::Vector2f(radius, radius), radius, color, width);
+        return shapes.size() - 1;
+    }
+
+    std::size_t addStroke(const sf::Vector2f* points, std::size_t count, const sf::Color& color,
+                          float width = ShapeStore::DefaultLineWidth) {
+        shapes.addStroke(points, count, color, width);
+        return shapes.size() - 1;
+    }
+
+    // Appends `count` shapes given as columns, laid out as ShapeStore holds them
+    void append(std::size_t count, const ShapeKind* kinds, const sf::Vector2f* starts, const sf::Vector2f* extents,
+                const sf::Color* colors, const std::uint32_t* pointCounts = nullptr, const sf::Vector2f* points = nullptr,
+                const float* widths = nullptr) {
+        shapes.append(count, kinds, starts, extents, colors, pointCounts, points, widths);
+    }
+
+    // Appends every shape of a .2dv document. Returns false if it could not
+    // be read completely; the shapes read before the error are kept
+    bool load(const std::string& filename) {
+        DocumentReader reader;
+        if (!reader.open(filename)) {
+            return false;
+        }
+        while (reader.readChunk(shapes)) {
+        }
+        return !reader.failed();
+    }
+
+    // Registers the shapes added since the last commit in the spatial
+    // index. Returns how many there were
+    std::size_t commit() {
+        std::size_t added = shapes.size() - indexed;
+        index.reserve(shapes.size());
+        for (; indexed < shapes.size(); ++indexed) {
+            index.insert(static_cast<SpatialGrid::Index>(indexed), shapes.bounds(indexed));
+        }
+        return added;
+    }
+
+    void clear() {
+        shapes.clear();
+        index.clear();
+        indexed = 0;
+    }
+
+    std::size_t size() const { return shapes.size(); }
+    const ShapeStore& getShapes() const { return shapes; }
+
+    // Only covers the committed shapes
+    const SpatialGrid& getIndex() const { return index; }
+
+    // Smallest area containing every shape, outlines included
+    sf::FloatRect getBounds() const {
+        if (shapes.empty()) {
+            return sf::FloatRect();
+        }
+        sf::FloatRect first = shapes.bounds(0);
+        float left = first.left, top = first.top;
+        float right = first.left + first.width, bottom = first.top + first.height;
+        for (std::size_t i = 1; i < shapes.size(); ++i) {
+            sf::FloatRect b = shapes.bounds(i);
+            left = std::min(left, b.left);
+            top = std::min(top, b.top);
+            right = std::max(right, b.left + b.width);
+            bottom = std::max(bottom, b.top + b.height);
+        }
+        return sf::FloatRect(left, top, right - left, bottom - top);
+    }
+
+    bool save(const std::string& filename) const {
+        return DocumentWriter::save(shapes, filename);
+    }
+
+    // Renders `area` at `scale` pixels per scene unit into a PNG of any size
+    bool exportPng(const std::string& filename, const sf::FloatRect& area, float scale = 1.f,
+                   const Antialiasing& quality = Antialiasing::exportDefault()) {
+        commit();
+        return TiledExporter::save(shapes, index, area, scale, filename, quality);
+    }
+
+    bool exportSvg(const std::string& filename, const sf::Vector2u& size) const {
+        return SvgWriter::save(shapes, size, filename);
+    }
+};
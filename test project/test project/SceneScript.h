@@ -0,0 +1,147 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+#include <istream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "Scene.h"
+
+// Builds a Scene from a plain-text script, one command per line:
+//
+//   color r g b [a]          colour of the shapes that follow (0-255, default white)
+//   width w                  width of the shapes that follow; "width default" restores
+//                            1 for lines and strokes, 2 for rectangle and circle outlines
+//   line x0 y0 x1 y1
+//   rect x y width height
+//   circle cx cy radius
+//   stroke x0 y0 x1 y1 ...   freehand stroke through two or more points
+//   reserve shapes [points]  room for the shapes that follow, at most 16777216
+//                            shapes and 67108864 points at a time
+//   load file.2dv            appends a vector document
+//
+// Blank lines and lines starting with '#' are ignored. The whole script is
+// one batch: the scene's index is updated once, after the last line
+class SceneScript {
+public:
+    // Runs the script; on error, stops and describes the failing line in `error`
+    static bool run(std::istream& script, Scene& scene, std::string& error) {
+        sf::Color color = sf::Color::White;
+        float width = -1.f; // Negative for each kind's default
+        std::vector<sf::Vector2f> points;
+        std::string line;
+        for (unsigned number = 1; std::getline(script, line); ++number) {
+            std::istringstream words(line);
+            std::string command;
+            if (!(words >> command) || command[0] == '#') {
+                continue;
+            }
+
+            bool ok;
+            if (command == "color") {
+                int r, g, b, a = 255;
+                ok = static_cast<bool>(words >> r >> g >> b);
+                if (ok && !(words >> a)) {
+                    words.clear(); // Alpha is optional
+                }
+                ok = ok && inByteRange(r) && inByteRange(g) && inByteRange(b) && inByteRange(a);
+                color = sf::Color(static_cast<sf::Uint8>(r), static_cast<sf::Uint8>(g),
+                                  static_cast<sf::Uint8>(b), static_cast<sf::Uint8>(a));
+            }
+            else if (command == "width") {
+                std::string value;
+                ok = static_cast<bool>(words >> value);
+                if (ok && value == "default") {
+                    width = -1.f;
+                }
+                else if (ok) {
+                    std::istringstream number(value);
+                    ok = number >> width && number.eof() && width >= 0 && width <= MaxWidth;
+                }
+            }
+            else if (command == "line") {
+                float x0, y0, x1, y1;
+                ok = static_cast<bool>(words >> x0 >> y0 >> x1 >> y1);
+                if (ok) {
+                    scene.addLine(sf::Vector2f(x0, y0), sf::Vector2f(x1, y1), color, widthOf(width, ShapeKind::Line));
+                }
+            }
+            else if (command == "rect") {
+                float x, y, w, h;
+                ok = static_cast<bool>(words >> x >> y >> w >> h);
+                if (ok) {
+                    scene.addRectangle(sf::Vector2f(x, y), sf::Vector2f(w, h), color, widthOf(width, ShapeKind::Rectangle));
+                }
+            }
+            else if (command == "circle") {
+                float x, y, radius;
+                ok = words >> x >> y >> radius && radius >= 0;
+                if (ok) {
+                    scene.addCircle(sf::Vector2f(x, y), radius, color, widthOf(width, ShapeKind::Circle));
+                }
+            }
+            else if (command == "stroke") {
+                points.clear();
+                float x, y;
+                bool paired = true; // A trailing x without its y is an error, not the end
+                while (words >> x) {
+                    paired = static_cast<bool>(words >> y);
+                    if (!paired) {
+                        break;
+                    }
+                    points.push_back(sf::Vector2f(x, y));
+                }
+                ok = paired && points.size() >= 2 && words.eof();
+                if (ok) {
+                    scene.addStroke(points.data(), points.size(), color, widthOf(width, ShapeKind::Stroke));
+                }
+            }
+            else if (command == "reserve") {
+                // Read signed, so that a negative count is rejected rather than wrapped
+                long long shapes, pointCount = 0;
+                ok = static_cast<bool>(words >> shapes);
+                if (ok && !(words >> pointCount)) {
+                    words.clear();
+                }
+                ok = ok && shapes >= 0 && shapes <= MaxReserveShapes && pointCount >= 0 && pointCount <= MaxReservePoints;
+                if (ok) {
+                    scene.reserve(static_cast<std::size_t>(shapes), static_cast<std::size_t>(pointCount));
+                }
+            }
+            else if (command == "load") {
+                std::string filename;
+                ok = static_cast<bool>(words >> filename);
+                if (ok && !scene.load(filename)) {
+                    error = "line " + std::to_string(number) + ": failed to read " + filename;
+                    return false;
+                }
+            }
+            else {
+                error = "line " + std::to_string(number) + ": unknown command '" + command + "'";
+                return false;
+            }
+
+            std::string extra;
+            if (!ok || words >> extra) {
+                error = "line " + std::to_string(number) + ": bad arguments to '" + command + "'";
+                return false;
+            }
+        }
+        scene.commit();
+        return true;
+    }
+
+private:
+    static constexpr float MaxWidth = 1e6f;
+    static const long long MaxReserveShapes = 1 << 24;
+    static const long long MaxReservePoints = 1 << 26;
+
+    static float widthOf(float width, ShapeKind kind) {
+        return width < 0 ? ShapeStore::defaultWidth(kind) : width;
+    }
+
+    static bool inByteRange(int value) {
+        return value >= 0 && value <= 255;
+    }
+};
@@ -0,0 +1,202 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <vector>
+
+#include "RenderBatch.h"
+#include "ShapeStore.h"
+#include "SpatialGrid.h"
+
+// The shapes selected in one layer, and the move, scale or rotation being
+// dragged on them. When a drag begins the selected shapes are lifted out of
+// the spatial index, so the layer's canvas is repainted once without them
+// and they are drawn as an overlay instead. Each mouse move then rewrites
+// only their rows of the store and their overlay geometry; the index and
+// the canvas are updated once, when the shapes are dropped
+class Selection {
+public:
+    enum class Mode { Move, Scale, Rotate };
+
+private:
+    static constexpr float MinScale = 0.01f;
+
+    std::vector<SpatialGrid::Index> indices; // Sorted, so the overlay keeps the drawing order
+    ShapeStore originals; // The selected shapes as they were when the drag began
+    ShapeTransform transform;
+    Mode mode = Mode::Move;
+    sf::Vector2f grab; // Where the drag began
+    bool dragging = false;
+
+    static sf::FloatRect unite(const sf::FloatRect& a, const sf::FloatRect& b) {
+        float right = std::max(a.left + a.width, b.left + b.width);
+        float bottom = std::max(a.top + a.height, b.top + b.height);
+        float left = std::min(a.left, b.left);
+        float top = std::min(a.top, b.top);
+        return sf::FloatRect(left, top, right - left, bottom - top);
+    }
+
+public:
+    bool empty() const { return indices.empty(); }
+    std::size_t size() const { return indices.size(); }
+    const std::vector<SpatialGrid::Index>& getIndices() const { return indices; }
+    bool isDragging() const { return dragging; }
+
+    // The previous versions of the shapes being dragged, in selection order
+    const ShapeStore& getOriginals() const { return originals; }
+
+    bool contains(std::size_t index) const {
+        return std::binary_search(indices.begin(), indices.end(), static_cast<SpatialGrid::Index>(index));
+    }
+
+    void clear() {
+        indices.clear();
+    }
+
+    // Selects only shape `index`
+    void set(std::size_t index) {
+        indices.assign(1, static_cast<SpatialGrid::Index>(index));
+    }
+
+    // Adds shape `index` to the selection, or removes it if it was selected
+    void toggle(std::size_t index) {
+        SpatialGrid::Index value = static_cast<SpatialGrid::Index>(index);
+        auto it = std::lower_bound(indices.begin(), indices.end(), value);
+        if (it != indices.end() && *it == value) {
+            indices.erase(it);
+        }
+        else {
+            indices.insert(it, value);
+        }
+    }
+
+    // Selects the shapes lying entirely inside `area`; with `add`, keeps the
+    // current selection as well
+    void selectArea(const ShapeStore& shapes, const SpatialGrid& index, const sf::FloatRect& area, bool add) {
+        std::vector<SpatialGrid::Index> found;
+        index.query(area, found);
+        found.erase(std::remove_if(found.begin(), found.end(), [&](SpatialGrid::Index i) {
+            sf::FloatRect b = shapes.bounds(i);
+            return b.left < area.left || b.top < area.top
+                || b.left + b.width > area.left + area.width || b.top + b.height > area.top + area.height;
+        }), found.end());
+        if (!add) {
+            indices.swap(found);
+            return;
+        }
+        std::vector<SpatialGrid::Index> merged;
+        merged.reserve(indices.size() + found.size());
+        std::set_union(indices.begin(), indices.end(), found.begin(), found.end(), std::back_inserter(merged));
+        indices.swap(merged);
+    }
+
+    // Drops the selected shapes at `first` and above, e.g. after an undo removed them
+    void dropFrom(std::size_t first) {
+        indices.erase(std::lower_bound(indices.begin(), indices.end(), static_cast<SpatialGrid::Index>(first)),
+                      indices.end());
+    }
+
+    // Smallest area containing every selected shape
+    sf::FloatRect bounds(const ShapeStore& shapes) const {
+        if (indices.empty()) {
+            return sf::FloatRect();
+        }
+        sf::FloatRect result = shapes.bounds(indices[0]);
+        for (std::size_t i = 1; i < indices.size(); ++i) {
+            result = unite(result, shapes.bounds(indices[i]));
+        }
+        return result;
+    }
+
+    // Starts dragging the selection from `point`, scaling and rotating
+    // about its centre. Removes the shapes from `index` and returns the
+    // area they covered, which the caller repaints without them
+    sf::FloatRect begin(const ShapeStore& shapes, SpatialGrid& index, Mode dragMode, const sf::Vector2f& point) {
+        sf::FloatRect area = bounds(shapes);
+        originals.clear();
+        std::size_t pointCount = 0;
+        for (SpatialGrid::Index i : indices) {
+            pointCount += shapes.pointCount(i);
+        }
+        originals.reserve(indices.size(), pointCount);
+        for (SpatialGrid::Index i : indices) {
+            originals.append(shapes, i, 1);
+            index.remove(i);
+        }
+        transform = ShapeTransform();
+        transform.pivot = sf::Vector2f(area.left + area.width / 2, area.top + area.height / 2);
+        mode = dragMode;
+        grab = point;
+        dragging = true;
+        return area;
+    }
+
+    // Applies the drag to `point` to the selected rows of `shapes`
+    void drag(ShapeStore& shapes, const sf::Vector2f& point) {
+        sf::Vector2f from = grab - transform.pivot;
+        sf::Vector2f to = point - transform.pivot;
+        switch (mode) {
+        case Mode::Move:
+            transform.offset = point - grab;
+            break;
+        case Mode::Scale: {
+            float grabDistance = std::sqrt(from.x * from.x + from.y * from.y);
+            float distance = std::sqrt(to.x * to.x + to.y * to.y);
+            transform.scale = grabDistance > 0.f ? distance / grabDistance : 1.f;
+            if (transform.scale < MinScale) {
+                transform.scale = MinScale;
+            }
+            break;
+        }
+        case Mode::Rotate:
+            transform.angle = std::atan2(to.y, to.x) - std::atan2(from.y, from.x);
+            break;
+        }
+        for (std::size_t i = 0; i < indices.size(); ++i) {
+            shapes.transform(indices[i], originals, i, transform);
+        }
+    }
+
+    // Puts the shapes back where the drag began
+    void cancel(ShapeStore& shapes) {
+        transform = ShapeTransform();
+        for (std::size_t i = 0; i < indices.size(); ++i) {
+            shapes.transform(indices[i], originals, i, transform);
+        }
+    }
+
+    // Ends the drag, registering the shapes in `index` at their new bounds,
+    // and returns the area they now cover. Returns whether they changed in
+    // `moved`; if so, getOriginals() still holds their previous versions
+    sf::FloatRect end(const ShapeStore& shapes, SpatialGrid& index, bool& moved) {
+        for (SpatialGrid::Index i : indices) {
+            index.insert(i, shapes.bounds(i));
+        }
+        dragging = false;
+        moved = !transform.isIdentity();
+        return bounds(shapes);
+    }
+
+    // Geometry of the shapes being dragged, in drawing order
+    void appendTo(const ShapeStore& shapes, RenderBatch& batch, float pixelsPerUnit) const {
+        for (SpatialGrid::Index i : indices) {
+            shapes.appendTo(i, batch, pixelsPerUnit);
+        }
+    }
+
+    // A box around each selected shape, so thousands are highlighted in one draw call
+    void appendOutlines(const ShapeStore& shapes, RenderBatch& batch, const sf::Color& color) const {
+        for (SpatialGrid::Index i : indices) {
+            sf::FloatRect b = shapes.bounds(i);
+            sf::Vector2f corners[4] = { { b.left, b.top }, { b.left + b.width, b.top },
+                                        { b.left + b.width, b.top + b.height }, { b.left, b.top + b.height } };
+            for (int k = 0; k < 4; ++k) {
+                batch.addLine(corners[k], corners[(k + 1) % 4], color);
+            }
+        }
+    }
+};
@@ -0,0 +1,441 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "RenderBatch.h"
+#include "StyleTable.h"
+
+enum class ShapeKind : std::uint8_t { Line, Rectangle, Circle, Stroke };
+
+// Scales by `scale` and rotates by `angle` radians about `pivot`, then
+// moves by `offset`. This is every edit the selection tools make
+struct ShapeTransform {
+    sf::Vector2f pivot;
+    sf::Vector2f offset;
+    float scale = 1.f;
+    float angle = 0.f;
+
+    bool isIdentity() const {
+        return offset.x == 0.f && offset.y == 0.f && scale == 1.f && angle == 0.f;
+    }
+
+    sf::Vector2f map(const sf::Vector2f& point) const {
+        float c = std::cos(angle) * scale;
+        float s = std::sin(angle) * scale;
+        sf::Vector2f d = point - pivot;
+        return pivot + offset + sf::Vector2f(d.x * c - d.y * s, d.x * s + d.y * c);
+    }
+
+    // Whole quarter turns nearest to the rotation, 0 to 3
+    int quarterTurns() const {
+        int turns = static_cast<int>(std::lround(angle / (3.141592654f / 2))) % 4;
+        return turns < 0 ? turns + 4 : turns;
+    }
+};
+
+// Structure-of-arrays storage for every shape in a drawing. Each shape is a
+// row across the parallel arrays below, so iterating one attribute only
+// touches the memory of that attribute. Every shape has a colour and a
+// width, the stroke width of lines and strokes and the outline thickness of
+// rectangles and circles, stored together as an index into a palette of
+// styles (StyleTable.h). Freehand strokes keep their points
+// in one shared, append-only pool, each shape owning the slice between its
+// own offset and the next shape's
+class ShapeStore {
+public:
+    static constexpr float OutlineThickness = 2.f; // Default width of rectangles and circles
+    static constexpr float DefaultLineWidth = 1.f; // Default width of lines and strokes
+    static constexpr std::size_t MinCirclePoints = 8;
+    static constexpr std::size_t CircleLodCount = 8; // Buckets of 8, 16, ... 1024 points
+    static constexpr float MaxCircleError = 0.25f;   // Largest gap between a circle and its polygon, in pixels
+
+private:
+    // Unit circle directions for every LOD bucket, computed once so
+    // tessellating a circle needs no trigonometry
+    struct CircleTables {
+        std::vector<sf::Vector2f> buckets[CircleLodCount];
+
+        CircleTables() {
+            for (std::size_t lod = 0; lod < CircleLodCount; ++lod) {
+                std::size_t count = MinCirclePoints << lod;
+                buckets[lod].resize(count);
+                for (std::size_t i = 0; i < count; ++i) {
+                    // Same point layout as sf::CircleShape: first point at the top
+                    float angle = i * 2 * 3.141592654f / count - 3.141592654f / 2;
+                    buckets[lod][i] = sf::Vector2f(std::cos(angle), std::sin(angle));
+                }
+            }
+        }
+    };
+
+    std::vector<ShapeKind> kinds;
+    std::vector<sf::Vector2f> starts;  // Line start, rectangle and circle position, stroke bounds minimum
+    std::vector<sf::Vector2f> extents; // Line end, rectangle size, circle radius in x, stroke bounds maximum
+    StyleTable styles;
+    std::vector<std::uint32_t> firstPoints; // Offset of each shape's points; only strokes have any
+    std::vector<sf::Vector2f> points;
+
+    void push(ShapeKind kind, const sf::Vector2f& start, const sf::Vector2f& extent, const sf::Color& color, float width) {
+        kinds.push_back(kind);
+        starts.push_back(start);
+        extents.push_back(extent);
+        styles.push(color, width);
+        firstPoints.push_back(static_cast<std::uint32_t>(points.size()));
+    }
+
+    // Offset of the points of shape `index`; size() gives the end of the pool
+    std::size_t pointOffset(std::size_t index) const {
+        return index < firstPoints.size() ? firstPoints[index] : points.size();
+    }
+
+public:
+    static float defaultWidth(ShapeKind kind) {
+        return kind == ShapeKind::Rectangle || kind == ShapeKind::Circle ? OutlineThickness : DefaultLineWidth;
+    }
+
+    // Unit circle directions of LOD bucket `lod`, first point at the top
+    static const std::vector<sf::Vector2f>& unitCircle(std::size_t lod) {
+        static const CircleTables tables;
+        return tables.buckets[lod];
+    }
+
+    // LOD bucket for a circle whose radius covers `projectedRadius` pixels:
+    // the fewest points that keep the polygon within MaxCircleError of it
+    static std::size_t circleLod(float projectedRadius) {
+        float needed = projectedRadius > MaxCircleError
+            ? 3.141592654f / std::acos(1.f - MaxCircleError / projectedRadius) : 0.f;
+        std::size_t lod = 0;
+        while (lod + 1 < CircleLodCount && static_cast<float>(MinCirclePoints << lod) < needed) {
+            ++lod;
+        }
+        return lod;
+    }
+
+    static float distanceToSegment(const sf::Vector2f& p, const sf::Vector2f& a, const sf::Vector2f& b) {
+        sf::Vector2f ab = b - a;
+        sf::Vector2f ap = p - a;
+        float lengthSquared = ab.x * ab.x + ab.y * ab.y;
+        float t = lengthSquared > 0.f ? (ap.x * ab.x + ap.y * ab.y) / lengthSquared : 0.f;
+        t = std::max(0.f, std::min(1.f, t));
+        sf::Vector2f d = p - (a + ab * t);
+        return std::sqrt(d.x * d.x + d.y * d.y);
+    }
+
+    std::size_t size() const { return kinds.size(); }
+    bool empty() const { return kinds.empty(); }
+    std::size_t capacity() const { return kinds.capacity(); }
+
+    // Makes room for `count` shapes holding `pointCount` stroke points in total
+    void reserve(std::size_t count, std::size_t pointCount = 0) {
+        kinds.reserve(count);
+        starts.reserve(count);
+        extents.reserve(count);
+        styles.reserve(count);
+        firstPoints.reserve(count);
+        points.reserve(pointCount);
+    }
+
+    void clear() {
+        kinds.clear();
+        starts.clear();
+        extents.clear();
+        styles.clear();
+        firstPoints.clear();
+        points.clear();
+    }
+
+    void addLine(const sf::Vector2f& start, const sf::Vector2f& end, const sf::Color& color,
+                 float width = DefaultLineWidth) {
+        push(ShapeKind::Line, start, end, color, width);
+    }
+
+    void addRectangle(const sf::Vector2f& position, const sf::Vector2f& size, const sf::Color& color,
+                      float width = OutlineThickness) {
+        push(ShapeKind::Rectangle, position, size, color, width);
+    }
+
+    void addCircle(const sf::Vector2f& position, float radius, const sf::Color& color, float width = OutlineThickness) {
+        push(ShapeKind::Circle, position, sf::Vector2f(radius, radius), color, width);
+    }
+
+    // Adds a polyline through `count` points, which are copied into the pool
+    void addStroke(const sf::Vector2f* strokePoints, std::size_t count, const sf::Color& color,
+                   float width = DefaultLineWidth) {
+        sf::Vector2f low = count > 0 ? strokePoints[0] : sf::Vector2f();
+        sf::Vector2f high = low;
+        for (std::size_t i = 1; i < count; ++i) {
+            low.x = std::min(low.x, strokePoints[i].x);
+            low.y = std::min(low.y, strokePoints[i].y);
+            high.x = std::max(high.x, strokePoints[i].x);
+            high.y = std::max(high.y, strokePoints[i].y);
+        }
+        push(ShapeKind::Stroke, low, high, color, width);
+        points.insert(points.end(), strokePoints, strokePoints + count);
+    }
+
+    // Appends `count` shapes given as parallel arrays, e.g. a chunk read from
+    // a file. `pointCounts` gives the number of points of each shape, which
+    // are read in order from `newPoints`; both may be null if there are none.
+    // Without `newWidths`, each shape gets the default width of its kind
+    void append(std::size_t count, const ShapeKind* newKinds, const sf::Vector2f* newStarts,
+                const sf::Vector2f* newExtents, const sf::Color* newColors,
+                const std::uint32_t* pointCounts = nullptr, const sf::Vector2f* newPoints = nullptr,
+                const float* newWidths = nullptr) {
+        kinds.insert(kinds.end(), newKinds, newKinds + count);
+        starts.insert(starts.end(), newStarts, newStarts + count);
+        extents.insert(extents.end(), newExtents, newExtents + count);
+        styles.reserve(styles.size() + count);
+        for (std::size_t i = 0; i < count; ++i) {
+            styles.push(newColors[i], newWidths ? newWidths[i] : defaultWidth(newKinds[i]));
+        }
+
+        std::size_t total = 0;
+        for (std::size_t i = 0; i < count; ++i) {
+            firstPoints.push_back(static_cast<std::uint32_t>(points.size() + total));
+            total += pointCounts ? pointCounts[i] : 0;
+        }
+        if (total > 0) {
+            points.insert(points.end(), newPoints, newPoints + total);
+        }
+    }
+
+    // Appends copies of shapes [first, first + count) of another store
+    void append(const ShapeStore& other, std::size_t first, std::size_t count) {
+        std::size_t pointBase = points.size();
+        std::size_t otherFirst = other.pointOffset(first);
+        std::size_t otherLast = other.pointOffset(first + count);
+        kinds.insert(kinds.end(), other.kinds.begin() + first, other.kinds.begin() + first + count);
+        starts.insert(starts.end(), other.starts.begin() + first, other.starts.begin() + first + count);
+        extents.insert(extents.end(), other.extents.begin() + first, other.extents.begin() + first + count);
+        styles.reserve(styles.size() + count);
+        for (std::size_t i = first; i < first + count; ++i) {
+            styles.push(other.styles[i].color, other.styles[i].width);
+        }
+        for (std::size_t i = first; i < first + count; ++i) {
+            firstPoints.push_back(static_cast<std::uint32_t>(pointBase + other.firstPoints[i] - otherFirst));
+        }
+        points.insert(points.end(), other.points.begin() + otherFirst, other.points.begin() + otherLast);
+    }
+
+    // Moves the last `count` shapes, in order, to the end of another store.
+    // Their points are the tail of the pool, so it shrinks with them
+    void moveTailTo(ShapeStore& other, std::size_t count) {
+        std::size_t first = size() - count;
+        other.append(*this, first, count);
+        truncate(first);
+    }
+
+    // Keeps the first `count` shapes
+    void truncate(std::size_t count) {
+        points.resize(pointOffset(count));
+        kinds.resize(count);
+        starts.resize(count);
+        extents.resize(count);
+        styles.truncate(count);
+        firstPoints.resize(count);
+    }
+
+    // Overwrites shape `index` with shape `sourceIndex` of `source` mapped
+    // through `transform`; `source` is typically a copy taken before the
+    // edit began, so dragging never accumulates rounding errors. Both shapes
+    // must be of the same kind with the same number of points. Rectangles
+    // stay axis-aligned: their centre follows the rotation, but their sides
+    // only turn in whole quarter turns
+    void transform(std::size_t index, const ShapeStore& source, std::size_t sourceIndex, const ShapeTransform& transform) {
+        const sf::Vector2f& a = source.starts[sourceIndex];
+        const sf::Vector2f& e = source.extents[sourceIndex];
+        styles.set(index, source.styles[sourceIndex].color, source.styles[sourceIndex].width * transform.scale);
+        switch (source.kinds[sourceIndex]) {
+        case ShapeKind::Line:
+            starts[index] = transform.map(a);
+            extents[index] = transform.map(e);
+            break;
+        case ShapeKind::Rectangle: {
+            sf::Vector2f size = (transform.quarterTurns() % 2 ? sf::Vector2f(e.y, e.x) : e) * transform.scale;
+            starts[index] = transform.map(a + e / 2.f) - size / 2.f;
+            extents[index] = size;
+            break;
+        }
+        case ShapeKind::Circle: {
+            float radius = e.x * transform.scale;
+            starts[index] = transform.map(a + sf::Vector2f(e.x, e.x)) - sf::Vector2f(radius, radius);
+            extents[index] = sf::Vector2f(radius, radius);
+            break;
+        }
+        case ShapeKind::Stroke: {
+            const sf::Vector2f* from = source.pointData(sourceIndex);
+            sf::Vector2f* to = points.data() + firstPoints[index];
+            std::size_t count = source.pointCount(sourceIndex);
+            sf::Vector2f low = count > 0 ? transform.map(from[0]) : sf::Vector2f();
+            sf::Vector2f high = low;
+            for (std::size_t i = 0; i < count; ++i) {
+                to[i] = transform.map(from[i]);
+                low.x = std::min(low.x, to[i].x);
+                low.y = std::min(low.y, to[i].y);
+                high.x = std::max(high.x, to[i].x);
+                high.y = std::max(high.y, to[i].y);
+            }
+            starts[index] = low;
+            extents[index] = high;
+            break;
+        }
+        }
+    }
+
+    // Exchanges shape `index` with shape `otherIndex` of another store, e.g.
+    // to undo an edit. Both must have the same number of points
+    void exchange(std::size_t index, ShapeStore& other, std::size_t otherIndex) {
+        std::swap(kinds[index], other.kinds[otherIndex]);
+        std::swap(starts[index], other.starts[otherIndex]);
+        std::swap(extents[index], other.extents[otherIndex]);
+        ShapeStyle mine = styles[index];
+        styles.set(index, other.styles[otherIndex].color, other.styles[otherIndex].width);
+        other.styles.set(otherIndex, mine.color, mine.width);
+        std::swap_ranges(points.begin() + firstPoints[index], points.begin() + pointOffset(index + 1),
+                         other.points.begin() + other.firstPoints[otherIndex]);
+    }
+
+    // Exchanges the contents of two stores without copying any shapes
+    void swap(ShapeStore& other) {
+        kinds.swap(other.kinds);
+        starts.swap(other.starts);
+        extents.swap(other.extents);
+        styles.swap(other.styles);
+        firstPoints.swap(other.firstPoints);
+        points.swap(other.points);
+    }
+
+    // Bytes held by the columns, including spare capacity
+    std::size_t memoryUsage() const {
+        return kinds.capacity() * sizeof(ShapeKind) + starts.capacity() * sizeof(sf::Vector2f)
+            + extents.capacity() * sizeof(sf::Vector2f) + styles.memoryUsage() + firstPoints.capacity() * sizeof(std::uint32_t) + points.capacity() * sizeof(sf::Vector2f);
+    }
+
+    ShapeKind kind(std::size_t index) const { return kinds[index]; }
+    const sf::Vector2f& start(std::size_t index) const { return starts[index]; }
+    const sf::Vector2f& extent(std::size_t index) const { return extents[index]; }
+    const sf::Color& color(std::size_t index) const { return styles[index].color; }
+    float width(std::size_t index) const { return styles[index].width; }
+    std::size_t styleCount() const { return styles.paletteSize(); }
+    std::size_t pointCount(std::size_t index) const { return pointOffset(index + 1) - firstPoints[index]; }
+    const sf::Vector2f* pointData(std::size_t index) const { return points.data() + firstPoints[index]; }
+    std::size_t totalPointCount() const { return points.size(); }
+
+    // Raw views of the columns, for bulk I/O
+    const ShapeKind* kindData() const { return kinds.data(); }
+    const sf::Vector2f* startData() const { return starts.data(); }
+    const sf::Vector2f* extentData() const { return extents.data(); }
+
+    // Axis-aligned bounds of a shape, including its outline or stroke width
+    sf::FloatRect bounds(std::size_t index) const {
+        const sf::Vector2f& a = starts[index];
+        bool outlined = kinds[index] == ShapeKind::Rectangle || kinds[index] == ShapeKind::Circle;
+        sf::Vector2f b = !outlined ? extents[index]
+            : kinds[index] == ShapeKind::Rectangle ? a + extents[index]
+            : a + extents[index] * 2.f;
+        // Outlines grow outwards; strokes are centred, with round ends and
+        // joins that can be mitred slightly past the half width
+        float pad = outlined ? width(index) : width(index) / 2 * (1 + StrokeTessellator::RoundSlack);
+        float left = std::min(a.x, b.x) - pad;
+        float top = std::min(a.y, b.y) - pad;
+        return sf::FloatRect(left, top, std::abs(b.x - a.x) + 2 * pad, std::abs(b.y - a.y) + 2 * pad);
+    }
+
+    // True if `point` lies within `tolerance` of the shape's stroke
+    bool hitTest(std::size_t index, const sf::Vector2f& point, float tolerance) const {
+        const sf::Vector2f& a = starts[index];
+        const sf::Vector2f& e = extents[index];
+        switch (kinds[index]) {
+        case ShapeKind::Line:
+            return distanceToSegment(point, a, e) <= tolerance + width(index) / 2;
+        case ShapeKind::Rectangle: {
+            sf::Vector2f corners[4] = { a, { a.x + e.x, a.y }, a + e, { a.x, a.y + e.y } };
+            for (int i = 0; i < 4; ++i) {
+                if (distanceToSegment(point, corners[i], corners[(i + 1) % 4]) <= tolerance + width(index)) {
+                    return true;
+                }
+            }
+            return false;
+        }
+        case ShapeKind::Circle: {
+            sf::Vector2f d = point - (a + sf::Vector2f(e.x, e.x));
+            float distance = std::sqrt(d.x * d.x + d.y * d.y);
+            return std::abs(distance - e.x - width(index) / 2) <= tolerance + width(index) / 2;
+        }
+        case ShapeKind::Stroke: {
+            float reach = tolerance + width(index) / 2;
+            if (point.x < a.x - reach || point.y < a.y - reach || point.x > e.x + reach || point.y > e.y + reach) {
+                return false;
+            }
+            const sf::Vector2f* p = pointData(index);
+            std::size_t count = pointCount(index);
+            for (std::size_t i = 1; i < count; ++i) {
+                if (distanceToSegment(point, p[i - 1], p[i]) <= reach) {
+                    return true;
+                }
+            }
+            return count == 1 && distanceToSegment(point, p[0], p[0]) <= reach;
+        }
+        }
+        return false;
+    }
+
+    // Index of the topmost shape under `point`, or size() if there is none
+    std::size_t pick(const sf::Vector2f& point, float tolerance) const {
+        for (std::size_t i = size(); i-- > 0;) {
+            if (hitTest(i, point, tolerance)) {
+                return i;
+            }
+        }
+        return size();
+    }
+
+    // Appends the geometry of one shape to a render batch. Curves are
+    // tessellated, and edges anti-aliased, for display at `pixelsPerUnit`
+    // pixels per scene unit
+    void appendTo(std::size_t index, RenderBatch& batch, float pixelsPerUnit = 1.f) const {
+        const sf::Vector2f& a = starts[index];
+        const sf::Vector2f& e = extents[index];
+        float pixelSize = 1.f / pixelsPerUnit;
+        switch (kinds[index]) {
+        case ShapeKind::Line: {
+            sf::Vector2f ends[2] = { a, e };
+            batch.addPolyline(ends, 2, width(index), color(index), pixelSize);
+            break;
+        }
+        case ShapeKind::Rectangle: {
+            sf::Vector2f corners[4] = { a, { a.x + e.x, a.y }, a + e, { a.x, a.y + e.y } };
+            batch.addOutline(corners, 4, width(index), color(index), pixelSize);
+            break;
+        }
+        case ShapeKind::Circle: {
+            float radius = e.x;
+            const std::vector<sf::Vector2f>& directions = unitCircle(circleLod(radius * pixelsPerUnit));
+            sf::Vector2f outline[MinCirclePoints << (CircleLodCount - 1)];
+            sf::Vector2f center = a + sf::Vector2f(radius, radius);
+            for (std::size_t i = 0; i < directions.size(); ++i) {
+                outline[i] = center + directions[i] * radius;
+            }
+            batch.addOutline(outline, directions.size(), width(index), color(index), pixelSize);
+            break;
+        }
+        case ShapeKind::Stroke:
+            // A one point stroke would be a dot; the pencil never stores those
+            if (pointCount(index) >= 2) {
+                batch.addPolyline(pointData(index), pointCount(index), width(index), color(index), pixelSize);
+            }
+            break;
+        }
+    }
+
+    void appendTo(RenderBatch& batch, float pixelsPerUnit = 1.f) const {
+        for (std::size_t i = 0; i < size(); ++i) {
+            appendTo(i, batch, pixelsPerUnit);
+        }
+    }
+};
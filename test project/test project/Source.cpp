@@ -1,258 +1,1636 @@
 #include <SFML/Graphics.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
 #include <iostream>
-#include <vector>
 #include <memory>
+#include <string>
+#include <vector>
 
-// Base class for all shapes
-class Shape {
-public:
-    virtual void draw(sf::RenderTarget& target) = 0;
-    virtual ~Shape() = default;
-};
+#include "Antialiasing.h"
+#include "AutosaveJournal.h"
+#include "CanvasLayer.h"
+#include "CommandHistory.h"
+#include "DocumentFile.h"
+#include "ExportQueue.h"
+#include "FontCache.h"
+#include "FrameProfiler.h"
+#include "GeometryBuilder.h"
+#include "LayerStack.h"
+#include "NetworkSession.h"
+#include "ReferenceImage.h"
+#include "RenderBatch.h"
+#include "Scene.h"
+#include "SceneScript.h"
+#include "Selection.h"
+#include "ShapeStore.h"
+#include "SpatialGrid.h"
+#include "StrokeBuilder.h"
+#include "SvgWriter.h"
+#include "TiledExporter.h"
+#include "Toolbar.h"
 
-// Derived class for Line
-class Line : public Shape {
+// One drawing and the window it is edited in. Each document has its own
+// layers, tools, journal and export worker, so documents never wait on
+// each other's edits or exports; GraphicsApp below runs their frames
+class DocumentWindow {
 private:
-    sf::VertexArray line;
+    sf::RenderWindow window;
+    unsigned number;          // 1 for the first window; picks the files below
+    std::string documentName; // Base name of the files this window saves and opens
+    LayerStack layers;      // Shapes, history and cached image of each layer
+    ReferenceImage reference; // Traced over; drawn beneath every layer
+    sf::Text layerText;
+    sf::Color currentColor = sf::Color::White;
+    float currentWidth = 2.f; // Stroke width of new lines, outline thickness of new rectangles and circles
+    static constexpr float MinWidth = 1.f;
+    static constexpr float MaxWidth = 32.f;
+    const sf::Font& font; // Shared through FontCache
+
+    enum class ShapeType { None, Line, Rectangle, Circle, Stroke, Select, Fill } currentShapeType;
+
+    // Toolbar buttons; the layout table below decides their order
+    enum class Command { Line, Rectangle, Circle, Clear, Save, Undo, Select };
+    struct ToolbarEntry {
+        Command command;
+        const char* label;
+    };
+    static const ToolbarEntry ToolbarLayout[7];
+    Toolbar toolbar;
+
+    bool isDrawing = false; // True if we are in the drawing phase
+    sf::Vector2f startPos;
+    StrokeBuilder stroke;   // Simplifies the freehand stroke being drawn
+
+    // Rubber-band preview of the shape being drawn. Both are rebuilt in place
+    // on every mouse move, so they only allocate while growing
+    ShapeStore pendingShape;
+    RenderBatch preview;
+    std::vector<sf::Vector2f> previewPoints; // The stroke so far and its tip
+
+    Selection selection;     // Shapes of the active layer picked with the Select tool
+    bool isTransforming = false; // Dragging the selection
+    bool isBoxSelecting = false; // Dragging out a selection rectangle
+    sf::Vector2f boxStart, boxEnd;
+    RenderBatch dragged;     // The shapes being dragged, rebuilt on every move
+    RenderBatch highlight;   // A box around each selected shape
+
+    bool frameDirty = true;  // Set when the window contents need to be recomposited
+
+    // OnDemand sleeps until an event and only draws frames that changed,
+    // without vsync, for the lowest latency; the others draw continuously
+    enum class FramePacing { OnDemand, VSync, Fixed } pacing = FramePacing::OnDemand;
+    static const unsigned FixedFrameRate = 60;
+
+    // Mouse moves of one burst are coalesced; only the newest position is
+    // acted on, when the next other event or the end of the frame comes
+    bool hasPendingMove = false;
+    sf::Vector2i pendingMove;
+
+    static constexpr float MaxZoom = 64.f; // In either direction, relative to the default view
+    sf::View camera;         // Maps the scene onto the canvas; the UI keeps the default view
+    bool cameraMoved = false; // Set by pan and zoom; the canvas is repainted once per frame
+    bool isPanning = false;
+    sf::Vector2i panOrigin;
+
+    ExportQueue exports;     // Compresses and writes PNGs off the UI thread
+    unsigned shownExports = 0; // Completed exports already reflected in statusText
+    sf::Text statusText;
+
+    std::string autosaveFile;
+    JournalWriter journal;   // Records every edit, for recovery after a crash
+    bool reportedAutosaveFailure = false;
+
+    NetworkSession session;  // Shares the drawing with other programs; F8 hosts
+    JournalReader sessionReader; // Decodes the edits the session receives
+    ShapeStore sessionShapes;    // Shapes of the shared record being applied
+    std::string sessionHost;     // Address joined, for the status line
+    bool sessionWelcomed = false; // The host's drawing has arrived
+
+    DocumentReader loader;   // Streams a document in over several frames
+    Layer* loadTarget = nullptr; // Layer the document is streaming into
+
+    FrameProfiler profiler;
+    bool showProfiler = false; // Toggled with F3
+    sf::Text profilerText;
+    sf::RectangleShape profilerBackground;
+
+    // Interactive drawing stays cheap by default; exports ask for more.
+    // The window's own samples, used by the overlays, are picked when it is
+    // created; F6 changes those of the layers' canvases
+    Antialiasing viewAntialiasing = Antialiasing::interactiveDefault();
+    Antialiasing exportAntialiasing = Antialiasing::exportDefault();
+
+    bool newWindowRequested = false; // Ctrl+N; GraphicsApp opens the window
+
+    static std::string numbered(const char* name, unsigned windowNumber) {
+        return windowNumber > 1 ? name + std::to_string(windowNumber) : name;
+    }
+
 public:
-    Line(const sf::Vector2f& start, const sf::Vector2f& end, const sf::Color& color)
-        : line(sf::Lines, 2) {
-        line[0].position = start;
-        line[1].position = end;
-        line[0].color = color;
-        line[1].color = color;
+    // Opens window `windowNumber`, which saves to drawing<number>.* and
+    // recovers its own autosave. Tessellation is shared with other
+    // documents through `geometry`, fonts through FontCache and the
+    // instancing shader through InstancedRenderer
+    DocumentWindow(GeometryBuilder& geometry, unsigned windowNumber)
+        : window(sf::VideoMode(800, 600), windowNumber > 1 ? "2D Graphics Drawing App " + std::to_string(windowNumber) : "2D Graphics Drawing App", sf::Style::Default,
+                 Antialiasing::interactiveDefault().contextSettings()),
+        number(windowNumber),
+        documentName(numbered("drawing", windowNumber)),
+        layers(geometry),
+        font(FontCache::get("arial.ttf")),
+        currentShapeType(ShapeType::None),
+        toolbar(window.getSize().x, font),
+        autosaveFile(numbered("autosave", windowNumber) + ".2dj") {
+
+        // Button labels use size 18, the instructions size 20, the profiler 14
+        FontCache::prewarm(font, { 14, 18, 20 });
+
+        for (const ToolbarEntry& entry : ToolbarLayout) {
+            toolbar.add(static_cast<int>(entry.command), entry.label);
+        }
+        toolbar.setCaption("'F' pencil, 'B' fill, 'Z'/'Y' undo/redo, 'C' clears, 'O' opens, 'E' SVG, 'P' poster, 'I' image.\n"
+                           "Mouse wheel zooms, middle button pans, Home resets the view, F3 stats, F6/F7 view/export AA, F8 shares.\n"
+                           "'N' new layer (Ctrl: new window), '['/']' pick layer (Ctrl moves it), 'H' hides, 'L' locks, '-'/'=' width.\n"
+                           "Select: drag moves, Shift+drag scales, Alt+drag rotates, Ctrl adds, Esc cancels.");
+
+        statusText.setFont(font);
+        statusText.setCharacterSize(18);
+        statusText.setFillColor(sf::Color(180, 180, 180));
+        statusText.setPosition(10, 570);
+
+        profilerText.setFont(font);
+        profilerText.setCharacterSize(14);
+        profilerText.setFillColor(sf::Color::Green);
+        profilerText.setPosition(510, 110);
+        profilerBackground.setPosition(500, 100);
+        profilerBackground.setSize({ 290, 185 });
+        profilerBackground.setFillColor(sf::Color(0, 0, 0, 200));
+
+        layerText.setFont(font);
+        layerText.setCharacterSize(14);
+        layerText.setFillColor(sf::Color(180, 180, 180));
+
+        layers.setAntialiasing(viewAntialiasing);
+        layers.create(window.getSize().x, window.getSize().y);
+        camera = window.getDefaultView();
+        if (number > 1) {
+            window.setPosition(window.getPosition() + sf::Vector2i(30, 30) * static_cast<int>(number - 1));
+        }
+        recoverAutosave();
     }
 
-    void draw(sf::RenderTarget& target) override {
-        target.draw(line);
+    DocumentWindow(const DocumentWindow&) = delete;
+    DocumentWindow& operator=(const DocumentWindow&) = delete;
+
+    unsigned getNumber() const { return number; }
+
+    // True once the window is closed and its exports are written
+    bool isFinished() const { return !window.isOpen() && exports.pending() == 0; }
+
+    // Shares the drawing with the programs that join on `port`. Returns
+    // false if the port cannot be listened on
+    bool hostSession(unsigned short port) {
+        bool hosting = session.host(port);
+        statusText.setString(hosting ? "Sharing the drawing on port " + std::to_string(port)
+            : "Failed to share on port " + std::to_string(port));
+        frameDirty = true;
+        return hosting;
     }
-};
 
-// Derived class for Rectangle
-class Rectangle : public Shape {
-private:
-    sf::RectangleShape rectangle;
-public:
-    Rectangle(const sf::Vector2f& position, const sf::Vector2f& size, const sf::Color& color) {
-        rectangle.setPosition(position);
-        rectangle.setSize(size);
-        rectangle.setFillColor(sf::Color::Transparent);
-        rectangle.setOutlineThickness(2);
-        rectangle.setOutlineColor(color);
+    // Starts joining the drawing shared at `address`; it replaces this
+    // window's drawing once it arrives
+    void joinSession(const std::string& address, unsigned short port) {
+        session.join(address, port);
+        sessionHost = address;
+        sessionWelcomed = false;
+        statusText.setString("Joining " + address + "...");
+        frameDirty = true;
     }
 
-    void draw(sf::RenderTarget& target) override {
-        target.draw(rectangle);
+    // Returns true once after Ctrl+N
+    bool takeNewWindowRequest() {
+        bool requested = newWindowRequested;
+        newWindowRequested = false;
+        return requested;
+    }
+
+    // Handles the window's events and draws its next frame if it changed.
+    // With `mayWait`, the only window may sleep until something happens;
+    // otherwise GraphicsApp paces the idle windows. Returns whether a frame
+    // was drawn
+    bool update(bool mayWait) {
+        if (!window.isOpen()) {
+            return false;
+        }
+        handleEvents(mayWait);
+        updateSession();
+        updateReference();
+        if (loader.isLoading()) {
+            loadNextChunk();
+        }
+        if (exports.completed() != shownExports) {
+            updateStatus();
+        }
+        if (!isDrawing && !isTransforming && !loader.isLoading() && journal.needsSnapshot()) {
+            journal.snapshot(layers);
+        }
+        journal.flush();
+        if (journal.failed() && !reportedAutosaveFailure) {
+            statusText.setString("Autosave failed; save your work manually");
+            reportedAutosaveFailure = true;
+            frameDirty = true;
+        }
+        profiler.end(FrameProfiler::Events);
+
+        if (!window.isOpen()) {
+            return false;
+        }
+        if (frameDirty || pacing != FramePacing::OnDemand) {
+            drawShapes();
+            const RenderStats& stats = RenderStats::frame();
+            profiler.endFrame(stats.drawCalls, stats.vertices, layers.shapeCount());
+            return true;
+        }
+        if (mayWait && (exports.pending() > 0 || reference.isBusy() || session.isActive())) {
+            // Poll the background workers and the session at roughly frame rate while they are busy
+            sf::sleep(sf::milliseconds(16));
+        }
+        return false;
     }
-};
 
-// Derived class for Circle
-class Circle : public Shape {
 private:
-    sf::CircleShape circle;
-public:
-    Circle(const sf::Vector2f& position, float radius, const sf::Color& color) {
-        circle.setPosition(position);
-        circle.setRadius(radius);
-        circle.setFillColor(sf::Color::Transparent);
-        circle.setOutlineThickness(2);
-        circle.setOutlineColor(color);
+    void handleEvents(bool mayWait) {
+        sf::Event event;
+
+        // Nothing to redraw or report, so sleep until the next event instead of spinning
+        bool waited = false;
+        if (mayWait && pacing == FramePacing::OnDemand && !frameDirty && !loader.isLoading() && exports.pending() == 0
+            && exports.completed() == shownExports && !reference.isBusy() && !session.isActive()) {
+            waited = window.waitEvent(event);
+        }
+
+        // The frame starts once there is work, so idle time is not profiled
+        profiler.beginFrame();
+        RenderStats::frame() = RenderStats();
+        profiler.begin(FrameProfiler::Events);
+
+        if (waited) {
+            dispatchEvent(event);
+        }
+
+        while (window.pollEvent(event)) {
+            dispatchEvent(event);
+        }
+        flushMouseMove();
+
+        // Many wheel or drag events can arrive in one frame; repaint for the last
+        if (cameraMoved) {
+            layers.setView(camera);
+            cameraMoved = false;
+        }
     }
 
-    void draw(sf::RenderTarget& target) override {
-        target.draw(circle);
+    void dispatchEvent(const sf::Event& event) {
+        if (event.type == sf::Event::MouseMoved) {
+            // Every point still goes into a freehand stroke, so coalescing
+            // does not change its shape, only how often the preview is rebuilt
+            if (isDrawing && currentShapeType == ShapeType::Stroke) {
+                stroke.add(toScene(event.mouseMove.x, event.mouseMove.y));
+            }
+            pendingMove = sf::Vector2i(event.mouseMove.x, event.mouseMove.y);
+            hasPendingMove = true;
+            return;
+        }
+
+        // Later events see the cursor where it was when they happened
+        flushMouseMove();
+        if (event.type == sf::Event::MouseButtonPressed || event.type == sf::Event::MouseButtonReleased
+            || event.type == sf::Event::MouseWheelScrolled || event.type == sf::Event::KeyPressed) {
+            profiler.markInput();
+        }
+        handleEvent(event);
     }
-};
 
-// GUI Button class for user-friendly interface
-class Button {
-private:
-    sf::RectangleShape buttonShape;
-    sf::Text buttonText;
-    sf::Font font;
+    // Acts on the newest mouse position. A move that neither hovers a new
+    // button, pans nor draws leaves the frame as it is
+    void flushMouseMove() {
+        if (!hasPendingMove) {
+            return;
+        }
+        hasPendingMove = false;
 
-public:
-    Button(const sf::Vector2f& position, const sf::Vector2f& size, const std::string& text) {
-        buttonShape.setPosition(position);
-        buttonShape.setSize(size);
-        buttonShape.setFillColor(sf::Color(100, 100, 100)); // Dark grey background
+        bool changed = toolbar.hover(pendingMove);
+        if (isPanning) {
+            camera.move(window.mapPixelToCoords(panOrigin, camera) - window.mapPixelToCoords(pendingMove, camera));
+            panOrigin = pendingMove;
+            cameraMoved = true;
+            changed = true;
+        }
+        if (isDrawing) {
+            updatePreview(toScene(pendingMove.x, pendingMove.y));
+            changed = true;
+        }
+        if (isTransforming) {
+            selection.drag(layers.getActive().shapes, toScene(pendingMove.x, pendingMove.y));
+            updateDragged();
+            changed = true;
+        }
+        if (isBoxSelecting) {
+            boxEnd = toScene(pendingMove.x, pendingMove.y);
+            changed = true;
+        }
+        if (changed) {
+            profiler.markInput();
+            frameDirty = true;
+        }
+    }
 
-        if (!font.loadFromFile("arial.ttf")) {
-            // Handle error
+    void setPacing(FramePacing mode) {
+        pacing = mode;
+        window.setVerticalSyncEnabled(mode == FramePacing::VSync);
+        window.setFramerateLimit(mode == FramePacing::Fixed ? FixedFrameRate : 0);
+    }
+
+    const char* pacingName() const {
+        switch (pacing) {
+        case FramePacing::VSync:
+            return "vsync";
+        case FramePacing::Fixed:
+            return "fixed 60 fps";
+        default:
+            return "on demand";
         }
+    }
 
-        buttonText.setFont(font);
-        buttonText.setString(text);
-        buttonText.setCharacterSize(18);
-        buttonText.setFillColor(sf::Color::White);
-        buttonText.setPosition(position.x + 10, position.y + 10);
+    sf::Vector2f toScene(int x, int y) const {
+        return window.mapPixelToCoords(sf::Vector2i(x, y), camera);
     }
 
-    void draw(sf::RenderTarget& target) {
-        target.draw(buttonShape);
-        target.draw(buttonText);
+    // Scene units covered by one window pixel at the current zoom
+    float unitsPerPixel() const {
+        return camera.getSize().x / window.getSize().x;
     }
 
-    bool isClicked(const sf::Vector2i& mousePos) {
-        return buttonShape.getGlobalBounds().contains(sf::Vector2f(mousePos));
+    // Zooms by `factor` (below 1 zooms in), keeping the scene point under `pixel` in place
+    void zoomAt(const sf::Vector2i& pixel, float factor) {
+        float width = camera.getSize().x * factor;
+        float defaultWidth = window.getDefaultView().getSize().x;
+        if (width < defaultWidth / MaxZoom || width > defaultWidth * MaxZoom) {
+            return;
+        }
+        sf::Vector2f before = window.mapPixelToCoords(pixel, camera);
+        camera.zoom(factor);
+        camera.move(before - window.mapPixelToCoords(pixel, camera));
+        cameraMoved = true;
     }
-};
 
-// Main Application Class
-class GraphicsApp {
-private:
-    sf::RenderWindow window;
-    std::vector<std::shared_ptr<Shape>> shapes;
-    sf::Color currentColor = sf::Color::White;
-    sf::Font font;
-    sf::Text instructions;
+    void handleEvent(const sf::Event& event) {
+        // Any event may change what is on screen; recompositing the
+        // cached layers is cheap compared to re-rendering the shapes
+        frameDirty = true;
 
-    enum class ShapeType { None, Line, Rectangle, Circle } currentShapeType;
+        if (event.type == sf::Event::Closed) {
+            window.close();
+        }
 
-    bool isDrawing = false; // True if we are in the drawing phase
-    sf::Vector2f startPos;
+        if (event.type == sf::Event::MouseButtonPressed && event.mouseButton.button == sf::Mouse::Middle) {
+            isPanning = true;
+            panOrigin = sf::Vector2i(event.mouseButton.x, event.mouseButton.y);
+        }
+        else if (event.type == sf::Event::MouseButtonPressed && !isTransforming && !isBoxSelecting) {
+            sf::Vector2i mousePos(event.mouseButton.x, event.mouseButton.y);
+            if (!isDrawing) {
+                // Start drawing on first click after selecting shape
+                int button = toolbar.hit(mousePos);
+                if (button != Toolbar::NoButton) {
+                    runCommand(static_cast<Command>(button));
+                }
+                else if (currentShapeType == ShapeType::Select) {
+                    pressSelect(toScene(mousePos.x, mousePos.y));
+                }
+                else if (currentShapeType != ShapeType::None && layers.getActive().locked) {
+                    statusText.setString(layers.getActive().name + " is locked");
+                }
+                else if (currentShapeType == ShapeType::Fill) {
+                    fillAt(toScene(mousePos.x, mousePos.y));
+                }
+                else if (currentShapeType == ShapeType::Stroke) {
+                    // Freehand strokes follow the mouse until the button is released
+                    stroke.begin(toScene(event.mouseButton.x, event.mouseButton.y), unitsPerPixel());
+                    isDrawing = true;
+                    updatePreview(stroke.tip());
+                }
+                else if (currentShapeType != ShapeType::None) {
+                    // If a shape type is selected, begin drawing
+                    startPos = toScene(mousePos.x, mousePos.y);
+                    isDrawing = true; // Mark the drawing phase as started
+                    updatePreview(startPos);
+                }
+            }
+            else if (currentShapeType != ShapeType::Stroke) {
+                // Complete the drawing on second click
+                sf::Vector2f endPos = toScene(event.mouseButton.x, event.mouseButton.y);
+                addPendingShape(layers.getActive().shapes, endPos);
+                commitShape();
+                currentShapeType = ShapeType::None;
+                isDrawing = false; // Mark the drawing as completed
+            }
+        }
 
-    Button lineButton, rectButton, circleButton, clearButton, saveButton, undoButton;
-    std::vector<std::shared_ptr<Shape>> undoStack; // For undo functionality
+        if (event.type == sf::Event::MouseButtonReleased && event.mouseButton.button == sf::Mouse::Middle) {
+            isPanning = false;
+        }
+        else if (event.type == sf::Event::MouseButtonReleased && isDrawing && currentShapeType == ShapeType::Stroke) {
+            // The pencil stays selected for the next stroke; a click without a drag draws nothing
+            const std::vector<sf::Vector2f>& points = stroke.finish();
+            if (points.size() >= 2) {
+                layers.getActive().shapes.addStroke(points.data(), points.size(), currentColor, currentWidth);
+                commitShape();
+            }
+            isDrawing = false;
+        }
+        else if (event.type == sf::Event::MouseButtonReleased && event.mouseButton.button == sf::Mouse::Left && isTransforming) {
+            dropSelection();
+        }
+        else if (event.type == sf::Event::MouseButtonReleased && event.mouseButton.button == sf::Mouse::Left && isBoxSelecting) {
+            Layer& layer = layers.getActive();
+            sf::FloatRect box(std::min(boxStart.x, boxEnd.x), std::min(boxStart.y, boxEnd.y),
+                              std::abs(boxEnd.x - boxStart.x), std::abs(boxEnd.y - boxStart.y));
+            selection.selectArea(layer.shapes, layer.index, box, controlHeld());
+            isBoxSelecting = false;
+        }
 
-public:
-    GraphicsApp()
-        : window(sf::VideoMode(800, 600), "2D Graphics Drawing App"),
-        currentShapeType(ShapeType::None),
-        lineButton({ 10, 10 }, { 100, 50 }, "Line"),
-        rectButton({ 120, 10 }, { 100, 50 }, "Rectangle"),
-        circleButton({ 230, 10 }, { 100, 50 }, "Circle"),
-        clearButton({ 340, 10 }, { 100, 50 }, "Clear"),
-        saveButton({ 450, 10 }, { 100, 50 }, "Save"),
-        undoButton({ 560, 10 }, { 100, 50 }, "Undo") {
+        if (event.type == sf::Event::MouseWheelScrolled && event.mouseWheelScroll.wheel == sf::Mouse::VerticalWheel) {
+            float factor = event.mouseWheelScroll.delta > 0 ? 1 / 1.1f : 1.1f;
+            zoomAt(sf::Vector2i(event.mouseWheelScroll.x, event.mouseWheelScroll.y), factor);
+        }
 
-        if (!font.loadFromFile("arial.ttf")) {
-            // Handle font loading error
+        if (event.type == sf::Event::KeyPressed && event.key.code == sf::Keyboard::Escape && isTransforming) {
+            selection.cancel(layers.getActive().shapes);
+            dropSelection();
+        }
+        else if (event.type == sf::Event::KeyPressed && !isDrawing && !isTransforming && !isBoxSelecting) {
+            if (event.key.code == sf::Keyboard::O && session.isActive() && !session.isHosting()) {
+                statusText.setString("Only the host can open a document into a shared drawing");
+            }
+            else if (event.key.code == sf::Keyboard::O) {
+                openDocument(documentName + ".2dv");
+            }
+            else if (event.key.code == sf::Keyboard::C) {
+                clearShapes();
+            }
+            else if (event.key.code == sf::Keyboard::F) {
+                currentShapeType = ShapeType::Stroke;
+            }
+            else if (event.key.code == sf::Keyboard::B) {
+                currentShapeType = ShapeType::Fill;
+            }
+            else if (event.key.code == sf::Keyboard::E) {
+                std::shared_ptr<ShapeStore> flattened = flattenLayers();
+                sf::Vector2u size = window.getSize();
+                std::string filename = documentName + ".svg";
+                exports.push([flattened, size, filename] { return SvgWriter::save(*flattened, size, filename); }, filename);
+                updateStatus();
+            }
+            else if (event.key.code == sf::Keyboard::I) {
+                if (reference.isEmpty()) {
+                    reference.load("reference.png", sf::FloatRect(camera.getCenter() - camera.getSize() / 2.f, camera.getSize()));
+                    statusText.setString("Loading reference.png...");
+                }
+                else {
+                    reference.clear();
+                    statusText.setString("Removed the reference image");
+                }
+            }
+            else if (event.key.code == sf::Keyboard::P) {
+                savePoster(4.f);
+            }
+            else if (event.key.code == sf::Keyboard::Z) {
+                requestUndo();
+            }
+            else if (event.key.code == sf::Keyboard::Y) {
+                requestRedo();
+            }
+            else if (event.key.code == sf::Keyboard::N && event.key.control) {
+                newWindowRequested = true;
+            }
+            else if ((event.key.code == sf::Keyboard::N || (event.key.control && (event.key.code == sf::Keyboard::LBracket
+                      || event.key.code == sf::Keyboard::RBracket))) && session.isActive()) {
+                // Only shapes are shared; every copy keeps the layers it started with
+                statusText.setString("Layers cannot be added or moved in a shared drawing");
+            }
+            else if (event.key.code == sf::Keyboard::N) {
+                if (layers.add()) {
+                    journal.addLayer();
+                }
+                else {
+                    statusText.setString("Failed to create a layer");
+                }
+                selection.clear();
+                updateLayerText();
+            }
+            else if (event.key.code == sf::Keyboard::LBracket || event.key.code == sf::Keyboard::RBracket) {
+                int direction = event.key.code == sf::Keyboard::RBracket ? 1 : -1;
+                if (event.key.control) {
+                    if (layers.moveActive(direction)) {
+                        journal.moveActive(direction);
+                    }
+                }
+                else {
+                    layers.setActive(layers.getActiveIndex() + direction);
+                    journal.setActive(layers.getActiveIndex());
+                    selection.clear();
+                }
+                updateLayerText();
+            }
+            else if (event.key.code == sf::Keyboard::H) {
+                layers.getActive().visible = !layers.getActive().visible;
+                journal.setFlags(layers.getActiveIndex(), layers.getActive());
+                updateLayerText();
+            }
+            else if (event.key.code == sf::Keyboard::L) {
+                layers.getActive().locked = !layers.getActive().locked;
+                journal.setFlags(layers.getActiveIndex(), layers.getActive());
+                updateLayerText();
+            }
+            else if (event.key.code == sf::Keyboard::Hyphen || event.key.code == sf::Keyboard::Equal) {
+                currentWidth += event.key.code == sf::Keyboard::Equal ? 1.f : -1.f;
+                currentWidth = currentWidth < MinWidth ? MinWidth : currentWidth > MaxWidth ? MaxWidth : currentWidth;
+                statusText.setString("Width: " + std::to_string(static_cast<int>(currentWidth)));
+            }
+            else if (event.key.code == sf::Keyboard::Home) {
+                camera = window.getDefaultView();
+                cameraMoved = true;
+            }
+            else if (event.key.code == sf::Keyboard::F3) {
+                showProfiler = !showProfiler;
+            }
+            else if (event.key.code == sf::Keyboard::F4) {
+                bool saved = profiler.writeCsv("profile.csv") && profiler.writeChromeTrace("profile.json");
+                statusText.setString(saved ? "Wrote profile.csv and profile.json" : "Failed to write profile");
+            }
+            else if (event.key.code == sf::Keyboard::F5) {
+                setPacing(pacing == FramePacing::OnDemand ? FramePacing::VSync
+                    : pacing == FramePacing::VSync ? FramePacing::Fixed : FramePacing::OnDemand);
+                statusText.setString(std::string("Frame pacing: ") + pacingName());
+            }
+            else if (event.key.code == sf::Keyboard::F6) {
+                viewAntialiasing = viewAntialiasing.nextInteractive();
+                bool applied = layers.setAntialiasing(viewAntialiasing);
+                statusText.setString(applied ? "View antialiasing: " + viewAntialiasing.describe()
+                    : "Failed to apply view antialiasing");
+            }
+            else if (event.key.code == sf::Keyboard::F7) {
+                exportAntialiasing = exportAntialiasing.nextExport();
+                statusText.setString("Export antialiasing: " + exportAntialiasing.describe());
+            }
+            else if (event.key.code == sf::Keyboard::F8) {
+                if (session.isActive()) {
+                    session.leave();
+                    statusText.setString("Stopped sharing");
+                }
+                else {
+                    // Each window has a port of its own, so several can host at once
+                    hostSession(static_cast<unsigned short>(NetworkSession::DefaultPort + number - 1));
+                }
+            }
         }
+    }
 
-        instructions.setFont(font);
-        instructions.setString("Select a shape to draw. Press 'C' to clear.");
-        instructions.setCharacterSize(20);
-        instructions.setFillColor(sf::Color::White);
-        instructions.setPosition(10, 70);
+    // Appends the shape the current tool makes between startPos and `endPos`
+    void addPendingShape(ShapeStore& target, const sf::Vector2f& endPos) const {
+        if (currentShapeType == ShapeType::Line) {
+            target.addLine(startPos, endPos, currentColor, currentWidth);
+        }
+        else if (currentShapeType == ShapeType::Rectangle) {
+            sf::Vector2f size = endPos - startPos;
+            target.addRectangle(startPos, size, currentColor, currentWidth);
+        }
+        else if (currentShapeType == ShapeType::Circle) {
+            float radius = std::sqrt(std::pow(endPos.x - startPos.x, 2) + std::pow(endPos.y - startPos.y, 2));
+            target.addCircle(startPos, radius, currentColor, currentWidth);
+        }
     }
 
-    void run() {
-        while (window.isOpen()) {
-            handleEvents();
-            drawShapes();
+    // Regenerates the preview geometry for the cursor at `cursor`, using the
+    // same tessellation as the committed shape will
+    void updatePreview(const sf::Vector2f& cursor) {
+        preview.clear();
+        if (currentShapeType == ShapeType::Stroke) {
+            previewPoints.assign(stroke.getPoints().begin(), stroke.getPoints().end());
+            previewPoints.push_back(stroke.tip());
+            preview.addPolyline(previewPoints.data(), previewPoints.size(), currentWidth, currentColor, unitsPerPixel());
+            return;
+        }
+        pendingShape.clear();
+        addPendingShape(pendingShape, cursor);
+        if (!pendingShape.empty()) {
+            pendingShape.appendTo(0, preview, 1.f / unitsPerPixel());
         }
     }
 
-private:
-    void handleEvents() {
-        sf::Event event;
-        while (window.pollEvent(event)) {
-            if (event.type == sf::Event::Closed) {
-                window.close();
+    void runCommand(Command command) {
+        switch (command) {
+        case Command::Line:
+            currentShapeType = ShapeType::Line;
+            break;
+        case Command::Rectangle:
+            currentShapeType = ShapeType::Rectangle;
+            break;
+        case Command::Circle:
+            currentShapeType = ShapeType::Circle;
+            break;
+        case Command::Select:
+            currentShapeType = ShapeType::Select;
+            break;
+        case Command::Clear:
+            clearShapes();
+            break;
+        case Command::Save:
+            saveDrawing();
+            break;
+        case Command::Undo:
+            requestUndo();
+            break;
+        }
+    }
+
+    // Records the shape just appended to the active layer and draws it onto the layer's canvas
+    void commitShape() {
+        Layer& layer = layers.getActive();
+        std::size_t added = layer.shapes.size() - 1;
+        if (!appliesEditsAtOnce()) {
+            // Shown once the host has put it in order
+            session.addShapes(layers.getActiveIndex(), layer.shapes, added, 1, false, false);
+            layer.shapes.truncate(added);
+            return;
+        }
+        layer.history.recordAdd(added, 1);
+        layers.recordEdit(layer);
+        journal.addShapes(layers.getActiveIndex(), layer.shapes, added, 1);
+        session.addShapes(layers.getActiveIndex(), layer.shapes, added, 1);
+        layer.index.insert(static_cast<SpatialGrid::Index>(added), layer.shapes.bounds(added));
+        layer.canvas.drawShape(layer.shapes, added);
+    }
+
+    // Clears the active layer, unless it is locked
+    void clearShapes() {
+        Layer& layer = layers.getActive();
+        if (layer.locked) {
+            statusText.setString(layer.name + " is locked");
+            return;
+        }
+        if (!appliesEditsAtOnce()) {
+            session.clear(layers.getActiveIndex(), false);
+        }
+        else if (clearLayer(layers.getActiveIndex())) {
+            session.clear(layers.getActiveIndex());
+        }
+    }
+
+    // Clears layer `position`; the history keeps the shapes so the clear
+    // can be undone. Returns false if the layer had no shapes
+    bool clearLayer(std::size_t position) {
+        Layer& layer = layers[position];
+        if (loadTarget == &layer) {
+            loader.cancel();
+        }
+        bool cleared = layer.history.clear(layer.shapes);
+        if (cleared) {
+            layers.recordEdit(layer);
+        }
+        journal.clear(position);
+        layer.index.clear();
+        layer.fills.clear();
+        if (&layer == &layers.getActive()) {
+            selection.clear();
+        }
+        layer.canvas.invalidate();
+        layer.canvas.repaintAll(layer.shapes, layer.index);
+        updateLayerText();
+        return cleared;
+    }
+
+    // False while this window's edits have to wait for the host of a
+    // shared drawing to order them. A client applies an edit at once only
+    // if nothing could be redone, as it may have to retract the edit again
+    // and a retract cannot bring back what the edit dropped
+    bool appliesEditsAtOnce() const {
+        return !session.isJoined() || !layers.canRedo();
+    }
+
+    static sf::FloatRect unite(const sf::FloatRect& a, const sf::FloatRect& b) {
+        float right = std::max(a.left + a.width, b.left + b.width);
+        float bottom = std::max(a.top + a.height, b.top + b.height);
+        float left = std::min(a.left, b.left);
+        float top = std::min(a.top, b.top);
+        return sf::FloatRect(left, top, right - left, bottom - top);
+    }
+
+    static bool controlHeld() {
+        return sf::Keyboard::isKeyPressed(sf::Keyboard::LControl) || sf::Keyboard::isKeyPressed(sf::Keyboard::RControl);
+    }
+
+    // Select tool press. Picks the shape under the cursor, or starts a
+    // selection rectangle over empty space; Ctrl adds to the selection.
+    // Pressing on a shape also drags the whole selection: Shift scales it,
+    // Alt rotates it, and otherwise it moves
+    void pressSelect(const sf::Vector2f& point) {
+        Layer& layer = layers.getActive();
+        std::size_t picked = layer.index.pick(layer.shapes, point, 4.f * unitsPerPixel());
+        if (picked >= layer.shapes.size()) {
+            boxStart = boxEnd = point;
+            isBoxSelecting = true;
+            return;
+        }
+        if (controlHeld()) {
+            selection.toggle(picked);
+            return;
+        }
+        if (!selection.contains(picked)) {
+            selection.set(picked);
+        }
+        if (layer.locked) {
+            statusText.setString(layer.name + " is locked");
+            return;
+        }
+
+        Selection::Mode mode = Selection::Mode::Move;
+        if (sf::Keyboard::isKeyPressed(sf::Keyboard::LShift) || sf::Keyboard::isKeyPressed(sf::Keyboard::RShift)) {
+            mode = Selection::Mode::Scale;
+        }
+        else if (sf::Keyboard::isKeyPressed(sf::Keyboard::LAlt) || sf::Keyboard::isKeyPressed(sf::Keyboard::RAlt)) {
+            mode = Selection::Mode::Rotate;
+        }
+        // The canvas is repainted without the selection once; until the drop,
+        // moves only touch the dragged shapes
+        sf::FloatRect lifted = selection.begin(layer.shapes, layer.index, mode, point);
+        layer.canvas.repaint(layer.shapes, layer.index, lifted);
+        isTransforming = true;
+        updateDragged();
+    }
+
+    void updateDragged() {
+        dragged.clear();
+        selection.appendTo(layers.getActive().shapes, dragged, 1.f / unitsPerPixel());
+    }
+
+    // Puts the dragged shapes back into the index and onto the canvas, and
+    // records the edit if they changed
+    void dropSelection() {
+        Layer& layer = layers.getActive();
+        bool moved = false;
+        sf::FloatRect area = selection.end(layer.shapes, layer.index, moved);
+        isTransforming = false;
+        const std::vector<SpatialGrid::Index>& indices = selection.getIndices();
+        if (moved && !appliesEditsAtOnce()) {
+            // The shapes go back until the host has put the move in order
+            session.modifyShapes(layers.getActiveIndex(), layer.shapes, indices.data(), indices.size(), false);
+            selection.cancel(layer.shapes);
+            for (SpatialGrid::Index i : indices) {
+                layer.index.update(i, layer.shapes.bounds(i));
             }
+            area = unite(area, selection.bounds(layer.shapes));
+            moved = false;
+        }
+        layer.canvas.repaint(layer.shapes, layer.index, area);
+        if (moved) {
+            layer.history.recordModify(indices.data(), indices.size(), selection.getOriginals());
+            layers.recordEdit(layer);
+            journal.modifyShapes(layers.getActiveIndex(), layer.shapes, indices.data(), indices.size());
+            session.modifyShapes(layers.getActiveIndex(), layer.shapes, indices.data(), indices.size());
+        }
+    }
 
-            if (event.type == sf::Event::MouseButtonPressed) {
-                sf::Vector2i mousePos = sf::Mouse::getPosition(window);
-                if (!isDrawing) {
-                    // Start drawing on first click after selecting shape
-                    if (lineButton.isClicked(mousePos)) {
-                        currentShapeType = ShapeType::Line;
-                    }
-                    else if (rectButton.isClicked(mousePos)) {
-                        currentShapeType = ShapeType::Rectangle;
-                    }
-                    else if (circleButton.isClicked(mousePos)) {
-                        currentShapeType = ShapeType::Circle;
-                    }
-                    else if (clearButton.isClicked(mousePos)) {
-                        shapes.clear();
-                        undoStack.clear();
-                    }
-                    else if (undoButton.isClicked(mousePos)) {
-                        if (!shapes.empty()) {
-                            undoStack.push_back(shapes.back());
-                            shapes.pop_back();
-                        }
-                    }
-                    else if (saveButton.isClicked(mousePos)) {
-                        saveDrawing();
-                    }
-                    else if (currentShapeType != ShapeType::None) {
-                        // If a shape type is selected, begin drawing
-                        startPos = sf::Vector2f(mousePos);
-                        isDrawing = true; // Mark the drawing phase as started
-                    }
+    // Fills the region of the active layer around `point` with the current
+    // colour, within the visible area, and repaints only what changed
+    void fillAt(const sf::Vector2f& point) {
+        Layer& layer = layers.getActive();
+        sf::Vector2f topLeft = camera.getCenter() - camera.getSize() / 2.f;
+        sf::IntRect area(static_cast<int>(std::floor(topLeft.x)), static_cast<int>(std::floor(topLeft.y)),
+                         static_cast<int>(std::ceil(camera.getSize().x)) + 1, static_cast<int>(std::ceil(camera.getSize().y)) + 1);
+        sf::IntRect changed;
+        if (!layer.fills.fill(point, currentColor, layer.shapes, layer.index, area, changed)) {
+            return;
+        }
+        if (!layer.fills.upload()) {
+            statusText.setString("Failed to upload the fill");
+        }
+        layer.canvas.repaint(layer.shapes, layer.index, sf::FloatRect(changed));
+    }
+
+    // Replays the journal left by the previous session, if any, through the
+    // same code paths that recorded it, then starts a new journal from the
+    // recovered drawing
+    void recoverAutosave() {
+        JournalReader reader;
+        std::size_t replayed = 0;
+        if (reader.open(autosaveFile) || reader.open(autosaveFile + ".tmp")) {
+            JournalReader::Record record;
+            ShapeStore shapes;
+            while (reader.next(record, shapes) && replayJournalRecord(record, shapes)) {
+                shapes.clear();
+                ++replayed;
+            }
+        }
+
+        repaintReplayed();
+        journal.start(autosaveFile, layers);
+        if (replayed > 0) {
+            statusText.setString("Recovered " + std::to_string(layers.shapeCount()) + " shapes from the autosave");
+        }
+    }
+
+    // Repaints every layer after records were replayed without drawing
+    void repaintReplayed() {
+        for (std::size_t i = 0; i < layers.size(); ++i) {
+            layers[i].canvas.invalidate();
+        }
+        layers.setView(camera);
+        selection.clear();
+        updateLayerText();
+    }
+
+    // Applies one journal record; returns false if it does not fit the drawing
+    bool replayJournalRecord(const JournalReader::Record& record, ShapeStore& shapes) {
+        if (record.op != AutosaveJournal::Op::AddLayer && record.op != AutosaveJournal::Op::MoveActive
+            && record.op != AutosaveJournal::Op::Undo && record.op != AutosaveJournal::Op::Redo
+            && record.op != AutosaveJournal::Op::Retract && record.layer >= layers.size()) {
+            return false;
+        }
+
+        switch (record.op) {
+        case AutosaveJournal::Op::AddLayer:
+            return layers.add() != nullptr;
+        case AutosaveJournal::Op::SetActive:
+            layers.setActive(record.layer);
+            return true;
+        case AutosaveJournal::Op::MoveActive:
+            return layers.moveActive(record.value);
+        case AutosaveJournal::Op::SetFlags:
+            layers[record.layer].visible = (record.flags & AutosaveJournal::Visible) != 0;
+            layers[record.layer].locked = (record.flags & AutosaveJournal::Locked) != 0;
+            return true;
+        case AutosaveJournal::Op::AddShapes: {
+            Layer& layer = layers[record.layer];
+            std::size_t first = layer.shapes.size();
+            layer.shapes.append(shapes, 0, shapes.size());
+            if (!(record.flags & AutosaveJournal::Snapshot)
+                && layer.history.recordAdd(first, shapes.size(), (record.flags & AutosaveJournal::Merge) != 0)) {
+                layers.recordEdit(layer);
+            }
+            for (std::size_t i = first; i < layer.shapes.size(); ++i) {
+                layer.index.insert(static_cast<SpatialGrid::Index>(i), layer.shapes.bounds(i));
+            }
+            return true;
+        }
+        case AutosaveJournal::Op::ModifyShapes: {
+            Layer& layer = layers[record.layer];
+            for (std::size_t i = 0; i < record.indices.size(); ++i) {
+                if (record.indices[i] >= layer.shapes.size() || layer.shapes.pointCount(record.indices[i]) != shapes.pointCount(i)) {
+                    return false;
                 }
-                else {
-                    // Complete the drawing on second click
-                    sf::Vector2f endPos(event.mouseButton.x, event.mouseButton.y);
-                    if (currentShapeType == ShapeType::Line) {
-                        shapes.push_back(std::make_shared<Line>(startPos, endPos, currentColor));
-                    }
-                    else if (currentShapeType == ShapeType::Rectangle) {
-                        sf::Vector2f size = endPos - startPos;
-                        shapes.push_back(std::make_shared<Rectangle>(startPos, size, currentColor));
-                    }
-                    else if (currentShapeType == ShapeType::Circle) {
-                        float radius = std::sqrt(std::pow(endPos.x - startPos.x, 2) + std::pow(endPos.y - startPos.y, 2));
-                        shapes.push_back(std::make_shared<Circle>(startPos, radius, currentColor));
+            }
+            // Leaves the previous versions in `shapes`, for the undo history
+            for (std::size_t i = 0; i < record.indices.size(); ++i) {
+                layer.shapes.exchange(record.indices[i], shapes, i);
+                layer.index.update(record.indices[i], layer.shapes.bounds(record.indices[i]));
+            }
+            if (layer.history.recordModify(record.indices.data(), record.indices.size(), shapes,
+                                           (record.flags & AutosaveJournal::Merge) != 0)) {
+                layers.recordEdit(layer);
+            }
+            return true;
+        }
+        case AutosaveJournal::Op::Undo:
+            undo();
+            return true;
+        case AutosaveJournal::Op::Redo:
+            redo();
+            return true;
+        case AutosaveJournal::Op::Clear:
+            clearLayer(record.layer);
+            return true;
+        case AutosaveJournal::Op::Retract:
+            retract();
+            return true;
+        }
+        return false;
+    }
+
+    // Undo key and button. A client of a shared drawing only asks the host,
+    // which undoes the same edit everywhere
+    void requestUndo() {
+        if (session.isJoined()) {
+            session.undo();
+        }
+        else if (undo()) {
+            session.undo();
+        }
+    }
+
+    void requestRedo() {
+        if (session.isJoined()) {
+            session.redo();
+        }
+        else if (redo()) {
+            session.redo();
+        }
+    }
+
+    // Returns false if there was nothing to undo
+    bool undo() {
+        HistoryChange change;
+        Layer* layer = layers.undo(change);
+        if (layer) {
+            journal.undo();
+            applyHistoryChange(*layer, change);
+        }
+        return layer != nullptr;
+    }
+
+    bool redo() {
+        HistoryChange change;
+        Layer* layer = layers.redo(change);
+        if (layer) {
+            journal.redo();
+            applyHistoryChange(*layer, change);
+        }
+        return layer != nullptr;
+    }
+
+    // Takes back the most recent edit so that it cannot be redone
+    void retract() {
+        HistoryChange change;
+        if (Layer* layer = layers.retract(change)) {
+            journal.retract();
+            applyHistoryChange(*layer, change);
+        }
+    }
+
+    // Trades edits with the programs sharing the drawing. Skipped during a
+    // drag, which holds the selection out of the index until it drops, and
+    // must not be sent in the middle of it
+    void updateSession() {
+        if (!session.isActive() || isTransforming) {
+            return;
+        }
+        session.update(layers);
+        std::vector<char> records;
+        if (session.takeWelcome(records)) {
+            applyWelcome(records);
+        }
+        if (session.takeJoins() > 0) {
+            layers.forgetHistory();
+            statusText.setString("A collaborator joined (" + std::to_string(session.peerCount()) + " connected)");
+            frameDirty = true;
+        }
+        if (session.takeLeaves() > 0) {
+            statusText.setString("A collaborator left (" + std::to_string(session.peerCount()) + " connected)");
+            frameDirty = true;
+        }
+        applySessionEdits();
+        if (session.takeFailure()) {
+            statusText.setString(sessionWelcomed ? "Lost the connection to " + sessionHost : "Failed to join " + sessionHost);
+            frameDirty = true;
+        }
+    }
+
+    // Replaces the drawing with the one the host sent, which has no history
+    void applyWelcome(const std::vector<char>& records) {
+        loader.cancel();
+        loadTarget = nullptr;
+        if (!layers.reset()) {
+            statusText.setString("Failed to create a layer");
+        }
+        const char* data = records.data();
+        std::size_t left = records.size();
+        JournalReader::Record record;
+        while (left > 0) {
+            sessionShapes.clear();
+            if (!sessionReader.next(data, left, record, sessionShapes) || !replayJournalRecord(record, sessionShapes)) {
+                break;
+            }
+        }
+        repaintReplayed();
+        journal.snapshot(layers);
+        sessionWelcomed = true;
+        statusText.setString("Joined the drawing shared by " + sessionHost);
+        frameDirty = true;
+    }
+
+    // Applies the edits received, in the host's order. Our own edits that
+    // were applied already are only confirmed, unless something the host
+    // ordered before them arrived first: then they are retracted, and
+    // reapplied after everything received this frame
+    void applySessionEdits() {
+        NetworkSession::Edit edit;
+        bool retracted = false;
+        while (session.receive(edit)) {
+            frameDirty = true;
+            if (session.isOwn(edit)) {
+                bool applied = session.unconfirmedEdits().front().applied;
+                session.confirm();
+                if (applied && !retracted) {
+                    continue;
+                }
+            }
+            if (!retracted && session.hasAppliedEdits()) {
+                std::deque<NetworkSession::Edit>& own = session.unconfirmedEdits();
+                for (auto it = own.rbegin(); it != own.rend(); ++it) {
+                    if (it->applied && it->effective) {
+                        retract();
                     }
-                    currentShapeType = ShapeType::None;
-                    isDrawing = false; // Mark the drawing as completed
                 }
+                retracted = true;
             }
+            applyEdit(edit);
+        }
+        if (retracted) {
+            for (NetworkSession::Edit& own : session.unconfirmedEdits()) {
+                if (own.applied) {
+                    own.applied = appliesEditsAtOnce();
+                    own.effective = own.applied && applyEdit(own);
+                }
+            }
+        }
+    }
 
-            if (sf::Keyboard::isKeyPressed(sf::Keyboard::C)) {
-                shapes.clear();
-                undoStack.clear();
+    // Returns whether the edit changed the drawing
+    bool applyEdit(const NetworkSession::Edit& edit) {
+        if (edit.kind == NetworkSession::Kind::Baseline) {
+            // Someone joined without history, so nobody may undo past this point
+            layers.forgetHistory();
+            return false;
+        }
+        const char* data = edit.records.data();
+        std::size_t left = edit.records.size();
+        bool changed = false;
+        JournalReader::Record record;
+        while (left > 0) {
+            sessionShapes.clear();
+            if (!sessionReader.next(data, left, record, sessionShapes) || !applySharedRecord(record, sessionShapes)) {
+                break;
+            }
+            changed = true;
+        }
+        return changed;
+    }
+
+    // Applies a record of a shared edit the way the edit itself was made:
+    // it is journaled and only the shapes it touched are redrawn. Returns
+    // whether the drawing changed. Only shapes are shared, so records of
+    // layer changes do not apply
+    bool applySharedRecord(const JournalReader::Record& record, ShapeStore& shapes) {
+        if (record.op != AutosaveJournal::Op::Undo && record.op != AutosaveJournal::Op::Redo && record.layer >= layers.size()) {
+            return false;
+        }
+        bool merge = (record.flags & AutosaveJournal::Merge) != 0;
+        switch (record.op) {
+        case AutosaveJournal::Op::AddShapes: {
+            Layer& layer = layers[record.layer];
+            std::size_t first = layer.shapes.size();
+            layer.shapes.append(shapes, 0, shapes.size());
+            if (layer.history.recordAdd(first, shapes.size(), merge)) {
+                layers.recordEdit(layer);
             }
+            journal.addShapes(record.layer, layer.shapes, first, shapes.size(), merge);
+            for (std::size_t i = first; i < layer.shapes.size(); ++i) {
+                layer.index.insert(static_cast<SpatialGrid::Index>(i), layer.shapes.bounds(i));
+            }
+            layer.canvas.drawShapes(layer.shapes, first, layer.shapes.size());
+            updateLayerText();
+            return true;
+        }
+        case AutosaveJournal::Op::ModifyShapes: {
+            Layer& layer = layers[record.layer];
+            if (record.indices.empty()) {
+                return false;
+            }
+            for (std::size_t i = 0; i < record.indices.size(); ++i) {
+                if (record.indices[i] >= layer.shapes.size() || layer.shapes.pointCount(record.indices[i]) != shapes.pointCount(i)) {
+                    return false;
+                }
+            }
+            sf::FloatRect region = layer.shapes.bounds(record.indices[0]);
+            for (std::size_t i = 0; i < record.indices.size(); ++i) {
+                region = unite(region, layer.shapes.bounds(record.indices[i]));
+                layer.shapes.exchange(record.indices[i], shapes, i);
+                region = unite(region, layer.shapes.bounds(record.indices[i]));
+                layer.index.update(record.indices[i], layer.shapes.bounds(record.indices[i]));
+            }
+            if (layer.history.recordModify(record.indices.data(), record.indices.size(), shapes, merge)) {
+                layers.recordEdit(layer);
+            }
+            journal.modifyShapes(record.layer, layer.shapes, record.indices.data(), record.indices.size(), merge);
+            layer.canvas.repaint(layer.shapes, layer.index, region);
+            return true;
+        }
+        case AutosaveJournal::Op::Clear:
+            return clearLayer(record.layer);
+        case AutosaveJournal::Op::Undo:
+            return undo();
+        case AutosaveJournal::Op::Redo:
+            return redo();
+        default:
+            return false;
+        }
+    }
+
+    // Brings a layer's index and canvas up to date after an undo or redo.
+    // Other layers, whatever their size, are not touched
+    void applyHistoryChange(Layer& layer, const HistoryChange& change) {
+        bool activeLayer = &layer == &layers.getActive();
+        switch (change.kind) {
+        case HistoryChange::Kind::None:
+            return;
+        case HistoryChange::Kind::RemovedTail:
+            for (std::size_t i = change.first + change.count; i-- > change.first;) {
+                layer.index.remove(static_cast<SpatialGrid::Index>(i));
+            }
+            if (activeLayer) {
+                selection.dropFrom(change.first);
+            }
+            layer.canvas.repaint(layer.shapes, layer.index, change.region);
+            break;
+        case HistoryChange::Kind::AppendedTail:
+            for (std::size_t i = change.first; i < change.first + change.count; ++i) {
+                layer.index.insert(static_cast<SpatialGrid::Index>(i), layer.shapes.bounds(i));
+            }
+            layer.canvas.drawShapes(layer.shapes, change.first, change.first + change.count);
+            break;
+        case HistoryChange::Kind::ReplacedAll:
+            layer.index.rebuild(layer.shapes);
+            if (activeLayer) {
+                selection.clear();
+            }
+            layer.canvas.invalidate();
+            layer.canvas.repaintAll(layer.shapes, layer.index);
+            break;
+        case HistoryChange::Kind::Modified:
+            // Shapes keep their indices, so the selection stays valid
+            for (std::uint32_t i : change.indices) {
+                layer.index.update(i, layer.shapes.bounds(i));
+            }
+            layer.canvas.repaint(layer.shapes, layer.index, change.region);
+            break;
+        }
+        updateLayerText();
+    }
+
+    // Lists the layers top to bottom in the corner of the window
+    void updateLayerText() {
+        std::string text;
+        for (std::size_t i = layers.size(); i-- > 0;) {
+            const Layer& layer = layers[i];
+            text += (i == layers.getActiveIndex() ? "> " : "   ") + layer.name + " (" + std::to_string(layer.shapes.size()) + ")";
+            text += layer.visible ? "" : " hidden";
+            text += layer.locked ? " locked" : "";
+            text += "\n";
+        }
+        layerText.setString(text);
+        sf::FloatRect bounds = layerText.getLocalBounds();
+        layerText.setPosition(790 - bounds.width, 560 - bounds.height);
+    }
+
+    // Toolbar button of the current tool, if it has one
+    int activeButton() const {
+        switch (currentShapeType) {
+        case ShapeType::Line:
+            return static_cast<int>(Command::Line);
+        case ShapeType::Rectangle:
+            return static_cast<int>(Command::Rectangle);
+        case ShapeType::Circle:
+            return static_cast<int>(Command::Circle);
+        case ShapeType::Select:
+            return static_cast<int>(Command::Select);
+        default:
+            return Toolbar::NoButton;
         }
     }
 
     void drawShapes() {
+        profiler.begin(FrameProfiler::Draw);
         window.clear(sf::Color::Black);
 
-        // Draw GUI buttons
-        lineButton.draw(window);
-        rectButton.draw(window);
-        circleButton.draw(window);
-        clearButton.draw(window);
-        saveButton.draw(window);
-        undoButton.draw(window);
+        window.setView(camera);
+        reference.draw(window);
+        window.setView(window.getDefaultView());
 
-        // Draw instructions
-        window.draw(instructions);
+        // The toolbar only redraws its cached image when the selected tool
+        // or the hovered button changed since the last frame
+        toolbar.setActive(activeButton());
+        toolbar.draw(window);
+        window.draw(statusText);
+        RenderStats::count(6 * statusText.getString().getSize());
 
-        // Draw shapes
-        for (const auto& shape : shapes) {
-            shape->draw(window);
+        // Draw shapes from the retained image of each visible layer
+        layers.draw(window);
+        window.draw(layerText);
+        RenderStats::count(6 * layerText.getString().getSize());
+
+        // Overlays on the scene are drawn through the camera
+        window.setView(camera);
+
+        // The shape in progress is not on the canvas layer until it is finished
+        if (isDrawing) {
+            preview.draw(window);
         }
 
+        // Dragged shapes are lifted off the canvas until they are dropped
+        if (isTransforming) {
+            dragged.draw(window);
+        }
+
+        // Highlight the selected shapes
+        if (!selection.empty()) {
+            highlight.clear();
+            selection.appendOutlines(layers.getActive().shapes, highlight, sf::Color::Yellow);
+            highlight.draw(window);
+        }
+        if (isBoxSelecting) {
+            sf::RectangleShape box(boxEnd - boxStart);
+            box.setPosition(boxStart);
+            box.setFillColor(sf::Color::Transparent);
+            box.setOutlineThickness(unitsPerPixel());
+            box.setOutlineColor(sf::Color::Yellow);
+            window.draw(box);
+            RenderStats::count(10);
+        }
+        window.setView(window.getDefaultView());
+
+        if (showProfiler) {
+            drawProfiler();
+        }
+        profiler.end(FrameProfiler::Draw);
+
+        profiler.begin(FrameProfiler::Display);
         window.display();
+        profiler.end(FrameProfiler::Display);
+        profiler.presented();
+        frameDirty = false;
+    }
+
+    // Shows the timings of the previous frames; the current one is still in progress
+    void drawProfiler() {
+        if (profiler.empty()) {
+            return;
+        }
+        const FrameProfiler::Frame& last = profiler.last();
+        FrameProfiler::Frame average = profiler.average();
+
+        std::size_t atlasBytes = 0;
+        for (unsigned size : { 14u, 18u, 20u }) {
+            sf::Vector2u atlas = font.getTexture(size).getSize();
+            atlasBytes += static_cast<std::size_t>(atlas.x) * atlas.y * 4;
+        }
+
+        char text[512];
+        std::snprintf(text, sizeof(text),
+            "frame        %6.2f ms (avg %6.2f)\n"
+            "handleEvents %6.2f ms\n"
+            "drawShapes   %6.2f ms\n"
+            "display      %6.2f ms\n"
+            "shapes %zu  draw calls %zu\n"
+            "vertices %zu\n"
+            "glyph atlases %zu KiB\n"
+            "input latency %6.2f ms\n"
+            "F5 pacing: %s\n"
+            "F4 dumps profile.csv / profile.json",
+            last.total() / 1000, average.total() / 1000,
+            average.duration[FrameProfiler::Events] / 1000,
+            average.duration[FrameProfiler::Draw] / 1000,
+            average.duration[FrameProfiler::Display] / 1000,
+            last.shapes, last.drawCalls, last.vertices, atlasBytes / 1024,
+            average.inputLatency < 0 ? 0. : average.inputLatency / 1000, pacingName());
+        profilerText.setString(text);
+
+        window.draw(profilerBackground);
+        window.draw(profilerText);
     }
 
-    // Save the current drawing to a PNG file
+    // The visible layers merged into one store, for an export worker to own
+    std::shared_ptr<ShapeStore> flattenLayers() {
+        std::shared_ptr<ShapeStore> flattened = std::make_shared<ShapeStore>();
+        layers.flatten(*flattened);
+        return flattened;
+    }
+
+    // Save the current drawing to a PNG file and as a reopenable vector
+    // document, both with the visible layers merged. Only copying the
+    // shapes, compositing the layers and reading them back happens here;
+    // the export queue writes the document, flattens the image onto black
+    // and writes it
     void saveDrawing() {
-        sf::RenderTexture texture;
-        texture.create(window.getSize().x, window.getSize().y);
+        std::shared_ptr<ShapeStore> flattened = flattenLayers();
+        std::string documentFile = documentName + ".2dv";
+        exports.push([flattened, documentFile] { return DocumentWriter::save(*flattened, documentFile); }, documentFile);
+
+        std::unique_ptr<sf::Image> image(new sf::Image(layers.compositeImage(exportAntialiasing)));
+        exports.push(std::move(image), documentName + ".png");
+        updateStatus();
+    }
+
+    // Exports the visible area at `scale` times its on-screen resolution,
+    // tile by tile. The export worker renders the tiles, in an OpenGL
+    // context of its own, so a large poster stalls no window
+    void savePoster(float scale) {
+        sf::FloatRect area(camera.getCenter() - camera.getSize() / 2.f, camera.getSize());
+        std::shared_ptr<ShapeStore> flattened = flattenLayers();
+        float pixelsPerUnit = scale / unitsPerPixel();
+        Antialiasing quality = exportAntialiasing;
+        std::string filename = documentName + "_poster.png";
+        exports.push([flattened, area, pixelsPerUnit, quality, filename] {
+            sf::Context context;
+            SpatialGrid index;
+            index.rebuild(*flattened);
+            return TiledExporter::save(*flattened, index, area, pixelsPerUnit, filename, quality);
+        }, filename);
+        updateStatus();
+    }
 
-        // Clear the texture
-        texture.clear(sf::Color::Black);
+    // Replaces the drawing with a saved document, which then streams in over
+    // the next frames so the first shapes show up before the file is read
+    void openDocument(const std::string& filename) {
+        if (layers.getActive().locked) {
+            statusText.setString(layers.getActive().name + " is locked");
+            return;
+        }
+        clearShapes();
+        loadTarget = &layers.getActive();
+        if (loader.open(filename)) {
+            statusText.setString("Loading " + filename + "...");
+        }
+        else {
+            statusText.setString("Failed to open " + filename);
+        }
+    }
+
+    void loadNextChunk() {
+        Layer& layer = *loadTarget;
+        std::size_t first = layer.shapes.size();
+        if (loader.readChunk(layer.shapes)) {
+            // The chunks are undone as one, except on a client, where each
+            // chunk is an edit that may have to be retracted on its own
+            bool merge = !session.isJoined();
+            if (layer.history.recordAdd(first, layer.shapes.size() - first, merge)) {
+                layers.recordEdit(layer);
+            }
+            journal.addShapes(layers.indexOf(layer), layer.shapes, first, layer.shapes.size() - first, merge);
+            session.addShapes(layers.indexOf(layer), layer.shapes, first, layer.shapes.size() - first, merge);
+            for (std::size_t i = first; i < layer.shapes.size(); ++i) {
+                layer.index.insert(static_cast<SpatialGrid::Index>(i), layer.shapes.bounds(i));
+            }
+            layer.canvas.drawShapes(layer.shapes, first, layer.shapes.size());
+            statusText.setString("Loading... " + std::to_string(layer.shapes.size()) + " shapes");
+        }
+        else {
+            statusText.setString(loader.failed() ? "Failed to read document"
+                : "Loaded " + std::to_string(layer.shapes.size()) + " shapes");
+        }
+        updateLayerText();
+        frameDirty = true;
+    }
 
-        // Draw all the shapes to the texture
-        for (const auto& shape : shapes) {
-            shape->draw(texture);
+    // Streams in the reference image tiles the view needs and reports when it finishes loading
+    void updateReference() {
+        bool wasLoading = reference.isLoading();
+        if (reference.update(camera, 1.f / unitsPerPixel())) {
+            frameDirty = true;
         }
+        if (reference.takeFailure()) {
+            statusText.setString("Failed to load reference.png");
+            frameDirty = true;
+        }
+        else if (wasLoading && !reference.isLoading()) {
+            sf::Vector2u size = reference.getSize();
+            statusText.setString("Loaded reference.png (" + std::to_string(size.x) + " x " + std::to_string(size.y) + ")");
+            frameDirty = true;
+        }
+    }
 
-        // Save the texture to a PNG file
-        texture.display();
-        texture.getTexture().copyToImage().saveToFile("drawing.png");
+    void updateStatus() {
+        shownExports = exports.completed();
+        unsigned pending = exports.pending();
+        if (pending > 0) {
+            statusText.setString("Saving... (" + std::to_string(pending) + " queued)");
+        }
+        else if (exports.succeeded()) {
+            statusText.setString("Saved " + exports.lastFile());
+        }
+        else {
+            statusText.setString("Failed to save " + exports.lastFile());
+        }
+        frameDirty = true;
     }
 };
 
-int main() {
+const DocumentWindow::ToolbarEntry DocumentWindow::ToolbarLayout[7] = {
+    { Command::Line, "Line" },
+    { Command::Rectangle, "Rectangle" },
+    { Command::Circle, "Circle" },
+    { Command::Clear, "Clear" },
+    { Command::Save, "Save" },
+    { Command::Undo, "Undo" },
+    { Command::Select, "Select" },
+};
+
+// Runs every document window on the UI thread, one frame of each in turn.
+// The windows share one tessellation pool, the font cache and the
+// instancing shader, so another document costs its layers' textures and
+// little else. SFML can only wait for the events of one window, so a lone
+// window sleeps until its next event while several are polled
+class GraphicsApp {
+private:
+    static constexpr int PollMilliseconds = 4; // Idle polling interval with several windows
+
+    GeometryBuilder geometry; // Declared before the windows, which use it
+    std::vector<std::unique_ptr<DocumentWindow>> windows;
+
+    // Lowest window number not in use, so a reopened window gets its files back
+    unsigned freeNumber() const {
+        for (unsigned candidate = 1;; ++candidate) {
+            bool taken = false;
+            for (const std::unique_ptr<DocumentWindow>& window : windows) {
+                taken = taken || window->getNumber() == candidate;
+            }
+            if (!taken) {
+                return candidate;
+            }
+        }
+    }
+
+    void openWindow() {
+        windows.push_back(std::unique_ptr<DocumentWindow>(new DocumentWindow(geometry, freeNumber())));
+    }
+
+public:
+    GraphicsApp() {
+        openWindow();
+    }
+
+    // The first window hosts a shared drawing, or joins one
+    bool host(unsigned short port) {
+        return windows.front()->hostSession(port);
+    }
+
+    void join(const std::string& address, unsigned short port) {
+        windows.front()->joinSession(address, port);
+    }
+
+    void run() {
+        while (!windows.empty()) {
+            bool drew = false;
+            bool mayWait = windows.size() == 1;
+            for (std::size_t i = 0; i < windows.size(); ++i) {
+                drew = windows[i]->update(mayWait) || drew;
+                if (windows[i]->takeNewWindowRequest()) {
+                    openWindow();
+                }
+            }
+
+            // A closed window is kept until its exports are written, as
+            // finishing them on destruction would block the other windows
+            for (std::size_t i = windows.size(); i-- > 0;) {
+                if (windows[i]->isFinished()) {
+                    windows.erase(windows.begin() + i);
+                }
+            }
+            if (!drew && !mayWait) {
+                sf::sleep(sf::milliseconds(PollMilliseconds));
+            }
+        }
+    }
+};
+
+static bool endsWith(const std::string& text, const std::string& suffix) {
+    return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// Builds a scene from a .2dv document or a script and exports it without
+// opening a window
+static int runHeadless(int argc, char** argv) {
+    const char* usage = "Usage: drawing --headless <scene.2dv|script.txt> [--png out.png] [--svg out.svg] "
+                        "[--save out.2dv] [--scale s] [--aa 0|2|4|8] [--supersample 1-4]";
+    if (argc < 3) {
+        std::cerr << usage << std::endl;
+        return 1;
+    }
+    std::string input = argv[2];
+    std::string pngFile, svgFile, saveFile;
+    float scale = 1.f;
+    Antialiasing quality = Antialiasing::exportDefault();
+    for (int i = 3; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--png" && i + 1 < argc) {
+            pngFile = argv[++i];
+        }
+        else if (arg == "--svg" && i + 1 < argc) {
+            svgFile = argv[++i];
+        }
+        else if (arg == "--save" && i + 1 < argc) {
+            saveFile = argv[++i];
+        }
+        else if (arg == "--scale" && i + 1 < argc) {
+            scale = static_cast<float>(std::atof(argv[++i]));
+            if (!(scale > 0.f)) {
+                std::cerr << "Scale must be positive" << std::endl;
+                return 1;
+            }
+        }
+        else if (arg == "--aa" && i + 1 < argc) {
+            int samples = std::atoi(argv[++i]);
+            if (samples != 0 && samples != 2 && samples != 4 && samples != 8) {
+                std::cerr << "Antialiasing must be 0, 2, 4 or 8 samples" << std::endl;
+                return 1;
+            }
+            quality.samples = static_cast<unsigned>(samples);
+        }
+        else if (arg == "--supersample" && i + 1 < argc) {
+            int factor = std::atoi(argv[++i]);
+            if (factor < 1 || factor > static_cast<int>(Antialiasing::MaxSupersample)) {
+                std::cerr << "Supersampling must be 1 to 4" << std::endl;
+                return 1;
+            }
+            quality.supersample = static_cast<unsigned>(factor);
+        }
+        else {
+            std::cerr << usage << std::endl;
+            return 1;
+        }
+    }
+
+    Scene scene;
+    if (endsWith(input, ".2dv")) {
+        if (!scene.load(input)) {
+            std::cerr << "Failed to read " << input << std::endl;
+            return 1;
+        }
+        scene.commit();
+    }
+    else {
+        std::ifstream script(input);
+        std::string error;
+        if (!script) {
+            std::cerr << "Failed to open " << input << std::endl;
+            return 1;
+        }
+        if (!SceneScript::run(script, scene, error)) {
+            std::cerr << input << ": " << error << std::endl;
+            return 1;
+        }
+    }
+
+    // An empty scene still exports the size of the window's canvas
+    sf::FloatRect area = scene.size() > 0 ? scene.getBounds() : sf::FloatRect(0.f, 0.f, 800.f, 600.f);
+    int status = 0;
+    if (!pngFile.empty() && !scene.exportPng(pngFile, area, scale, quality)) {
+        std::cerr << "Failed to export " << pngFile << std::endl;
+        status = 1;
+    }
+    if (!svgFile.empty()) {
+        sf::Vector2u size(static_cast<unsigned>(std::ceil(area.left + area.width)),
+                          static_cast<unsigned>(std::ceil(area.top + area.height)));
+        if (!scene.exportSvg(svgFile, size)) {
+            std::cerr << "Failed to export " << svgFile << std::endl;
+            status = 1;
+        }
+    }
+    if (!saveFile.empty() && !scene.save(saveFile)) {
+        std::cerr << "Failed to save " << saveFile << std::endl;
+        status = 1;
+    }
+    std::cout << scene.size() << " shapes" << std::endl;
+    return status;
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1 && std::string(argv[1]) == "--headless") {
+        return runHeadless(argc, argv);
+    }
+
+    // drawing --host [port] shares the first window's drawing; drawing
+    // --join <address> [port] edits the one shared there
+    std::string mode = argc > 1 ? argv[1] : "";
+    int portArgument = mode == "--join" ? 3 : 2;
+    int port = argc > portArgument ? std::atoi(argv[portArgument]) : NetworkSession::DefaultPort;
+    if ((mode != "" && mode != "--host" && mode != "--join") || (mode == "--join" && argc < 3)
+        || argc > portArgument + 1 || port <= 0 || port > 65535) {
+        std::cerr << "Usage: drawing [--host [port] | --join <address> [port] | --headless ...]" << std::endl;
+        return 1;
+    }
+
     GraphicsApp app;
+    if (mode == "--host" && !app.host(static_cast<unsigned short>(port))) {
+        std::cerr << "Failed to listen on port " << port << std::endl;
+    }
+    else if (mode == "--join") {
+        app.join(argv[2], static_cast<unsigned short>(port));
+    }
     app.run();
     return 0;
 }
@@ -0,0 +1,202 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "ShapeStore.h"
+
+// Uniform-grid spatial index over the shapes of a ShapeStore. Each shape is
+// registered in every cell its bounds overlap, so point picks and rectangle
+// queries only look at the shapes near the area of interest. Shapes too big
+// to register cell by cell are kept in a separate list that is always tested
+class SpatialGrid {
+public:
+    typedef std::uint32_t Index;
+
+private:
+    static constexpr int MaxCellsPerShape = 256;
+
+    float cellSize;
+    std::unordered_map<std::uint64_t, std::vector<Index>> cells;
+    std::vector<Index> oversized;
+    std::vector<sf::FloatRect> shapeBounds;
+    std::vector<bool> present;
+
+    // Used to report each shape once even if it spans several queried cells
+    mutable std::vector<std::uint32_t> stamps;
+    mutable std::uint32_t currentStamp = 0;
+
+    struct CellRange { int x0, y0, x1, y1; };
+
+    CellRange cellsFor(const sf::FloatRect& bounds) const {
+        return {
+            static_cast<int>(std::floor(bounds.left / cellSize)),
+            static_cast<int>(std::floor(bounds.top / cellSize)),
+            static_cast<int>(std::floor((bounds.left + bounds.width) / cellSize)),
+            static_cast<int>(std::floor((bounds.top + bounds.height) / cellSize))
+        };
+    }
+
+    static long long cellCount(const CellRange& range) {
+        return static_cast<long long>(range.x1 - range.x0 + 1) * (range.y1 - range.y0 + 1);
+    }
+
+    static std::uint64_t key(int x, int y) {
+        return (static_cast<std::uint64_t>(static_cast<std::uint32_t>(x)) << 32) | static_cast<std::uint32_t>(y);
+    }
+
+    static int keyX(std::uint64_t k) { return static_cast<int>(static_cast<std::uint32_t>(k >> 32)); }
+    static int keyY(std::uint64_t k) { return static_cast<int>(static_cast<std::uint32_t>(k)); }
+
+    void collect(const std::vector<Index>& candidates, const sf::FloatRect& area, std::vector<Index>& out) const {
+        for (Index index : candidates) {
+            if (stamps[index] != currentStamp && shapeBounds[index].intersects(area)) {
+                stamps[index] = currentStamp;
+                out.push_back(index);
+            }
+        }
+    }
+
+public:
+    explicit SpatialGrid(float cellSize = 64.f)
+        : cellSize(cellSize) {
+    }
+
+    std::size_t size() const { return shapeBounds.size(); }
+
+    // Makes room for shapes with indices below `count`
+    void reserve(std::size_t count) {
+        shapeBounds.reserve(count);
+        present.reserve(count);
+        stamps.reserve(count);
+    }
+
+    void clear() {
+        cells.clear();
+        oversized.clear();
+        shapeBounds.clear();
+        present.clear();
+        stamps.clear();
+    }
+
+    void insert(Index index, const sf::FloatRect& bounds) {
+        if (index >= shapeBounds.size()) {
+            shapeBounds.resize(index + 1);
+            present.resize(index + 1, false);
+            stamps.resize(index + 1, currentStamp);
+        }
+        shapeBounds[index] = bounds;
+        present[index] = true;
+
+        CellRange range = cellsFor(bounds);
+        if (cellCount(range) > MaxCellsPerShape) {
+            oversized.push_back(index);
+            return;
+        }
+        for (int y = range.y0; y <= range.y1; ++y) {
+            for (int x = range.x0; x <= range.x1; ++x) {
+                cells[key(x, y)].push_back(index);
+            }
+        }
+    }
+
+    void remove(Index index) {
+        if (index >= shapeBounds.size() || !present[index]) {
+            return;
+        }
+        present[index] = false;
+
+        CellRange range = cellsFor(shapeBounds[index]);
+        if (cellCount(range) > MaxCellsPerShape) {
+            oversized.erase(std::remove(oversized.begin(), oversized.end(), index), oversized.end());
+        }
+        else {
+            for (int y = range.y0; y <= range.y1; ++y) {
+                for (int x = range.x0; x <= range.x1; ++x) {
+                    auto cell = cells.find(key(x, y));
+                    if (cell == cells.end()) {
+                        continue;
+                    }
+                    std::vector<Index>& entries = cell->second;
+                    entries.erase(std::remove(entries.begin(), entries.end(), index), entries.end());
+                    if (entries.empty()) {
+                        cells.erase(cell);
+                    }
+                }
+            }
+        }
+
+        // Keep the tables tight when the most recent shapes are removed, which
+        // is what undo does
+        while (!present.empty() && !present.back()) {
+            present.pop_back();
+            shapeBounds.pop_back();
+            stamps.pop_back();
+        }
+    }
+
+    // Moves a shape to new bounds; only the cells it leaves and enters are touched
+    void update(Index index, const sf::FloatRect& bounds) {
+        remove(index);
+        insert(index, bounds);
+    }
+
+    // Re-registers every shape of a store, e.g. after a bulk change
+    void rebuild(const ShapeStore& shapes) {
+        clear();
+        for (std::size_t i = 0; i < shapes.size(); ++i) {
+            insert(static_cast<Index>(i), shapes.bounds(i));
+        }
+    }
+
+    // Collects the shapes whose bounds overlap `area`, in drawing order
+    void query(const sf::FloatRect& area, std::vector<Index>& out) const {
+        out.clear();
+        if (++currentStamp == 0) {
+            std::fill(stamps.begin(), stamps.end(), 0);
+            currentStamp = 1;
+        }
+
+        CellRange range = cellsFor(area);
+        if (cellCount(range) > static_cast<long long>(cells.size())) {
+            // The area covers more cells than are occupied; walk the occupied ones
+            for (const auto& cell : cells) {
+                int x = keyX(cell.first);
+                int y = keyY(cell.first);
+                if (x >= range.x0 && x <= range.x1 && y >= range.y0 && y <= range.y1) {
+                    collect(cell.second, area, out);
+                }
+            }
+        }
+        else {
+            for (int y = range.y0; y <= range.y1; ++y) {
+                for (int x = range.x0; x <= range.x1; ++x) {
+                    auto cell = cells.find(key(x, y));
+                    if (cell != cells.end()) {
+                        collect(cell->second, area, out);
+                    }
+                }
+            }
+        }
+        collect(oversized, area, out);
+
+        std::sort(out.begin(), out.end());
+    }
+
+    // Index of the topmost shape under `point`, or shapes.size() if there is none
+    std::size_t pick(const ShapeStore& shapes, const sf::Vector2f& point, float tolerance) const {
+        std::vector<Index> candidates;
+        query(sf::FloatRect(point.x - tolerance, point.y - tolerance, 2 * tolerance, 2 * tolerance), candidates);
+        for (auto it = candidates.rbegin(); it != candidates.rend(); ++it) {
+            if (shapes.hitTest(*it, point, tolerance)) {
+                return *it;
+            }
+        }
+        return shapes.size();
+    }
+};
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+#include <cstddef>
+#include <vector>
+
+#include "ShapeStore.h"
+
+// Simplifies a freehand stroke while it is being drawn, so only the points
+// that shape it are ever stored. Incoming points are collected in a run
+// starting at the last kept point; as soon as the chord from that point to
+// the newest one strays more than `tolerance` from any point of the run,
+// the previous point is kept and a new run starts there. This is a greedy,
+// streaming form of Ramer-Douglas-Peucker: the work per mouse move is
+// bounded by the run length, and nothing is revisited once kept
+class StrokeBuilder {
+private:
+    static const std::size_t MaxRunLength = 256;
+
+    float pixelTolerance; // In window pixels
+    float pixelSpacing;
+    float tolerance;      // In the units of the stroke's points
+    float minSpacing;
+    std::vector<sf::Vector2f> kept;
+    std::vector<sf::Vector2f> run; // Candidate points after the last kept one
+    std::size_t received = 0;
+
+    // True if every point of the run lies within tolerance of anchor..end
+    bool chordFits(const sf::Vector2f& anchor, const sf::Vector2f& end) const {
+        for (const sf::Vector2f& p : run) {
+            if (ShapeStore::distanceToSegment(p, anchor, end) > tolerance) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+public:
+    // `tolerance` and `minSpacing` are in window pixels
+    explicit StrokeBuilder(float tolerance = 0.75f, float minSpacing = 1.5f)
+        : pixelTolerance(tolerance), pixelSpacing(minSpacing), tolerance(tolerance), minSpacing(minSpacing) {
+    }
+
+    // Starts a stroke whose points are `unitsPerPixel` units per window
+    // pixel apart, so it keeps the same detail on screen at any zoom
+    void begin(const sf::Vector2f& point, float unitsPerPixel = 1.f) {
+        tolerance = pixelTolerance * unitsPerPixel;
+        minSpacing = pixelSpacing * unitsPerPixel;
+        kept.assign(1, point);
+        run.clear();
+        received = 1;
+    }
+
+    void add(const sf::Vector2f& point) {
+        ++received;
+        // Mouse jitter below the spacing would only produce redundant points
+        const sf::Vector2f& previous = run.empty() ? kept.back() : run.back();
+        sf::Vector2f d = point - previous;
+        if (d.x * d.x + d.y * d.y < minSpacing * minSpacing) {
+            return;
+        }
+
+        if (!run.empty() && (run.size() >= MaxRunLength || !chordFits(kept.back(), point))) {
+            kept.push_back(run.back());
+            run.clear();
+        }
+        run.push_back(point);
+    }
+
+    // Ends the stroke and returns its simplified points
+    const std::vector<sf::Vector2f>& finish() {
+        if (!run.empty()) {
+            kept.push_back(run.back());
+            run.clear();
+        }
+        return kept;
+    }
+
+    // Points kept so far; the newest point is `tip()` until the stroke is finished
+    const std::vector<sf::Vector2f>& getPoints() const { return kept; }
+    const sf::Vector2f& tip() const { return run.empty() ? kept.back() : run.back(); }
+
+    // Number of points given to the builder, before simplification
+    std::size_t getReceivedCount() const { return received; }
+};
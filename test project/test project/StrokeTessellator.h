@@ -0,0 +1,274 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+// Turns lines and outlines of any width into anti-aliased triangles. Each
+// edge of a stroke gets a one pixel wide feather whose outer vertices are
+// transparent, so the GPU's colour interpolation does the anti-aliasing and
+// the triangles can be batched with everything else. Strokes thinner than
+// a pixel keep a one pixel footprint and fade out instead. Straight runs
+// share a mitred cross-section between segments, so a smooth polyline costs
+// 18 vertices per segment (12 below two pixels wide); only corners sharp
+// enough to show get extra join geometry
+class StrokeTessellator {
+public:
+    enum class Join { Miter, Bevel, Round };
+    enum class Cap { Butt, Square, Round };
+
+    static constexpr float MiterLimit = 4.f;   // Longest miter, in half widths, before it is bevelled
+    static constexpr float RoundSlack = 0.05f; // Round joins this close to a miter, relative to the half width, are mitred
+    static constexpr float MaxArcError = 0.25f; // Largest gap between an arc and its polygon, in pixels
+
+private:
+    // Cross-section of a stroke: the opaque core and the feather around it,
+    // as half widths, and the colours at the core and the feather's edge
+    struct Profile {
+        float core;
+        float feather;
+        sf::Color solid;
+        sf::Color clear;
+    };
+
+    static Profile profile(float halfWidth, float pixelSize, const sf::Color& color) {
+        Profile p;
+        p.core = std::max(halfWidth - pixelSize / 2, 0.f);
+        p.feather = std::max(halfWidth, pixelSize / 2) + pixelSize / 2;
+        float coverage = pixelSize > 0.f ? std::min(1.f, 2 * halfWidth / pixelSize) : 1.f;
+        p.solid = color;
+        p.solid.a = static_cast<sf::Uint8>(color.a * coverage + 0.5f);
+        p.clear = color;
+        p.clear.a = 0;
+        return p;
+    }
+
+    static sf::Vector2f normalize(const sf::Vector2f& v) {
+        float length = std::sqrt(v.x * v.x + v.y * v.y);
+        return length > 0.f ? v / length : sf::Vector2f();
+    }
+
+    // Left-hand normal of a direction
+    static sf::Vector2f normal(const sf::Vector2f& d) {
+        return sf::Vector2f(-d.y, d.x);
+    }
+
+    static float dot(const sf::Vector2f& a, const sf::Vector2f& b) { return a.x * b.x + a.y * b.y; }
+    static float cross(const sf::Vector2f& a, const sf::Vector2f& b) { return a.x * b.y - a.y * b.x; }
+
+    static void quad(std::vector<sf::Vertex>& out, const sf::Vector2f& a, const sf::Vector2f& b,
+                     const sf::Vector2f& c, const sf::Vector2f& d,
+                     const sf::Color& ab, const sf::Color& cd) {
+        out.emplace_back(a, ab);
+        out.emplace_back(b, ab);
+        out.emplace_back(c, cd);
+        out.emplace_back(a, ab);
+        out.emplace_back(c, cd);
+        out.emplace_back(d, cd);
+    }
+
+    // The stroke between cross-sections centred on c0 and c1. m0 and m1 point
+    // across the stroke and are one half width long for square cuts, longer
+    // for mitred ones
+    static void band(std::vector<sf::Vertex>& out, const Profile& p,
+                     const sf::Vector2f& c0, const sf::Vector2f& m0, const sf::Vector2f& c1, const sf::Vector2f& m1) {
+        if (p.core > 0.f) {
+            quad(out, c0 + m0 * p.core, c1 + m1 * p.core, c1 - m1 * p.core, c0 - m0 * p.core, p.solid, p.solid);
+        }
+        quad(out, c0 + m0 * p.core, c1 + m1 * p.core, c1 + m1 * p.feather, c0 + m0 * p.feather, p.solid, p.clear);
+        quad(out, c0 - m0 * p.core, c1 - m1 * p.core, c1 - m1 * p.feather, c0 - m0 * p.feather, p.solid, p.clear);
+    }
+
+    // Feathers a butt or square end at cross-section (c, m), fading out along `outward`
+    static void endFeather(std::vector<sf::Vertex>& out, const Profile& p, const sf::Vector2f& c,
+                           const sf::Vector2f& m, const sf::Vector2f& outward, float pixelSize) {
+        sf::Vector2f shift = outward * pixelSize;
+        sf::Vector2f row[4] = { c - m * p.feather, c - m * p.core, c + m * p.core, c + m * p.feather };
+        const sf::Color colors[4] = { p.clear, p.solid, p.solid, p.clear };
+        for (int i = 0; i < 3; ++i) {
+            out.emplace_back(row[i], colors[i]);
+            out.emplace_back(row[i + 1], colors[i + 1]);
+            out.emplace_back(row[i + 1] + shift, p.clear);
+            out.emplace_back(row[i], colors[i]);
+            out.emplace_back(row[i + 1] + shift, p.clear);
+            out.emplace_back(row[i] + shift, p.clear);
+        }
+    }
+
+    // Round piece of a stroke around `center`, sweeping `angle` radians from
+    // the unit direction `from`
+    static void fan(std::vector<sf::Vertex>& out, const Profile& p, const sf::Vector2f& center,
+                    const sf::Vector2f& from, float angle, float pixelSize) {
+        float radius = p.feather / pixelSize;
+        float step = radius > MaxArcError ? 2 * std::acos(1 - MaxArcError / radius) : 3.141592654f;
+        int steps = std::max(1, std::min(64, static_cast<int>(std::ceil(std::abs(angle) / step))));
+        float c = std::cos(angle / steps);
+        float s = std::sin(angle / steps);
+        sf::Vector2f u = from;
+        for (int i = 0; i < steps; ++i) {
+            sf::Vector2f v(u.x * c - u.y * s, u.x * s + u.y * c);
+            if (p.core > 0.f) {
+                out.emplace_back(center, p.solid);
+                out.emplace_back(center + u * p.core, p.solid);
+                out.emplace_back(center + v * p.core, p.solid);
+            }
+            quad(out, center + u * p.core, center + v * p.core, center + v * p.feather, center + u * p.feather,
+                 p.solid, p.clear);
+            u = v;
+        }
+    }
+
+    static std::size_t nextDistinct(const sf::Vector2f* points, std::size_t count, std::size_t i) {
+        std::size_t j = i + 1;
+        while (j < count && points[j] == points[i]) {
+            ++j;
+        }
+        return j;
+    }
+
+public:
+    // Appends a polyline `width` scene units wide through `count` points.
+    // `pixelSize` is the size of a pixel in scene units, which sets the
+    // feather and the detail of round parts
+    static void polyline(std::vector<sf::Vertex>& out, const sf::Vector2f* points, std::size_t count, float width,
+                         const sf::Color& color, float pixelSize, Join join = Join::Round, Cap cap = Cap::Round) {
+        if (count == 0) {
+            return;
+        }
+        float half = width / 2;
+        Profile p = profile(half, pixelSize, color);
+        float extension = cap == Cap::Square ? half : 0.f;
+
+        std::size_t current = 0;
+        std::size_t next = nextDistinct(points, count, 0);
+        if (next == count) {
+            // A single point is a dot, unless the ends are cut flush
+            if (cap == Cap::Round) {
+                fan(out, p, points[0], sf::Vector2f(1, 0), 2 * 3.141592654f, pixelSize);
+            }
+            else if (cap == Cap::Square) {
+                sf::Vector2f d(half, 0);
+                band(out, p, points[0] - d, sf::Vector2f(0, 1), points[0] + d, sf::Vector2f(0, 1));
+                endFeather(out, p, points[0] - d, sf::Vector2f(0, 1), sf::Vector2f(-1, 0), pixelSize);
+                endFeather(out, p, points[0] + d, sf::Vector2f(0, 1), sf::Vector2f(1, 0), pixelSize);
+            }
+            return;
+        }
+
+        sf::Vector2f direction = normalize(points[next] - points[current]);
+        sf::Vector2f across = normal(direction);
+        sf::Vector2f start = points[0] - direction * extension;
+        if (cap == Cap::Round) {
+            fan(out, p, start, across, 3.141592654f, pixelSize);
+        }
+        else {
+            endFeather(out, p, start, across, -direction, pixelSize);
+        }
+
+        // Cross-section the current segment starts from
+        sf::Vector2f sectionCenter = start;
+        sf::Vector2f section = across;
+        for (;;) {
+            current = next;
+            next = nextDistinct(points, count, current);
+            if (next == count) {
+                break;
+            }
+
+            sf::Vector2f nextDirection = normalize(points[next] - points[current]);
+            sf::Vector2f nextAcross = normal(nextDirection);
+            float bend = 1 + dot(across, nextAcross);
+            sf::Vector2f miter = bend > 1e-4f ? (across + nextAcross) / bend : sf::Vector2f();
+            float miterLength = std::sqrt(dot(miter, miter));
+            bool mitred;
+            if (join == Join::Miter) {
+                mitred = bend > 1e-4f && miterLength <= MiterLimit;
+            }
+            else {
+                // Nearly straight joins look the same however they are drawn
+                mitred = bend > 1e-4f && (miterLength - 1) * half <= std::min(RoundSlack * half, pixelSize / 2);
+            }
+
+            const sf::Vector2f& corner = points[current];
+            if (mitred) {
+                band(out, p, sectionCenter, section, corner, miter);
+                section = miter;
+            }
+            else {
+                band(out, p, sectionCenter, section, corner, across);
+                // Fill the gap on the outside of the turn
+                float side = cross(direction, nextDirection) > 0 ? -1.f : 1.f;
+                sf::Vector2f from = across * side;
+                sf::Vector2f to = nextAcross * side;
+                if (join == Join::Bevel || join == Join::Miter) {
+                    out.emplace_back(corner, p.solid);
+                    out.emplace_back(corner + from * p.core, p.solid);
+                    out.emplace_back(corner + to * p.core, p.solid);
+                    quad(out, corner + from * p.core, corner + to * p.core, corner + to * p.feather, corner + from * p.feather,
+                         p.solid, p.clear);
+                }
+                else {
+                    fan(out, p, corner, from, std::atan2(cross(from, to), dot(from, to)), pixelSize);
+                }
+                section = nextAcross;
+            }
+            sectionCenter = corner;
+            direction = nextDirection;
+            across = nextAcross;
+        }
+
+        sf::Vector2f end = points[current] + direction * extension;
+        band(out, p, sectionCenter, section, end, across);
+        if (cap == Cap::Round) {
+            fan(out, p, end, across, -3.141592654f, pixelSize);
+        }
+        else {
+            endFeather(out, p, end, across, direction, pixelSize);
+        }
+    }
+
+    // Appends the outline of a closed polygon, growing outwards from it by
+    // `thickness` with mitred corners like sf::Shape::setOutlineThickness
+    static void outline(std::vector<sf::Vertex>& out, const sf::Vector2f* points, std::size_t count, float thickness,
+                        const sf::Color& color, float pixelSize) {
+        if (count < 2) {
+            return;
+        }
+        sf::Vector2f center;
+        for (std::size_t i = 0; i < count; ++i) {
+            center += points[i];
+        }
+        center /= static_cast<float>(count);
+
+        float half = thickness / 2;
+        Profile p = profile(half, pixelSize, color);
+        sf::Vector2f firstMiter, previousMiter;
+        for (std::size_t i = 0; i <= count; ++i) {
+            std::size_t index = i % count;
+            sf::Vector2f miter = firstMiter;
+            if (i < count) {
+                const sf::Vector2f& p0 = points[(index + count - 1) % count];
+                const sf::Vector2f& p1 = points[index];
+                const sf::Vector2f& p2 = points[(index + 1) % count];
+                sf::Vector2f n1 = normal(normalize(p1 - p0));
+                sf::Vector2f n2 = normal(normalize(p2 - p1));
+
+                // Make both normals point away from the shape, whatever the winding
+                if (dot(n1, center - p1) > 0) n1 = -n1;
+                if (dot(n2, center - p1) > 0) n2 = -n2;
+                float bend = 1 + dot(n1, n2);
+                miter = bend != 0.f ? (n1 + n2) / bend : n1;
+            }
+            if (i == 0) {
+                firstMiter = miter;
+            }
+            else {
+                const sf::Vector2f& previous = points[i - 1];
+                band(out, p, previous + previousMiter * half, previousMiter, points[index] + miter * half, miter);
+            }
+            previousMiter = miter;
+        }
+    }
+};
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Colour and width of a shape
+struct ShapeStyle {
+    sf::Color color;
+    float width;
+};
+
+// The style of every shape in a ShapeStore, kept as an index into a palette
+// of the distinct styles. Drawings use a handful of colours and widths, so
+// a shape costs two bytes here instead of eight; a store that collects more
+// than NarrowLimit distinct styles switches to four-byte indices. Styles no
+// shape uses any more, e.g. left behind by a drag that rescaled widths, are
+// dropped once the palette outgrows the shapes
+class StyleTable {
+public:
+    static const std::size_t NarrowLimit = 65536;
+
+private:
+    std::vector<ShapeStyle> palette;
+    std::unordered_map<std::uint64_t, std::uint32_t> lookup; // Style key to palette index
+    std::vector<std::uint16_t> narrow; // Index of each shape's style; empty once wide
+    std::vector<std::uint32_t> wide;
+    bool isWide = false;
+
+    std::uint32_t raw(std::size_t row) const {
+        return isWide ? wide[row] : narrow[row];
+    }
+
+    void setRaw(std::size_t row, std::uint32_t index) {
+        if (isWide) {
+            wide[row] = index;
+        }
+        else {
+            narrow[row] = static_cast<std::uint16_t>(index);
+        }
+    }
+
+    // Rebuilds the palette from the styles still in use
+    void compact() {
+        const std::uint32_t unused = 0xFFFFFFFFu;
+        std::vector<std::uint32_t> remap(palette.size(), unused);
+        std::vector<ShapeStyle> kept;
+        lookup.clear();
+        for (std::size_t row = 0; row < size(); ++row) {
+            std::uint32_t index = raw(row);
+            if (remap[index] == unused) {
+                remap[index] = static_cast<std::uint32_t>(kept.size());
+                kept.push_back(palette[index]);
+                lookup.emplace(key(palette[index].color, palette[index].width), remap[index]);
+            }
+            setRaw(row, remap[index]);
+        }
+        palette.swap(kept);
+    }
+
+    void widen() {
+        wide.assign(narrow.begin(), narrow.end());
+        narrow.clear();
+        narrow.shrink_to_fit();
+        isWide = true;
+    }
+
+    // Palette index of a style, adding it if it is new
+    std::uint32_t indexOf(const sf::Color& color, float width) {
+        std::uint64_t styleKey = key(color, width);
+        auto found = lookup.find(styleKey);
+        if (found != lookup.end()) {
+            return found->second;
+        }
+        if (palette.size() >= 2 * size() + 256) {
+            compact();
+        }
+        if (!isWide && palette.size() >= NarrowLimit) {
+            widen();
+        }
+        std::uint32_t index = static_cast<std::uint32_t>(palette.size());
+        palette.push_back(ShapeStyle{ color, width });
+        lookup.emplace(styleKey, index);
+        return index;
+    }
+
+public:
+    // Identifies a style; equal keys mean equal colours and bit-identical widths
+    static std::uint64_t key(const sf::Color& color, float width) {
+        std::uint32_t bits;
+        std::memcpy(&bits, &width, sizeof(bits));
+        std::uint32_t rgba = (static_cast<std::uint32_t>(color.r) << 24) | (static_cast<std::uint32_t>(color.g) << 16)
+            | (static_cast<std::uint32_t>(color.b) << 8) | color.a;
+        return (static_cast<std::uint64_t>(rgba) << 32) | bits;
+    }
+
+    std::size_t size() const { return isWide ? wide.size() : narrow.size(); }
+    std::size_t paletteSize() const { return palette.size(); }
+
+    const ShapeStyle& operator[](std::size_t row) const {
+        return palette[raw(row)];
+    }
+
+    // Styles are taken by value, as they may live in this table's palette
+    void push(sf::Color color, float width) {
+        std::uint32_t index = indexOf(color, width);
+        if (isWide) {
+            wide.push_back(index);
+        }
+        else {
+            narrow.push_back(static_cast<std::uint16_t>(index));
+        }
+    }
+
+    void set(std::size_t row, sf::Color color, float width) {
+        setRaw(row, indexOf(color, width));
+    }
+
+    void reserve(std::size_t count) {
+        if (isWide) {
+            wide.reserve(count);
+        }
+        else {
+            narrow.reserve(count);
+        }
+    }
+
+    // Keeps the first `count` rows
+    void truncate(std::size_t count) {
+        if (isWide) {
+            wide.resize(count);
+        }
+        else {
+            narrow.resize(count);
+        }
+    }
+
+    void clear() {
+        palette.clear();
+        lookup.clear();
+        narrow.clear();
+        wide.clear();
+        isWide = false;
+    }
+
+    void swap(StyleTable& other) {
+        palette.swap(other.palette);
+        lookup.swap(other.lookup);
+        narrow.swap(other.narrow);
+        wide.swap(other.wide);
+        std::swap(isWide, other.isWide);
+    }
+
+    // Bytes held, including spare capacity and an estimate for the lookup table
+    std::size_t memoryUsage() const {
+        return narrow.capacity() * sizeof(std::uint16_t) + wide.capacity() * sizeof(std::uint32_t)
+            + palette.capacity() * sizeof(ShapeStyle) + lookup.bucket_count() * sizeof(void*)
+            + lookup.size() * (sizeof(std::pair<const std::uint64_t, std::uint32_t>) + 2 * sizeof(void*));
+    }
+};
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <string>
+
+#include "ShapeStore.h"
+
+// Streams a ShapeStore out as SVG, one element per shape, without building
+// the document in memory first
+class SvgWriter {
+private:
+    static void writeColor(std::ofstream& file, const sf::Color& color) {
+        file << "rgb(" << static_cast<int>(color.r) << ',' << static_cast<int>(color.g) << ','
+             << static_cast<int>(color.b) << ')';
+        if (color.a != 255) {
+            file << "\" stroke-opacity=\"" << color.a / 255.f;
+        }
+    }
+
+public:
+    static bool save(const ShapeStore& shapes, const sf::Vector2u& size, const std::string& filename) {
+        std::ofstream file(filename, std::ios::trunc);
+        if (!file) {
+            return false;
+        }
+
+        file << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+             << "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"" << size.x << "\" height=\"" << size.y
+             << "\" viewBox=\"0 0 " << size.x << ' ' << size.y << "\">\n"
+             << "<rect width=\"100%\" height=\"100%\" fill=\"black\"/>\n";
+
+        for (std::size_t i = 0; i < shapes.size(); ++i) {
+            const sf::Vector2f& a = shapes.start(i);
+            const sf::Vector2f& e = shapes.extent(i);
+            // Outlines grow outwards while SVG strokes are centred on the path,
+            // so rectangles and circles are pushed out by half the outline thickness
+            const float thickness = shapes.width(i);
+            const float half = thickness / 2;
+            switch (shapes.kind(i)) {
+            case ShapeKind::Line:
+                file << "<line x1=\"" << a.x << "\" y1=\"" << a.y << "\" x2=\"" << e.x << "\" y2=\"" << e.y
+                     << "\" stroke-width=\"" << thickness << "\" stroke-linecap=\"round\" stroke=\"";
+                break;
+            case ShapeKind::Rectangle:
+                file << "<rect x=\"" << std::min(a.x, a.x + e.x) - half << "\" y=\"" << std::min(a.y, a.y + e.y) - half
+                     << "\" width=\"" << std::abs(e.x) + thickness << "\" height=\"" << std::abs(e.y) + thickness
+                     << "\" fill=\"none\" stroke-width=\"" << thickness << "\" stroke=\"";
+                break;
+            case ShapeKind::Circle:
+                file << "<circle cx=\"" << a.x + e.x << "\" cy=\"" << a.y + e.x << "\" r=\"" << e.x + half
+                     << "\" fill=\"none\" stroke-width=\"" << thickness << "\" stroke=\"";
+                break;
+            case ShapeKind::Stroke: {
+                file << "<polyline points=\"";
+                const sf::Vector2f* points = shapes.pointData(i);
+                for (std::size_t j = 0; j < shapes.pointCount(i); ++j) {
+                    file << (j > 0 ? " " : "") << points[j].x << ',' << points[j].y;
+                }
+                file << "\" fill=\"none\" stroke-width=\"" << thickness
+                     << "\" stroke-linecap=\"round\" stroke-linejoin=\"round\" stroke=\"";
+                break;
+            }
+            }
+            writeColor(file, shapes.color(i));
+            file << "\"/>\n";
+        }
+
+        file << "</svg>\n";
+        return static_cast<bool>(file);
+    }
+};
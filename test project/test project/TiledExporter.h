@@ -0,0 +1,93 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "Antialiasing.h"
+#include "PngStreamWriter.h"
+#include "RenderBatch.h"
+#include "ShapeStore.h"
+#include "SpatialGrid.h"
+
+// Renders an area of the scene at an arbitrary scale into a PNG, one
+// GPU-sized tile at a time. Only one row of tiles is ever held in memory,
+// and it is streamed to the PNG encoder as soon as it is complete, so the
+// output size is limited by disk space rather than by texture or RAM limits.
+// With supersampling, each tile is rendered larger and averaged down to
+// its slice of the output before it joins the band
+class TiledExporter {
+public:
+    static bool save(const ShapeStore& shapes, const SpatialGrid& index, const sf::FloatRect& area,
+                     float scale, const std::string& filename, const Antialiasing& quality = Antialiasing(),
+                     unsigned maxTileSize = 2048) {
+        unsigned width = static_cast<unsigned>(std::ceil(area.width * scale));
+        unsigned height = static_cast<unsigned>(std::ceil(area.height * scale));
+        unsigned tileSize = std::min(maxTileSize, sf::Texture::getMaximumSize());
+        unsigned factor = std::min(std::max(quality.supersample, 1u), tileSize);
+        tileSize /= factor; // In output pixels
+        if (width == 0 || height == 0 || tileSize == 0) {
+            return false;
+        }
+
+        sf::RenderTexture tile;
+        if (!tile.create(std::min(tileSize, width) * factor, std::min(tileSize, height) * factor,
+                         quality.contextSettings())) {
+            return false;
+        }
+
+        PngStreamWriter png;
+        if (!png.open(filename, width, height)) {
+            return false;
+        }
+
+        sf::Vector2u tileExtent = tile.getSize() / factor;
+        std::vector<sf::Uint8> band(static_cast<std::size_t>(width) * tileExtent.y * 4);
+        std::vector<SpatialGrid::Index> visible;
+        RenderBatch batch;
+
+        for (unsigned y = 0; y < height; y += tileExtent.y) {
+            unsigned bandHeight = std::min(tileExtent.y, height - y);
+
+            for (unsigned x = 0; x < width; x += tileExtent.x) {
+                unsigned tileWidth = std::min(tileExtent.x, width - x);
+
+                // The view maps this tile's slice of the scene onto the whole render texture
+                sf::FloatRect world(area.left + x / scale, area.top + y / scale,
+                                    tileExtent.x / scale, tileExtent.y / scale);
+                index.query(world, visible);
+                batch.clear();
+                for (SpatialGrid::Index i : visible) {
+                    shapes.appendTo(i, batch, scale * factor);
+                }
+
+                tile.setView(sf::View(world));
+                tile.clear(sf::Color::Black);
+                batch.draw(tile);
+                tile.display();
+
+                sf::Image pixels = tile.getTexture().copyToImage();
+                const sf::Uint8* source = pixels.getPixelsPtr();
+                if (factor > 1) {
+                    Antialiasing::downsample(source, tile.getSize().x, factor, tileWidth, bandHeight,
+                                             &band[static_cast<std::size_t>(x) * 4], static_cast<std::size_t>(width) * 4);
+                    continue;
+                }
+                for (unsigned row = 0; row < bandHeight; ++row) {
+                    std::memcpy(&band[(static_cast<std::size_t>(row) * width + x) * 4],
+                                source + static_cast<std::size_t>(row) * tileExtent.x * 4,
+                                static_cast<std::size_t>(tileWidth) * 4);
+                }
+            }
+
+            for (unsigned row = 0; row < bandHeight; ++row) {
+                png.writeRow(&band[static_cast<std::size_t>(row) * width * 4]);
+            }
+        }
+
+        return png.close();
+    }
+};
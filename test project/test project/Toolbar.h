@@ -0,0 +1,136 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "RenderBatch.h"
+
+// The row of buttons and the help text above the canvas. Buttons are added
+// as (id, label) pairs and laid out left to right, and the whole toolbar is
+// rendered once into a texture that is only redrawn when a button's state
+// changes, so each frame costs one sprite however many buttons there are
+class Toolbar {
+public:
+    static constexpr float ButtonWidth = 100.f;
+    static constexpr float ButtonHeight = 50.f;
+    static constexpr float Spacing = 10.f;
+    static const int NoButton = -1;
+
+private:
+    struct Item {
+        int id;
+        sf::FloatRect bounds;
+        sf::Text label;
+    };
+
+    const sf::Font& font;
+    std::vector<Item> items;
+    sf::Text caption;
+    int hovered = NoButton; // Id of the button under the cursor
+    int active = NoButton;  // Id of the button shown as selected
+    unsigned width;
+
+    sf::RenderTexture cache;
+    bool dirty = true;
+
+    void rebuild() {
+        sf::FloatRect text = caption.getGlobalBounds();
+        float bottom = std::max(Spacing + ButtonHeight, text.top + text.height) + Spacing;
+        unsigned height = static_cast<unsigned>(std::ceil(bottom));
+        if ((cache.getSize().x != width || cache.getSize().y != height) && !cache.create(width, height)) {
+            return;
+        }
+
+        // The window is cleared to black as well, so text is blended onto
+        // the same background it would have been drawn over directly
+        cache.clear(sf::Color::Black);
+        sf::RectangleShape button;
+        for (const Item& item : items) {
+            button.setPosition(item.bounds.left, item.bounds.top);
+            button.setSize(sf::Vector2f(item.bounds.width, item.bounds.height));
+            if (item.id == active) {
+                button.setFillColor(sf::Color(70, 110, 170));
+            }
+            else if (item.id == hovered) {
+                button.setFillColor(sf::Color(130, 130, 130));
+            }
+            else {
+                button.setFillColor(sf::Color(100, 100, 100)); // Dark grey background
+            }
+            cache.draw(button);
+            cache.draw(item.label);
+        }
+        cache.draw(caption);
+        cache.display();
+        dirty = false;
+    }
+
+public:
+    Toolbar(unsigned toolbarWidth, const sf::Font& labelFont) : font(labelFont), width(toolbarWidth) {
+        caption.setFont(font);
+        caption.setCharacterSize(20);
+        caption.setFillColor(sf::Color::White);
+        caption.setPosition(Spacing, Spacing + ButtonHeight + Spacing);
+    }
+
+    // Appends a button to the right of the last one
+    void add(int id, const std::string& text) {
+        Item item;
+        item.id = id;
+        item.bounds = sf::FloatRect(Spacing + items.size() * (ButtonWidth + Spacing), Spacing, ButtonWidth, ButtonHeight);
+        item.label.setFont(font);
+        item.label.setString(text);
+        item.label.setCharacterSize(18);
+        item.label.setFillColor(sf::Color::White);
+        item.label.setPosition(item.bounds.left + 10, item.bounds.top + 10);
+        items.push_back(item);
+        dirty = true;
+    }
+
+    // Help text shown below the buttons
+    void setCaption(const std::string& text) {
+        caption.setString(text);
+        dirty = true;
+    }
+
+    // Id of the button at `position`, or NoButton
+    int hit(const sf::Vector2i& position) const {
+        sf::Vector2f point(position);
+        for (const Item& item : items) {
+            if (item.bounds.contains(point)) {
+                return item.id;
+            }
+        }
+        return NoButton;
+    }
+
+    // Highlights the button under the cursor; returns true if that changed
+    bool hover(const sf::Vector2i& position) {
+        int id = hit(position);
+        if (id == hovered) {
+            return false;
+        }
+        hovered = id;
+        dirty = true;
+        return true;
+    }
+
+    // Shows button `id` as selected, or none with NoButton
+    void setActive(int id) {
+        if (id != active) {
+            active = id;
+            dirty = true;
+        }
+    }
+
+    void draw(sf::RenderTarget& target) {
+        if (dirty) {
+            rebuild();
+        }
+        target.draw(sf::Sprite(cache.getTexture()));
+        RenderStats::count(4);
+    }
+};